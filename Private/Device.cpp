@@ -19,30 +19,35 @@ template <typename TDerived>
 CImage::Ref CDeviceBase<TDerived>::CreateImage1D(EFormat format, EImageUsageFlags usage,
                                                  uint32_t width, uint32_t mipLevels,
                                                  uint32_t arrayLayers, uint32_t sampleCount,
-                                                 const void* initialData)
+                                                 const void* initialData,
+                                                 EFormat initialDataFormat)
 {
     return static_cast<TDerived*>(this)->CreateImage1D(format, usage, width, mipLevels, arrayLayers,
-                                                       sampleCount, initialData);
+                                                       sampleCount, initialData, initialDataFormat);
 }
 
 template <typename TDerived>
 CImage::Ref CDeviceBase<TDerived>::CreateImage2D(EFormat format, EImageUsageFlags usage,
                                                  uint32_t width, uint32_t height,
                                                  uint32_t mipLevels, uint32_t arrayLayers,
-                                                 uint32_t sampleCount, const void* initialData)
+                                                 uint32_t sampleCount, const void* initialData,
+                                                 EFormat initialDataFormat)
 {
     return static_cast<TDerived*>(this)->CreateImage2D(format, usage, width, height, mipLevels,
-                                                       arrayLayers, sampleCount, initialData);
+                                                       arrayLayers, sampleCount, initialData,
+                                                       initialDataFormat);
 }
 
 template <typename TDerived>
 CImage::Ref CDeviceBase<TDerived>::CreateImage3D(EFormat format, EImageUsageFlags usage,
                                                  uint32_t width, uint32_t height, uint32_t depth,
                                                  uint32_t mipLevels, uint32_t arrayLayers,
-                                                 uint32_t sampleCount, const void* initialData)
+                                                 uint32_t sampleCount, const void* initialData,
+                                                 EFormat initialDataFormat)
 {
-    return static_cast<TDerived*>(this)->CreateImage3D(
-        format, usage, width, height, depth, mipLevels, arrayLayers, sampleCount, initialData);
+    return static_cast<TDerived*>(this)->CreateImage3D(format, usage, width, height, depth,
+                                                       mipLevels, arrayLayers, sampleCount,
+                                                       initialData, initialDataFormat);
 }
 
 template <typename TDerived>
@@ -52,6 +57,53 @@ CImageView::Ref CDeviceBase<TDerived>::CreateImageView(const CImageViewDesc& des
     return static_cast<TDerived*>(this)->CreateImageView(desc, image);
 }
 
+template <typename TDerived>
+CBuffer::Ref CDeviceBase<TDerived>::ImportHostBuffer(const void* pointer, size_t size,
+                                                     CFence::Ref& releaseFence)
+{
+    return static_cast<TDerived*>(this)->ImportHostBuffer(pointer, size, releaseFence);
+}
+
+template <typename TDerived> size_t CDeviceBase<TDerived>::GetHostImportAlignment() const
+{
+    return static_cast<const TDerived*>(this)->GetHostImportAlignment();
+}
+
+template <typename TDerived>
+CMemoryHeap::Ref
+CDeviceBase<TDerived>::CreateMemoryHeap(size_t size, EMemoryHeapType type,
+                                        const std::vector<CMemoryRequirements>& contents)
+{
+    return static_cast<TDerived*>(this)->CreateMemoryHeap(size, type, contents);
+}
+
+template <typename TDerived>
+CMemoryRequirements CDeviceBase<TDerived>::GetImageMemoryRequirements(const CImageDesc& desc)
+{
+    return static_cast<TDerived*>(this)->GetImageMemoryRequirements(desc);
+}
+
+template <typename TDerived>
+CMemoryRequirements CDeviceBase<TDerived>::GetBufferMemoryRequirements(size_t size,
+                                                                      EBufferUsageFlags usage)
+{
+    return static_cast<TDerived*>(this)->GetBufferMemoryRequirements(size, usage);
+}
+
+template <typename TDerived>
+CImage::Ref CDeviceBase<TDerived>::CreateImageInHeap(const CImageDesc& desc,
+                                                     CMemoryHeap::Ref heap, size_t offset)
+{
+    return static_cast<TDerived*>(this)->CreateImageInHeap(desc, std::move(heap), offset);
+}
+
+template <typename TDerived>
+CBuffer::Ref CDeviceBase<TDerived>::CreateBufferInHeap(size_t size, EBufferUsageFlags usage,
+                                                       CMemoryHeap::Ref heap, size_t offset)
+{
+    return static_cast<TDerived*>(this)->CreateBufferInHeap(size, usage, std::move(heap), offset);
+}
+
 template <typename TDerived>
 CShaderModule::Ref CDeviceBase<TDerived>::CreateShaderModule(size_t size, const void* pCode)
 {
@@ -114,6 +166,18 @@ template <typename TDerived> CCommandQueue::Ref CDeviceBase<TDerived>::CreateCom
     return static_cast<TDerived*>(this)->CreateCommandQueue();
 }
 
+template <typename TDerived>
+CCommandQueue::Ref CDeviceBase<TDerived>::CreateCommandQueue(EQueueType queueType, uint32_t index)
+{
+    return static_cast<TDerived*>(this)->CreateCommandQueue(queueType, index);
+}
+
+template <typename TDerived>
+uint32_t CDeviceBase<TDerived>::GetQueueCount(EQueueType queueType) const
+{
+    return static_cast<const TDerived*>(this)->GetQueueCount(queueType);
+}
+
 template <typename TDerived>
 CSwapChain::Ref CDeviceBase<TDerived>::CreateSwapChain(const CPresentationSurfaceDesc& info,
                                                        EFormat format)
@@ -126,6 +190,17 @@ template <typename TDerived> void CDeviceBase<TDerived>::WaitIdle()
     return static_cast<TDerived*>(this)->WaitIdle();
 }
 
+template <typename TDerived> CMemoryStats CDeviceBase<TDerived>::GetMemoryStats() const
+{
+    return static_cast<const TDerived*>(this)->GetMemoryStats();
+}
+
+template <typename TDerived>
+void CDeviceBase<TDerived>::SetDefragmentationBudget(float milliseconds)
+{
+    return static_cast<TDerived*>(this)->SetDefragmentationBudget(milliseconds);
+}
+
 // Explicitly instanciate the wrapper for the chosen implementation
 template class RHI_API CDeviceBase<TChooseImpl<CDeviceBase>::TDerived>;
 
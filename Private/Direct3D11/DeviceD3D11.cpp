@@ -12,6 +12,7 @@
 #include "ShaderD3D11.h"
 #include "StateCacheD3D11.h"
 #include "SwapChainD3D11.h"
+#include "TexelConversion.h"
 
 extern "C"
 {
@@ -113,14 +114,16 @@ CBuffer::Ref CDeviceD3D11::CreateBuffer(size_t size, EBufferUsageFlags usage,
 
 CImage::Ref CDeviceD3D11::CreateImage1D(EFormat format, EImageUsageFlags usage, uint32_t width,
                                         uint32_t mipLevels, uint32_t arrayLayers,
-                                        uint32_t sampleCount, const void* initialData)
+                                        uint32_t sampleCount, const void* initialData,
+                                        EFormat initialDataFormat)
 {
     throw std::runtime_error("unimplemented");
 }
 
 CImage::Ref CDeviceD3D11::CreateImage2D(EFormat format, EImageUsageFlags usage, uint32_t width,
                                         uint32_t height, uint32_t mipLevels, uint32_t arrayLayers,
-                                        uint32_t sampleCount, const void* initialData)
+                                        uint32_t sampleCount, const void* initialData,
+                                        EFormat initialDataFormat)
 {
     // Determine various properties
     UINT bindFlags = 0;
@@ -165,6 +168,18 @@ CImage::Ref CDeviceD3D11::CreateImage2D(EFormat format, EImageUsageFlags usage,
     if (IsDepthStencilFormat(format))
         desc.Format = DepthStencilFormatToTypeless(format);
 
+    // D3D copies the data during creation, so a temporary converted copy is enough
+    std::vector<uint8_t> convertedData;
+    if (initialData && initialDataFormat != EFormat::UNDEFINED && initialDataFormat != format)
+    {
+        if (!CanConvertTexels(initialDataFormat, format))
+            throw CRHIRuntimeError("Cannot convert initial data to the image format");
+        size_t texelCount = static_cast<size_t>(width) * height;
+        convertedData.resize(texelCount * GetConvertibleTexelSize(format));
+        ConvertTexels(initialDataFormat, format, initialData, convertedData.data(), texelCount);
+        initialData = convertedData.data();
+    }
+
     auto image = std::make_shared<CImageD3D11>(*this, desc);
     if (bCreateImmediately)
         image->CreateFromMem(initialData);
@@ -174,7 +189,7 @@ CImage::Ref CDeviceD3D11::CreateImage2D(EFormat format, EImageUsageFlags usage,
 CImage::Ref CDeviceD3D11::CreateImage3D(EFormat format, EImageUsageFlags usage, uint32_t width,
                                         uint32_t height, uint32_t depth, uint32_t mipLevels,
                                         uint32_t arrayLayers, uint32_t sampleCount,
-                                        const void* initialData)
+                                        const void* initialData, EFormat initialDataFormat)
 {
     throw std::runtime_error("unimplemented");
 }
@@ -21,14 +21,17 @@ public:
                               const void* initialData = nullptr);
     CImage::Ref CreateImage1D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t mipLevels = 1, uint32_t arrayLayers = 1,
-                              uint32_t sampleCount = 1, const void* initialData = nullptr);
+                              uint32_t sampleCount = 1, const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImage::Ref CreateImage2D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t height, uint32_t mipLevels = 1, uint32_t arrayLayers = 1,
-                              uint32_t sampleCount = 1, const void* initialData = nullptr);
+                              uint32_t sampleCount = 1, const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImage::Ref CreateImage3D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t height, uint32_t depth, uint32_t mipLevels = 1,
                               uint32_t arrayLayers = 1, uint32_t sampleCount = 1,
-                              const void* initialData = nullptr);
+                              const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImageView::Ref CreateImageView(const CImageViewDesc& desc, CImage::Ref image);
 
     // Shader and resource binding
@@ -0,0 +1,62 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace RHI
+{
+
+// Any number of threads push, a single consumer takes everything at once in the order it was
+//   pushed. Pushing is one compare exchange and never waits for the consumer.
+template <typename T> class TMPSCQueue
+{
+public:
+    TMPSCQueue() = default;
+    ~TMPSCQueue()
+    {
+        std::vector<T> dropped;
+        PopAll(dropped);
+    }
+    TMPSCQueue(const TMPSCQueue&) = delete;
+    TMPSCQueue& operator=(const TMPSCQueue&) = delete;
+
+    void Push(T value)
+    {
+        auto* node = new CNode { std::move(value), Head.load(std::memory_order_relaxed) };
+        while (!Head.compare_exchange_weak(node->Next, node))
+            ;
+    }
+
+    // Appends whatever was pushed so far to out, oldest first. Consumer thread only.
+    bool PopAll(std::vector<T>& out)
+    {
+        CNode* node = Head.exchange(nullptr);
+        if (!node)
+            return false;
+
+        // The nodes are linked newest first
+        size_t first = out.size();
+        while (node)
+        {
+            out.push_back(std::move(node->Value));
+            CNode* next = node->Next;
+            delete node;
+            node = next;
+        }
+        std::reverse(out.begin() + first, out.end());
+        return true;
+    }
+
+    bool IsEmpty() const { return Head.load() == nullptr; }
+
+private:
+    struct CNode
+    {
+        T Value;
+        CNode* Next;
+    };
+
+    std::atomic<CNode*> Head { nullptr };
+};
+
+} /* namespace RHI */
@@ -0,0 +1,440 @@
+#include "MipChainBuilder.h"
+#include "RHIException.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RHI_MIP_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define RHI_MIP_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace RHI
+{
+
+// Kaiser windowed sinc, radius is in destination texels
+static const double kPi = 3.14159265358979323846;
+static const double kKaiserRadius = 3.0;
+static const double kKaiserAlpha = 4.0;
+
+// Sliding window of weights for one axis of a single downsampling step
+struct CFilterPlan
+{
+    uint32_t MaxTaps = 0;
+    std::vector<uint32_t> First;
+    std::vector<uint32_t> Count;
+    std::vector<float> Weights; // First.size() * MaxTaps
+};
+
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double halfX = x * 0.5;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (halfX / k) * (halfX / k);
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+static double kaiserSinc(double x)
+{
+    double t = x / kKaiserRadius;
+    if (t <= -1.0 || t >= 1.0)
+        return 0.0;
+    double sinc = 1.0;
+    if (x != 0.0)
+        sinc = std::sin(kPi * x) / (kPi * x);
+    return sinc * besselI0(kKaiserAlpha * std::sqrt(1.0 - t * t)) / besselI0(kKaiserAlpha);
+}
+
+static CFilterPlan makeFilterPlan(uint32_t srcSize, uint32_t dstSize, EMipFilter filter)
+{
+    CFilterPlan plan;
+    plan.First.resize(dstSize);
+    plan.Count.resize(dstSize);
+
+    // Each destination texel covers [i * scale, (i + 1) * scale) of the source, which takes care
+    //   of odd sizes where a texel straddles 2.x source texels
+    double scale = static_cast<double>(srcSize) / dstSize;
+    double support = filter == EMipFilter::Box ? 0.5 * scale : kKaiserRadius * scale;
+
+    std::vector<std::vector<double>> weights(dstSize);
+    for (uint32_t i = 0; i < dstSize; i++)
+    {
+        double center = (i + 0.5) * scale;
+        int64_t lo = std::max<int64_t>(0, static_cast<int64_t>(std::floor(center - support)));
+        int64_t hi = std::min<int64_t>(srcSize - 1, static_cast<int64_t>(std::ceil(center + support)));
+
+        double total = 0.0;
+        int64_t first = -1;
+        std::vector<double>& w = weights[i];
+        for (int64_t j = lo; j <= hi; j++)
+        {
+            double weight;
+            if (filter == EMipFilter::Box)
+                weight = std::max(0.0, std::min(j + 1.0, center + support)
+                                      - std::max(static_cast<double>(j), center - support));
+            else
+                weight = kaiserSinc((j + 0.5 - center) / scale);
+
+            // Trim leading zero taps
+            if (first < 0 && weight == 0.0)
+                continue;
+            if (first < 0)
+                first = j;
+            w.push_back(weight);
+            total += weight;
+        }
+        while (!w.empty() && w.back() == 0.0)
+            w.pop_back();
+        for (double& weight : w)
+            weight /= total;
+
+        plan.First[i] = static_cast<uint32_t>(first);
+        plan.Count[i] = static_cast<uint32_t>(w.size());
+        plan.MaxTaps = std::max(plan.MaxTaps, plan.Count[i]);
+    }
+
+    plan.Weights.resize(static_cast<size_t>(dstSize) * plan.MaxTaps, 0.0f);
+    for (uint32_t i = 0; i < dstSize; i++)
+        for (uint32_t k = 0; k < plan.Count[i]; k++)
+            plan.Weights[i * plan.MaxTaps + k] = static_cast<float>(weights[i][k]);
+    return plan;
+}
+
+static const float* srgbToLinearTable()
+{
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> result;
+        for (int i = 0; i < 256; i++)
+        {
+            double c = i / 255.0;
+            result[i] = static_cast<float>(c <= 0.04045 ? c / 12.92
+                                                        : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        return result;
+    }();
+    return table.data();
+}
+
+// Indexed by linear value quantized to 16 bits, fine enough for the dark end of the curve
+static const uint8_t* linearToSRGBTable()
+{
+    static const std::vector<uint8_t> table = [] {
+        std::vector<uint8_t> result(65536);
+        for (int i = 0; i < 65536; i++)
+        {
+            double l = i / 65535.0;
+            double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+            result[i] = static_cast<uint8_t>(std::min(255.0, std::max(0.0, c * 255.0 + 0.5)));
+        }
+        return result;
+    }();
+    return table.data();
+}
+
+static void decodeRow(const uint8_t* src, float* dst, uint32_t width, bool isSRGB, bool isFloat)
+{
+    if (isFloat)
+    {
+        memcpy(dst, src, static_cast<size_t>(width) * 16);
+        return;
+    }
+
+    if (isSRGB)
+    {
+        const float* toLinear = srgbToLinearTable();
+        for (uint32_t x = 0; x < width; x++)
+        {
+            dst[x * 4 + 0] = toLinear[src[x * 4 + 0]];
+            dst[x * 4 + 1] = toLinear[src[x * 4 + 1]];
+            dst[x * 4 + 2] = toLinear[src[x * 4 + 2]];
+            dst[x * 4 + 3] = src[x * 4 + 3] * (1.0f / 255.0f);
+        }
+        return;
+    }
+
+#if RHI_MIP_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    for (uint32_t x = 0; x < width; x++)
+    {
+        int32_t packed;
+        memcpy(&packed, src + x * 4, 4);
+        __m128i bytes = _mm_cvtsi32_si128(packed);
+        __m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+        _mm_storeu_ps(dst + x * 4, _mm_mul_ps(_mm_cvtepi32_ps(ints), scale));
+    }
+#else
+    for (uint32_t i = 0; i < width * 4; i++)
+        dst[i] = src[i] * (1.0f / 255.0f);
+#endif
+}
+
+static void encodeRow(const float* src, uint8_t* dst, uint32_t width, bool isSRGB, bool isFloat)
+{
+    if (isFloat)
+    {
+        memcpy(dst, src, static_cast<size_t>(width) * 16);
+        return;
+    }
+
+    if (isSRGB)
+    {
+        const uint8_t* toSRGB = linearToSRGBTable();
+        for (uint32_t x = 0; x < width; x++)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                float v = std::min(1.0f, std::max(0.0f, src[x * 4 + c]));
+                dst[x * 4 + c] = toSRGB[static_cast<uint32_t>(v * 65535.0f + 0.5f)];
+            }
+            float a = std::min(1.0f, std::max(0.0f, src[x * 4 + 3]));
+            dst[x * 4 + 3] = static_cast<uint8_t>(a * 255.0f + 0.5f);
+        }
+        return;
+    }
+
+#if RHI_MIP_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for (uint32_t x = 0; x < width; x++)
+    {
+        __m128 v = _mm_min_ps(one, _mm_max_ps(zero, _mm_loadu_ps(src + x * 4)));
+        __m128i ints = _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+        __m128i words = _mm_packs_epi32(ints, ints);
+        int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(dst + x * 4, &packed, 4);
+    }
+#else
+    for (uint32_t i = 0; i < width * 4; i++)
+    {
+        float v = std::min(1.0f, std::max(0.0f, src[i]));
+        dst[i] = static_cast<uint8_t>(v * 255.0f + 0.5f);
+    }
+#endif
+}
+
+// Exact 2:1 box, the common case for even sizes
+static void downsampleRowBox2(const float* src, float* dst, uint32_t dstWidth)
+{
+    uint32_t x = 0;
+#if RHI_MIP_AVX2
+    const __m256 half8 = _mm256_set1_ps(0.5f);
+    for (; x + 2 <= dstWidth; x += 2)
+    {
+        __m256 a = _mm256_loadu_ps(src + x * 8);
+        __m256 b = _mm256_loadu_ps(src + x * 8 + 8);
+        __m256 even = _mm256_permute2f128_ps(a, b, 0x20);
+        __m256 odd = _mm256_permute2f128_ps(a, b, 0x31);
+        _mm256_storeu_ps(dst + x * 4, _mm256_mul_ps(_mm256_add_ps(even, odd), half8));
+    }
+#endif
+#if RHI_MIP_SSE2
+    const __m128 half4 = _mm_set1_ps(0.5f);
+    for (; x < dstWidth; x++)
+    {
+        __m128 a = _mm_loadu_ps(src + x * 8);
+        __m128 b = _mm_loadu_ps(src + x * 8 + 4);
+        _mm_storeu_ps(dst + x * 4, _mm_mul_ps(_mm_add_ps(a, b), half4));
+    }
+#else
+    for (; x < dstWidth; x++)
+        for (uint32_t c = 0; c < 4; c++)
+            dst[x * 4 + c] = (src[x * 8 + c] + src[x * 8 + 4 + c]) * 0.5f;
+#endif
+}
+
+static void downsampleRow(const float* src, float* dst, const CFilterPlan& plan)
+{
+    uint32_t dstWidth = static_cast<uint32_t>(plan.First.size());
+    for (uint32_t x = 0; x < dstWidth; x++)
+    {
+        const float* weights = &plan.Weights[x * plan.MaxTaps];
+        const float* texels = src + static_cast<size_t>(plan.First[x]) * 4;
+#if RHI_MIP_SSE2
+        __m128 acc = _mm_setzero_ps();
+        for (uint32_t k = 0; k < plan.Count[x]; k++)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]),
+                                             _mm_loadu_ps(texels + k * 4)));
+        _mm_storeu_ps(dst + x * 4, acc);
+#else
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            float acc = 0.0f;
+            for (uint32_t k = 0; k < plan.Count[x]; k++)
+                acc += weights[k] * texels[k * 4 + c];
+            dst[x * 4 + c] = acc;
+        }
+#endif
+    }
+}
+
+static void blendRows(const float* const* rows, const float* weights, uint32_t count,
+                      float* dst, size_t floatCount)
+{
+    size_t i = 0;
+#if RHI_MIP_AVX2
+    for (; i + 8 <= floatCount; i += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (uint32_t k = 0; k < count; k++)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(weights[k]),
+                                                   _mm256_loadu_ps(rows[k] + i)));
+        _mm256_storeu_ps(dst + i, acc);
+    }
+#endif
+#if RHI_MIP_SSE2
+    for (; i + 4 <= floatCount; i += 4)
+    {
+        __m128 acc = _mm_setzero_ps();
+        for (uint32_t k = 0; k < count; k++)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+        _mm_storeu_ps(dst + i, acc);
+    }
+#endif
+    for (; i < floatCount; i++)
+    {
+        float acc = 0.0f;
+        for (uint32_t k = 0; k < count; k++)
+            acc += weights[k] * rows[k][i];
+        dst[i] = acc;
+    }
+}
+
+bool CMipChainBuilder::IsFormatSupported(EFormat format)
+{
+    switch (format)
+    {
+    case EFormat::R8G8B8A8_UNORM:
+    case EFormat::R8G8B8A8_SRGB:
+    case EFormat::B8G8R8A8_UNORM:
+    case EFormat::B8G8R8A8_SRGB:
+    case EFormat::R32G32B32A32_SFLOAT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint32_t CMipChainBuilder::GetFullChainLevelCount(uint32_t width, uint32_t height, uint32_t depth)
+{
+    uint32_t largest = std::max(width, std::max(height, depth));
+    uint32_t levels = 1;
+    while (largest > 1)
+    {
+        largest >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+CMipChainBuilder::CMipChainBuilder(EFormat format, uint32_t width, uint32_t height,
+                                   uint32_t mipLevels, EMipFilter filter)
+    : Format(format)
+    , Filter(filter)
+{
+    if (!IsFormatSupported(format))
+        throw CRHIRuntimeError("CMipChainBuilder does not support this format");
+
+    bIsSRGB = format == EFormat::R8G8B8A8_SRGB || format == EFormat::B8G8R8A8_SRGB;
+    bIsFloat = format == EFormat::R32G32B32A32_SFLOAT;
+    TexelSize = bIsFloat ? 16 : 4;
+
+    mipLevels = std::min(mipLevels, GetFullChainLevelCount(width, height));
+    for (uint32_t level = 0; level < mipLevels; level++)
+    {
+        CMipLevelInfo info;
+        info.Offset = TotalSize;
+        info.Width = std::max(1u, width >> level);
+        info.Height = std::max(1u, height >> level);
+        info.Size = static_cast<size_t>(info.Width) * info.Height * TexelSize;
+        Levels.push_back(info);
+
+        // Keep every level at an offset usable for buffer to image copies
+        TotalSize += (info.Size + 15) & ~static_cast<size_t>(15);
+    }
+}
+
+void CMipChainBuilder::Build(const void* src, void* dst) const
+{
+    auto* dstBytes = static_cast<uint8_t*>(dst);
+    if (src != dstBytes + Levels[0].Offset)
+        memcpy(dstBytes + Levels[0].Offset, src, Levels[0].Size);
+
+    // Level n is filtered from the float copy of level n - 1, except for level 1 which decodes the
+    //   caller's data row by row so we never hold a float copy of the largest level
+    std::vector<float> prevLevel;
+    std::vector<float> decodedRow(static_cast<size_t>(Levels[0].Width) * 4);
+    for (size_t level = 1; level < Levels.size(); level++)
+    {
+        const CMipLevelInfo& srcInfo = Levels[level - 1];
+        const CMipLevelInfo& dstInfo = Levels[level];
+        size_t rowFloats = static_cast<size_t>(dstInfo.Width) * 4;
+
+        bool box2x = Filter == EMipFilter::Box && srcInfo.Width == dstInfo.Width * 2;
+        CFilterPlan horizontal = makeFilterPlan(srcInfo.Width, dstInfo.Width, Filter);
+        CFilterPlan vertical = makeFilterPlan(srcInfo.Height, dstInfo.Height, Filter);
+
+        // Horizontally filtered source rows, slot = row % cacheRows. The taps of one output row are
+        //   contiguous and never more than cacheRows, so they never evict each other.
+        uint32_t cacheRows = vertical.MaxTaps;
+        std::vector<float> rowCache(cacheRows * rowFloats);
+        std::vector<int64_t> cachedRow(cacheRows, -1);
+        std::vector<const float*> taps(cacheRows);
+
+        bool isLast = level + 1 == Levels.size();
+        std::vector<float> currLevel(isLast ? rowFloats : rowFloats * dstInfo.Height);
+
+        for (uint32_t y = 0; y < dstInfo.Height; y++)
+        {
+            for (uint32_t k = 0; k < vertical.Count[y]; k++)
+            {
+                uint32_t srcRow = vertical.First[y] + k;
+                uint32_t slot = srcRow % cacheRows;
+                float* cached = &rowCache[slot * rowFloats];
+                if (cachedRow[slot] != srcRow)
+                {
+                    const float* srcData;
+                    if (level == 1)
+                    {
+                        const auto* encoded = static_cast<const uint8_t*>(src)
+                            + static_cast<size_t>(srcRow) * srcInfo.Width * TexelSize;
+                        decodeRow(encoded, decodedRow.data(), srcInfo.Width, bIsSRGB, bIsFloat);
+                        srcData = decodedRow.data();
+                    }
+                    else
+                        srcData = &prevLevel[static_cast<size_t>(srcRow) * srcInfo.Width * 4];
+
+                    if (box2x)
+                        downsampleRowBox2(srcData, cached, dstInfo.Width);
+                    else
+                        downsampleRow(srcData, cached, horizontal);
+                    cachedRow[slot] = srcRow;
+                }
+                taps[k] = cached;
+            }
+
+            float* out = isLast ? currLevel.data() : &currLevel[y * rowFloats];
+            blendRows(taps.data(), &vertical.Weights[y * vertical.MaxTaps], vertical.Count[y], out,
+                      rowFloats);
+            encodeRow(out, dstBytes + dstInfo.Offset + static_cast<size_t>(y) * dstInfo.Width * TexelSize,
+                      dstInfo.Width, bIsSRGB, bIsFloat);
+        }
+
+        prevLevel = std::move(currLevel);
+    }
+}
+
+} /* namespace RHI */
@@ -0,0 +1,56 @@
+#pragma once
+#include "Format.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace RHI
+{
+
+enum class EMipFilter
+{
+    Box,
+    Kaiser,
+};
+
+struct CMipLevelInfo
+{
+    size_t Offset;
+    size_t Size;
+    uint32_t Width;
+    uint32_t Height;
+};
+
+// Generates a complete mip chain on the CPU. Filtering happens in linear float space, so sRGB
+// formats are decoded before and re-encoded after each level. Sizes don't have to be 2^n.
+// The builder holds no device state and can be used from any number of loader threads at once.
+class CMipChainBuilder
+{
+public:
+    static bool IsFormatSupported(EFormat format);
+    static uint32_t GetFullChainLevelCount(uint32_t width, uint32_t height = 1,
+                                           uint32_t depth = 1);
+
+    CMipChainBuilder(EFormat format, uint32_t width, uint32_t height, uint32_t mipLevels,
+                     EMipFilter filter = EMipFilter::Box);
+
+    const std::vector<CMipLevelInfo>& GetLevels() const { return Levels; }
+    size_t GetTotalSize() const { return TotalSize; }
+
+    // Writes all levels tightly packed into dst, which must hold GetTotalSize() bytes.
+    //   Level 0 is a plain copy of src, unless src already points at level 0 inside dst. Apart
+    //   from that case dst is never read from, so it can be mapped staging memory.
+    void Build(const void* src, void* dst) const;
+
+private:
+    EFormat Format;
+    EMipFilter Filter;
+    uint32_t TexelSize;
+    bool bIsSRGB;
+    bool bIsFloat;
+
+    std::vector<CMipLevelInfo> Levels;
+    size_t TotalSize = 0;
+};
+
+} /* namespace RHI */
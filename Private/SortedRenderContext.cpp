@@ -0,0 +1,271 @@
+#include "SortedRenderContext.h"
+#include "RHIException.h"
+#include <algorithm>
+#include <cstring>
+
+namespace RHI
+{
+
+// Key layout from the most significant bit: pipeline, descriptor sets, vertex and index buffers,
+//   depth. Ids past what fits share the last value, those draws are then only partly sorted.
+static constexpr uint32_t IdBits = 12;
+static constexpr uint32_t DepthBits = 64 - 3 * IdBits;
+static constexpr uint32_t MaxId = (1u << IdBits) - 1;
+
+template <typename TMap, typename TKey> static uint64_t GetId(TMap& ids, const TKey& key)
+{
+    auto iter = ids.emplace(key, static_cast<uint32_t>(ids.size())).first;
+    return std::min(iter->second, MaxId);
+}
+
+template <typename T> static bool IsSame(const T& a, const T& b)
+{
+    return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+CSortedRenderContext::CSortedRenderContext(IRenderContext::Ref target)
+    : Target(std::move(target))
+{
+}
+
+void CSortedRenderContext::SetSortDepth(float depth)
+{
+    depth = std::min(std::max(depth, 0.0f), 1.0f);
+    CurrDepth = static_cast<uint32_t>(depth * static_cast<float>((1u << DepthBits) - 1));
+}
+
+void CSortedRenderContext::Flush()
+{
+    SortPackets();
+    for (const auto& item : SortItems)
+        Replay(Packets[item.Packet]);
+
+    // The state carries over to draws after the flush, but has to be captured again
+    States.clear();
+    Packets.clear();
+    SortItems.clear();
+    AppliedStateIndex = UINT32_MAX;
+    PipelineIds.clear();
+    DescriptorSetIds.clear();
+    BufferIds.clear();
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::BindRenderPipeline(CPipeline& pipeline)
+{
+    CurrState.Pipeline = &pipeline;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::SetViewport(const CViewportDesc& viewportDesc)
+{
+    CurrState.bHasViewport = true;
+    CurrState.Viewport = viewportDesc;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::SetScissor(const CRect2D& scissor)
+{
+    CurrState.bHasScissor = true;
+    CurrState.Scissor = scissor;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::SetBlendConstants(const std::array<float, 4>& blendConstants)
+{
+    CurrState.bHasBlendConstants = true;
+    CurrState.BlendConstants = blendConstants;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::SetStencilReference(uint32_t reference)
+{
+    CurrState.bHasStencilReference = true;
+    CurrState.StencilReference = reference;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::BindRenderDescriptorSet(uint32_t set, CDescriptorSet& descriptorSet)
+{
+    if (set >= MaxDescriptorSets)
+        throw CRHIRuntimeError("Descriptor set index out of range");
+    CurrState.DescriptorSets[set] = &descriptorSet;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::BindIndexBuffer(CBuffer& buffer, size_t offset, EFormat format)
+{
+    CurrState.IndexBuffer = &buffer;
+    CurrState.IndexOffset = offset;
+    CurrState.IndexFormat = format;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::BindVertexBuffer(uint32_t binding, CBuffer& buffer, size_t offset)
+{
+    if (binding >= MaxVertexBindings)
+        throw CRHIRuntimeError("Vertex buffer binding out of range");
+    CurrState.VertexBuffers[binding] = &buffer;
+    CurrState.VertexOffsets[binding] = offset;
+    bIsStateDirty = true;
+}
+
+void CSortedRenderContext::Draw(uint32_t vertexCount, uint32_t instanceCount,
+                                uint32_t firstVertex, uint32_t firstInstance)
+{
+    AddPacket(CDrawPacket { EDrawType::Draw, 0,
+                            { vertexCount, instanceCount, firstVertex, 0, firstInstance },
+                            nullptr, 0 });
+}
+
+void CSortedRenderContext::DrawIndexed(uint32_t indexCount, uint32_t instanceCount,
+                                       uint32_t firstIndex, int32_t vertexOffset,
+                                       uint32_t firstInstance)
+{
+    AddPacket(CDrawPacket { EDrawType::DrawIndexed, 0,
+                            { indexCount, instanceCount, firstIndex,
+                              static_cast<uint32_t>(vertexOffset), firstInstance },
+                            nullptr, 0 });
+}
+
+void CSortedRenderContext::DrawIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount,
+                                        uint32_t stride)
+{
+    AddPacket(CDrawPacket { EDrawType::DrawIndirect, 0, { drawCount, stride, 0, 0, 0 }, &buffer,
+                            offset });
+}
+
+void CSortedRenderContext::DrawIndexedIndirect(CBuffer& buffer, size_t offset,
+                                               uint32_t drawCount, uint32_t stride)
+{
+    AddPacket(CDrawPacket { EDrawType::DrawIndexedIndirect, 0, { drawCount, stride, 0, 0, 0 },
+                            &buffer, offset });
+}
+
+CBuffer::Ref CSortedRenderContext::AllocateScratch(size_t size, size_t alignment)
+{
+    return Target->AllocateScratch(size, alignment);
+}
+
+void CSortedRenderContext::FinishRecording()
+{
+    Flush();
+    bHasAppliedState = false;
+    Target->FinishRecording();
+}
+
+void CSortedRenderContext::AddPacket(const CDrawPacket& packet)
+{
+    if (bIsStateDirty)
+    {
+        CurrState.Key = MakeStateKey();
+        States.push_back(CurrState);
+        bIsStateDirty = false;
+    }
+    Packets.push_back(packet);
+    Packets.back().State = static_cast<uint32_t>(States.size() - 1);
+    SortItems.push_back(CSortItem { States.back().Key | CurrDepth,
+                                    static_cast<uint32_t>(Packets.size() - 1) });
+}
+
+uint64_t CSortedRenderContext::MakeStateKey()
+{
+    std::array<CBuffer*, MaxVertexBindings + 1> buffers;
+    std::copy(CurrState.VertexBuffers.begin(), CurrState.VertexBuffers.end(), buffers.begin());
+    buffers.back() = CurrState.IndexBuffer;
+
+    uint64_t key = GetId(PipelineIds, CurrState.Pipeline);
+    key = (key << IdBits) | GetId(DescriptorSetIds, CurrState.DescriptorSets);
+    key = (key << IdBits) | GetId(BufferIds, buffers);
+    return key << DepthBits;
+}
+
+void CSortedRenderContext::SortPackets()
+{
+    // Least significant byte first, each pass is stable so the order of equal keys is the order
+    //   the draws came in. Bytes that are the same for every key are skipped, which with few
+    //   pipelines and no depth is most of them.
+    if (SortItems.size() < 2)
+        return;
+    SortScratch.resize(SortItems.size());
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        std::array<size_t, 256> offsets {};
+        for (const auto& item : SortItems)
+            offsets[(item.Key >> shift) & 0xff]++;
+        if (offsets[(SortItems[0].Key >> shift) & 0xff] == SortItems.size())
+            continue;
+
+        size_t sum = 0;
+        for (auto& offset : offsets)
+        {
+            size_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        for (const auto& item : SortItems)
+            SortScratch[offsets[(item.Key >> shift) & 0xff]++] = item;
+        SortItems.swap(SortScratch);
+    }
+}
+
+void CSortedRenderContext::ApplyState(const CDrawState& state)
+{
+    const CDrawState* prev = bHasAppliedState ? &AppliedState : nullptr;
+    if (state.Pipeline && (!prev || prev->Pipeline != state.Pipeline))
+        Target->BindRenderPipeline(*state.Pipeline);
+    for (uint32_t set = 0; set < MaxDescriptorSets; set++)
+        if (state.DescriptorSets[set]
+            && (!prev || prev->DescriptorSets[set] != state.DescriptorSets[set]))
+            Target->BindRenderDescriptorSet(set, *state.DescriptorSets[set]);
+    if (state.IndexBuffer
+        && (!prev || prev->IndexBuffer != state.IndexBuffer
+            || prev->IndexOffset != state.IndexOffset || prev->IndexFormat != state.IndexFormat))
+        Target->BindIndexBuffer(*state.IndexBuffer, state.IndexOffset, state.IndexFormat);
+    for (uint32_t binding = 0; binding < MaxVertexBindings; binding++)
+        if (state.VertexBuffers[binding]
+            && (!prev || prev->VertexBuffers[binding] != state.VertexBuffers[binding]
+                || prev->VertexOffsets[binding] != state.VertexOffsets[binding]))
+            Target->BindVertexBuffer(binding, *state.VertexBuffers[binding],
+                                     state.VertexOffsets[binding]);
+    if (state.bHasViewport && (!prev || !IsSame(prev->Viewport, state.Viewport)))
+        Target->SetViewport(state.Viewport);
+    if (state.bHasScissor && (!prev || !IsSame(prev->Scissor, state.Scissor)))
+        Target->SetScissor(state.Scissor);
+    if (state.bHasBlendConstants && (!prev || prev->BlendConstants != state.BlendConstants))
+        Target->SetBlendConstants(state.BlendConstants);
+    if (state.bHasStencilReference && (!prev || prev->StencilReference != state.StencilReference))
+        Target->SetStencilReference(state.StencilReference);
+
+    AppliedState = state;
+    bHasAppliedState = true;
+}
+
+void CSortedRenderContext::Replay(const CDrawPacket& packet)
+{
+    if (packet.State != AppliedStateIndex)
+    {
+        ApplyState(States[packet.State]);
+        AppliedStateIndex = packet.State;
+    }
+
+    const auto& args = packet.Args;
+    switch (packet.Type)
+    {
+    case EDrawType::Draw:
+        Target->Draw(args[0], args[1], args[2], args[4]);
+        break;
+    case EDrawType::DrawIndexed:
+        Target->DrawIndexed(args[0], args[1], args[2], static_cast<int32_t>(args[3]), args[4]);
+        break;
+    case EDrawType::DrawIndirect:
+        Target->DrawIndirect(*packet.IndirectBuffer, packet.IndirectOffset, args[0], args[1]);
+        break;
+    case EDrawType::DrawIndexedIndirect:
+        Target->DrawIndexedIndirect(*packet.IndirectBuffer, packet.IndirectOffset, args[0],
+                                    args[1]);
+        break;
+    }
+}
+
+} /* namespace RHI */
@@ -0,0 +1,326 @@
+#include "TexelConversion.h"
+#include "RHIException.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RHI_TEXEL_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || (defined(_MSC_VER) && defined(__AVX__))
+#define RHI_TEXEL_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define RHI_TEXEL_F16C 1
+#include <immintrin.h>
+#endif
+
+namespace RHI
+{
+
+enum class EComponentType
+{
+    UNorm8,
+    Float16,
+    Float32,
+};
+
+struct CTexelLayout
+{
+    EComponentType Type;
+    uint32_t Channels;
+    bool bIsBGR;
+    bool bIsSRGB;
+};
+
+static bool getTexelLayout(EFormat format, CTexelLayout& layout)
+{
+    switch (format)
+    {
+    case EFormat::R8G8B8_UNORM:
+        layout = { EComponentType::UNorm8, 3, false, false };
+        return true;
+    case EFormat::R8G8B8_SRGB:
+        layout = { EComponentType::UNorm8, 3, false, true };
+        return true;
+    case EFormat::B8G8R8_UNORM:
+        layout = { EComponentType::UNorm8, 3, true, false };
+        return true;
+    case EFormat::B8G8R8_SRGB:
+        layout = { EComponentType::UNorm8, 3, true, true };
+        return true;
+    case EFormat::R8G8B8A8_UNORM:
+        layout = { EComponentType::UNorm8, 4, false, false };
+        return true;
+    case EFormat::R8G8B8A8_SRGB:
+        layout = { EComponentType::UNorm8, 4, false, true };
+        return true;
+    case EFormat::B8G8R8A8_UNORM:
+        layout = { EComponentType::UNorm8, 4, true, false };
+        return true;
+    case EFormat::B8G8R8A8_SRGB:
+        layout = { EComponentType::UNorm8, 4, true, true };
+        return true;
+    case EFormat::R16_SFLOAT:
+        layout = { EComponentType::Float16, 1, false, false };
+        return true;
+    case EFormat::R16G16_SFLOAT:
+        layout = { EComponentType::Float16, 2, false, false };
+        return true;
+    case EFormat::R16G16B16_SFLOAT:
+        layout = { EComponentType::Float16, 3, false, false };
+        return true;
+    case EFormat::R16G16B16A16_SFLOAT:
+        layout = { EComponentType::Float16, 4, false, false };
+        return true;
+    case EFormat::R32_SFLOAT:
+        layout = { EComponentType::Float32, 1, false, false };
+        return true;
+    case EFormat::R32G32_SFLOAT:
+        layout = { EComponentType::Float32, 2, false, false };
+        return true;
+    case EFormat::R32G32B32_SFLOAT:
+        layout = { EComponentType::Float32, 3, false, false };
+        return true;
+    case EFormat::R32G32B32A32_SFLOAT:
+        layout = { EComponentType::Float32, 4, false, false };
+        return true;
+    default:
+        return false;
+    }
+}
+
+static uint32_t componentSize(EComponentType type)
+{
+    switch (type)
+    {
+    case EComponentType::UNorm8:
+        return 1;
+    case EComponentType::Float16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Round to nearest even, same as the F16C instructions
+static uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t absBits = bits & 0x7FFFFFFF;
+
+    if (absBits >= 0x7F800000) // Inf or NaN, keep NaNs quiet
+        return static_cast<uint16_t>(sign | 0x7C00 | (absBits > 0x7F800000 ? 0x200 : 0));
+    if (absBits >= 0x477FF000) // Rounds past 65504
+        return static_cast<uint16_t>(sign | 0x7C00);
+    if (absBits < 0x38800000) // Below the smallest normal half
+    {
+        if (absBits < 0x33000000)
+            return static_cast<uint16_t>(sign);
+        uint32_t exponent = absBits >> 23;
+        uint32_t mantissa = (absBits & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1)))
+            half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = (absBits - 0x38000000) >> 13;
+    uint32_t rest = absBits & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return static_cast<uint16_t>(sign | half);
+}
+
+static void expandRGB8(const uint8_t* src, uint8_t* dst, size_t count, bool swapRB)
+{
+    size_t i = 0;
+#if RHI_TEXEL_SSSE3
+    // 4 texels per iteration, the 16 byte load reads 4 bytes past them so stop early
+    const __m128i shuffle = swapRB
+        ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+        : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        texels = _mm_or_si128(_mm_shuffle_epi8(texels, shuffle), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), texels);
+    }
+#endif
+    uint32_t r = swapRB ? 2 : 0;
+    uint32_t b = swapRB ? 0 : 2;
+    for (; i < count; i++)
+    {
+        dst[i * 4 + 0] = src[i * 3 + r];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + b];
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void swizzleRB8(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    size_t i = 0;
+#if RHI_TEXEL_SSE2
+    const __m128i greenAlpha = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+    const __m128i redBlue = _mm_set1_epi32(0x00FF00FF);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i rb = _mm_and_si128(texels, redBlue);
+        __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        texels = _mm_or_si128(_mm_and_si128(texels, greenAlpha), br);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), texels);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i * 4 + 0] = src[i * 4 + 2];
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = src[i * 4 + 0];
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+}
+
+static void floatsToHalves(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#if RHI_TEXEL_F16C
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), halves);
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = floatToHalf(src[i]);
+}
+
+static void expandFloatsToHalves(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#if RHI_TEXEL_F16C
+    for (; i < count; i++)
+    {
+        __m128 texel = _mm_setr_ps(src[i * 3 + 0], src[i * 3 + 1], src[i * 3 + 2], 1.0f);
+        __m128i halves = _mm_cvtps_ph(texel, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i * 4), halves);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i * 4 + 0] = floatToHalf(src[i * 3 + 0]);
+        dst[i * 4 + 1] = floatToHalf(src[i * 3 + 1]);
+        dst[i * 4 + 2] = floatToHalf(src[i * 3 + 2]);
+        dst[i * 4 + 3] = 0x3C00;
+    }
+}
+
+// Same component type, 3 to 4 channels with alpha set to one
+template <typename T> static void expandComponents(const T* src, T* dst, size_t count, T one)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i * 4 + 0] = src[i * 3 + 0];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = one;
+    }
+}
+
+bool CanConvertTexels(EFormat srcFormat, EFormat dstFormat)
+{
+    CTexelLayout src, dst;
+    if (!getTexelLayout(srcFormat, src) || !getTexelLayout(dstFormat, dst))
+        return false;
+    if (src.bIsSRGB != dst.bIsSRGB)
+        return false;
+    if (src.Channels != dst.Channels && !(src.Channels == 3 && dst.Channels == 4))
+        return false;
+
+    if (src.Type == EComponentType::UNorm8)
+        return dst.Type == EComponentType::UNorm8 && dst.Channels == 4;
+    if (dst.Type == EComponentType::UNorm8)
+        return false;
+    // Never widen halves, that only wastes memory
+    return !(src.Type == EComponentType::Float16 && dst.Type == EComponentType::Float32);
+}
+
+void ConvertTexels(EFormat srcFormat, EFormat dstFormat, const void* src, void* dst,
+                   size_t texelCount)
+{
+    CTexelLayout srcLayout, dstLayout;
+    if (!CanConvertTexels(srcFormat, dstFormat) || !getTexelLayout(srcFormat, srcLayout)
+        || !getTexelLayout(dstFormat, dstLayout))
+        throw CRHIRuntimeError("Cannot convert texels between these formats");
+
+    if (srcLayout.Type == EComponentType::UNorm8)
+    {
+        auto* srcBytes = static_cast<const uint8_t*>(src);
+        auto* dstBytes = static_cast<uint8_t*>(dst);
+        bool swapRB = srcLayout.bIsBGR != dstLayout.bIsBGR;
+        if (srcLayout.Channels == 3)
+            expandRGB8(srcBytes, dstBytes, texelCount, swapRB);
+        else if (swapRB)
+            swizzleRB8(srcBytes, dstBytes, texelCount);
+        else
+            memcpy(dst, src, texelCount * 4);
+        return;
+    }
+
+    bool expand = srcLayout.Channels != dstLayout.Channels;
+    if (srcLayout.Type == EComponentType::Float32 && dstLayout.Type == EComponentType::Float16)
+    {
+        auto* srcFloats = static_cast<const float*>(src);
+        auto* dstHalves = static_cast<uint16_t*>(dst);
+        if (expand)
+            expandFloatsToHalves(srcFloats, dstHalves, texelCount);
+        else
+            floatsToHalves(srcFloats, dstHalves, texelCount * srcLayout.Channels);
+    }
+    else if (!expand)
+        memcpy(dst, src, texelCount * srcLayout.Channels * componentSize(srcLayout.Type));
+    else if (srcLayout.Type == EComponentType::Float32)
+        expandComponents(static_cast<const float*>(src), static_cast<float*>(dst), texelCount,
+                         1.0f);
+    else
+        expandComponents(static_cast<const uint16_t*>(src), static_cast<uint16_t*>(dst),
+                         texelCount, static_cast<uint16_t>(0x3C00));
+}
+
+uint32_t GetConvertibleTexelSize(EFormat format)
+{
+    CTexelLayout layout;
+    if (!getTexelLayout(format, layout))
+        return 0;
+    return layout.Channels * componentSize(layout.Type);
+}
+
+EFormat GetExpandedTexelFormat(EFormat format)
+{
+    switch (format)
+    {
+    case EFormat::R8G8B8_UNORM:
+        return EFormat::R8G8B8A8_UNORM;
+    case EFormat::R8G8B8_SRGB:
+        return EFormat::R8G8B8A8_SRGB;
+    case EFormat::B8G8R8_UNORM:
+        return EFormat::B8G8R8A8_UNORM;
+    case EFormat::B8G8R8_SRGB:
+        return EFormat::B8G8R8A8_SRGB;
+    case EFormat::R16G16B16_SFLOAT:
+        return EFormat::R16G16B16A16_SFLOAT;
+    case EFormat::R32G32B32_SFLOAT:
+        return EFormat::R32G32B32A32_SFLOAT;
+    default:
+        return EFormat::UNDEFINED;
+    }
+}
+
+} /* namespace RHI */
@@ -0,0 +1,25 @@
+#pragma once
+#include "Format.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace RHI
+{
+
+// Upload time texel conversion. Covers what source assets usually come as but devices don't want:
+//   3 channel 8 bit texels expanded to 4, red/blue swizzles, and float32 narrowed to half floats.
+//   The encoding has to stay the same, i.e. no UNORM <-> SRGB.
+bool CanConvertTexels(EFormat srcFormat, EFormat dstFormat);
+
+// Writes texelCount texels of dstFormat. dst is written strictly sequentially and never read, so
+//   it can point into mapped staging memory.
+void ConvertTexels(EFormat srcFormat, EFormat dstFormat, const void* src, void* dst,
+                   size_t texelCount);
+
+// Size of a texel for the formats above, 0 for anything else
+uint32_t GetConvertibleTexelSize(EFormat format);
+
+// The 4 channel format a 3 channel one can be expanded to, UNDEFINED if there is none
+EFormat GetExpandedTexelFormat(EFormat format);
+
+} /* namespace RHI */
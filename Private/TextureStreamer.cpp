@@ -0,0 +1,397 @@
+#include "TextureStreamer.h"
+#include "Device.h"
+#include <algorithm>
+
+namespace RHI
+{
+
+// Point of retired resources until the next Update() knows which one they wait for
+static const uint64_t kPendingPoint = UINT64_MAX;
+
+static void getBlockInfo(EFormat format, uint32_t& blockDim, uint32_t& blockBytes)
+{
+    blockDim = 1;
+    switch (format)
+    {
+    case EFormat::BC1_RGB_UNORM_BLOCK:
+    case EFormat::BC1_RGB_SRGB_BLOCK:
+    case EFormat::BC1_RGBA_UNORM_BLOCK:
+    case EFormat::BC1_RGBA_SRGB_BLOCK:
+    case EFormat::BC4_UNORM_BLOCK:
+    case EFormat::BC4_SNORM_BLOCK:
+        blockDim = 4;
+        blockBytes = 8;
+        return;
+    case EFormat::BC2_UNORM_BLOCK:
+    case EFormat::BC2_SRGB_BLOCK:
+    case EFormat::BC3_UNORM_BLOCK:
+    case EFormat::BC3_SRGB_BLOCK:
+    case EFormat::BC5_UNORM_BLOCK:
+    case EFormat::BC5_SNORM_BLOCK:
+    case EFormat::BC6H_UFLOAT_BLOCK:
+    case EFormat::BC6H_SFLOAT_BLOCK:
+    case EFormat::BC7_UNORM_BLOCK:
+    case EFormat::BC7_SRGB_BLOCK:
+        blockDim = 4;
+        blockBytes = 16;
+        return;
+    case EFormat::R8_UNORM:
+        blockBytes = 1;
+        return;
+    case EFormat::R8G8_UNORM:
+    case EFormat::R16_SFLOAT:
+        blockBytes = 2;
+        return;
+    case EFormat::R8G8B8A8_UNORM:
+    case EFormat::R8G8B8A8_SRGB:
+    case EFormat::B8G8R8A8_UNORM:
+    case EFormat::B8G8R8A8_SRGB:
+    case EFormat::R16G16_SFLOAT:
+    case EFormat::R32_SFLOAT:
+        blockBytes = 4;
+        return;
+    case EFormat::R16G16B16A16_SFLOAT:
+    case EFormat::R32G32_SFLOAT:
+        blockBytes = 8;
+        return;
+    case EFormat::R32G32B32A32_SFLOAT:
+        blockBytes = 16;
+        return;
+    default:
+        throw CRHIRuntimeError("CTextureStreamer does not support this format");
+    }
+}
+
+// Levels are packed into staging buffers at offsets that satisfy any texel or block alignment
+static size_t alignLevel(size_t size) { return (size + 15) & ~static_cast<size_t>(15); }
+
+size_t CTextureStreamer::GetMipSize(EFormat format, uint32_t width, uint32_t height, uint32_t mip)
+{
+    uint32_t blockDim, blockBytes;
+    getBlockInfo(format, blockDim, blockBytes);
+    size_t blocksX = (std::max(1u, width >> mip) + blockDim - 1) / blockDim;
+    size_t blocksY = (std::max(1u, height >> mip) + blockDim - 1) / blockDim;
+    return blocksX * blocksY * blockBytes;
+}
+
+CTextureStreamer::CTextureStreamer(CDevice& device, CCommandQueue::Ref queue, size_t budget)
+    : Device(device)
+    , Queue(std::move(queue))
+    , Budget(budget)
+{
+    Thread = std::thread([this]() { LoaderThread(); });
+}
+
+CTextureStreamer::~CTextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lk(LoadMutex);
+        bIsStopping = true;
+    }
+    LoadCondition.notify_all();
+    Thread.join();
+
+    for (auto& request : FinishedLoads)
+        request.Staging->Unmap();
+    for (auto& request : PendingLoads)
+        request.Staging->Unmap();
+}
+
+CStreamedImage::Ref CTextureStreamer::Register(EFormat format, uint32_t width, uint32_t height,
+                                               uint32_t mipLevels, CMipLoader loader)
+{
+    // Throws for formats that can't be streamed before anything refers to the image
+    uint32_t blockDim, blockBytes;
+    getBlockInfo(format, blockDim, blockBytes);
+
+    auto image = std::make_shared<CStreamedImage>();
+    image->Format = format;
+    image->Width = width;
+    image->Height = height;
+    image->MipLevels = mipLevels;
+    image->Loader = std::move(loader);
+
+    image->TailMip = mipLevels - 1;
+    while (image->TailMip > 0
+           && std::max(width >> (image->TailMip - 1), height >> (image->TailMip - 1))
+               <= TailDimension)
+        image->TailMip--;
+
+    // Nothing is allocated yet, the next Update() makes room for the tail and loads it
+    image->ImageBaseMip = mipLevels;
+    image->ResidentMip = mipLevels;
+    image->TargetMip = image->TailMip;
+    Images.push_back(image);
+    return image;
+}
+
+void CTextureStreamer::Unregister(const CStreamedImage::Ref& image)
+{
+    auto iter = std::find(Images.begin(), Images.end(), image);
+    if (iter == Images.end())
+        return;
+    Images.erase(iter);
+
+    AllocatedSize -= GetImageSize(*image, image->ImageBaseMip);
+    Retire(image->Image, image->View, nullptr);
+    image->Image.reset();
+    image->View.reset();
+    image->ImageBaseMip = image->MipLevels;
+    image->ResidentMip = image->MipLevels;
+}
+
+void CTextureStreamer::Update()
+{
+    // What was retired up to now may be used by anything recorded before this call, all of which
+    //   the queue has by now. However many frames are in flight, that is done at this point.
+    uint64_t point = Queue->Flush();
+    for (auto iter = Retired.rbegin(); iter != Retired.rend() && iter->Point == kPendingPoint;
+         ++iter)
+        iter->Point = point;
+
+    std::vector<CStreamedImage::Ref> byPriority = UpdateTargets();
+
+    // Everything goes into one copy list, which is only created if there's anything to copy
+    CCommandList::Ref cmdList;
+    ICopyContext::Ref ctx;
+    auto getContext = [&]() -> ICopyContext& {
+        if (!ctx)
+        {
+            cmdList = Queue->CreateCommandList();
+            cmdList->Enqueue();
+            ctx = cmdList->CreateCopyContext();
+        }
+        return *ctx;
+    };
+
+    // Shrink first so growing has room. Levels of the old image that survive are copied over.
+    for (const auto& image : byPriority)
+        if (image->TargetMip > image->ImageBaseMip)
+            Reallocate(getContext(), *image, image->TargetMip);
+    for (const auto& image : byPriority)
+    {
+        if (image->TargetMip >= image->ImageBaseMip)
+            continue;
+        size_t growth =
+            GetImageSize(*image, image->TargetMip) - GetImageSize(*image, image->ImageBaseMip);
+        // The tail is always granted
+        if (image->ImageBaseMip != image->MipLevels && AllocatedSize + growth > Budget)
+            continue;
+        Reallocate(getContext(), *image, image->TargetMip);
+    }
+
+    std::vector<CLoadRequest> finished;
+    {
+        std::lock_guard<std::mutex> lk(LoadMutex);
+        finished.swap(FinishedLoads);
+    }
+    for (auto& request : finished)
+        FinishLoad(getContext(), request);
+
+    // Next level for each image, coarse to fine
+    for (const auto& image : byPriority)
+    {
+        if (image->bIsLoading || image->ResidentMip <= image->ImageBaseMip)
+            continue;
+        uint32_t firstMip = image->ResidentMip == image->MipLevels ? image->TailMip
+                                                                    : image->ResidentMip - 1;
+        size_t size = 0;
+        for (uint32_t mip = firstMip; mip < image->ResidentMip; mip++)
+            size += alignLevel(GetMipSize(image->Format, image->Width, image->Height, mip));
+        if (InFlightUpload > 0 && InFlightUpload + size > MaxInFlightUpload)
+            break;
+        InFlightUpload += size;
+        RequestLoad(image, firstMip, image->ResidentMip);
+    }
+
+    if (ctx)
+    {
+        ctx->FinishRecording();
+        cmdList->Commit();
+        Queue->Flush();
+    }
+
+    uint64_t completed = Queue->GetCompletedPoint();
+    while (!Retired.empty() && Retired.front().Point <= completed)
+        Retired.pop_front();
+}
+
+size_t CTextureStreamer::GetImageSize(const CStreamedImage& image, uint32_t baseMip) const
+{
+    size_t size = 0;
+    for (uint32_t mip = baseMip; mip < image.MipLevels; mip++)
+        size += GetMipSize(image.Format, image.Width, image.Height, mip);
+    return size;
+}
+
+std::vector<CStreamedImage::Ref> CTextureStreamer::UpdateTargets()
+{
+    std::vector<CStreamedImage::Ref> byPriority = Images;
+    size_t used = 0;
+    for (const auto& image : Images)
+        used += GetImageSize(*image, image->TailMip);
+    std::stable_sort(byPriority.begin(), byPriority.end(), [](const auto& a, const auto& b) {
+        return a->Priority.load(std::memory_order_relaxed)
+            > b->Priority.load(std::memory_order_relaxed);
+    });
+
+    // Greedy: the highest priorities get all they want, whatever is left over goes down the list
+    for (const auto& image : byPriority)
+    {
+        uint32_t wanted = std::min(image->WantedMip.load(std::memory_order_relaxed), image->TailMip);
+        uint32_t target = image->TailMip;
+        while (target > wanted)
+        {
+            size_t level = GetMipSize(image->Format, image->Width, image->Height, target - 1);
+            if (used + level > Budget)
+                break;
+            used += level;
+            target--;
+        }
+        image->TargetMip = target;
+    }
+    return byPriority;
+}
+
+void CTextureStreamer::Reallocate(ICopyContext& ctx, CStreamedImage& image, uint32_t baseMip)
+{
+    auto newImage = Device.CreateImage2D(
+        image.Format, EImageUsageFlags::Sampled | EImageUsageFlags::Streamed,
+        std::max(1u, image.Width >> baseMip), std::max(1u, image.Height >> baseMip),
+        image.MipLevels - baseMip);
+
+    uint32_t firstKept = std::max(image.ResidentMip, baseMip);
+    if (image.Image && firstKept < image.MipLevels)
+    {
+        std::vector<CImageCopy> regions;
+        for (uint32_t mip = firstKept; mip < image.MipLevels; mip++)
+        {
+            CImageCopy region;
+            region.SrcSubresource = { mip - image.ImageBaseMip, 0, 1 };
+            region.SrcOffset.Set(0, 0, 0);
+            region.DstSubresource = { mip - baseMip, 0, 1 };
+            region.DstOffset.Set(0, 0, 0);
+            region.Extent.Set(std::max(1u, image.Width >> mip), std::max(1u, image.Height >> mip),
+                              1);
+            regions.push_back(region);
+        }
+        ctx.CopyImage(*image.Image, *newImage, regions);
+    }
+
+    AllocatedSize -= GetImageSize(image, image.ImageBaseMip);
+    AllocatedSize += GetImageSize(image, baseMip);
+    Retire(image.Image, nullptr, nullptr);
+    image.Image = newImage;
+    image.ImageBaseMip = baseMip;
+    image.ResidentMip = image.ResidentMip == image.MipLevels ? image.MipLevels : firstKept;
+    UpdateView(image);
+}
+
+void CTextureStreamer::UpdateView(CStreamedImage& image)
+{
+    Retire(nullptr, image.View, nullptr);
+    image.View.reset();
+    if (image.ResidentMip >= image.MipLevels)
+        return;
+
+    CImageViewDesc desc;
+    desc.Type = EImageViewType::View2D;
+    desc.Format = image.Format;
+    desc.Range.Set(image.ResidentMip - image.ImageBaseMip, image.MipLevels - image.ResidentMip, 0,
+                   1);
+    image.View = Device.CreateImageView(desc, image.Image);
+}
+
+void CTextureStreamer::Retire(CImage::Ref image, CImageView::Ref view, CBuffer::Ref staging)
+{
+    if (!image && !view && !staging)
+        return;
+    Retired.push_back({ std::move(image), std::move(view), std::move(staging), kPendingPoint });
+}
+
+void CTextureStreamer::RequestLoad(CStreamedImage::Ref image, uint32_t firstMip, uint32_t endMip)
+{
+    size_t size = 0;
+    for (uint32_t mip = firstMip; mip < endMip; mip++)
+        size += alignLevel(GetMipSize(image->Format, image->Width, image->Height, mip));
+
+    // The loader writes straight into the mapped staging buffer
+    CLoadRequest request;
+    request.Image = std::move(image);
+    request.FirstMip = firstMip;
+    request.EndMip = endMip;
+    request.Staging = Device.CreateBuffer(size, EBufferUsageFlags::Streaming);
+    request.Mapped = request.Staging->Map(0, size);
+    request.Image->bIsLoading = true;
+    {
+        std::lock_guard<std::mutex> lk(LoadMutex);
+        PendingLoads.push_back(std::move(request));
+    }
+    LoadCondition.notify_one();
+}
+
+void CTextureStreamer::FinishLoad(ICopyContext& ctx, CLoadRequest& request)
+{
+    CStreamedImage& image = *request.Image;
+    request.Staging->Unmap();
+    image.bIsLoading = false;
+
+    size_t offset = 0;
+    std::vector<CBufferImageCopy> regions;
+    for (uint32_t mip = request.FirstMip; mip < request.EndMip; mip++)
+    {
+        InFlightUpload -= alignLevel(GetMipSize(image.Format, image.Width, image.Height, mip));
+
+        CBufferImageCopy region;
+        region.BufferOffset = offset;
+        region.BufferRowLength = 0;
+        region.BufferImageHeight = 0;
+        region.ImageSubresource = { mip - image.ImageBaseMip, 0, 1 };
+        region.ImageOffset.Set(0, 0, 0);
+        region.ImageExtent.Set(std::max(1u, image.Width >> mip), std::max(1u, image.Height >> mip),
+                               1);
+        regions.push_back(region);
+        offset += alignLevel(GetMipSize(image.Format, image.Width, image.Height, mip));
+    }
+
+    // Residency may have moved on while loading: unregistered, or the levels were evicted
+    bool isStale = !image.Image || request.EndMip != image.ResidentMip
+        || request.FirstMip < image.ImageBaseMip;
+    if (!isStale)
+    {
+        ctx.CopyBufferToImage(*request.Staging, *image.Image, regions);
+        image.ResidentMip = request.FirstMip;
+        UpdateView(image);
+    }
+    Retire(nullptr, nullptr, std::move(request.Staging));
+}
+
+void CTextureStreamer::LoaderThread()
+{
+    for (;;)
+    {
+        CLoadRequest request;
+        {
+            std::unique_lock<std::mutex> lk(LoadMutex);
+            LoadCondition.wait(lk, [this]() { return bIsStopping || !PendingLoads.empty(); });
+            if (bIsStopping)
+                return;
+            request = std::move(PendingLoads.front());
+            PendingLoads.pop_front();
+        }
+
+        const CStreamedImage& image = *request.Image;
+        size_t offset = 0;
+        for (uint32_t mip = request.FirstMip; mip < request.EndMip; mip++)
+        {
+            size_t size = GetMipSize(image.Format, image.Width, image.Height, mip);
+            image.Loader(mip, static_cast<uint8_t*>(request.Mapped) + offset, size);
+            offset += alignLevel(size);
+        }
+
+        std::lock_guard<std::mutex> lk(LoadMutex);
+        FinishedLoads.push_back(std::move(request));
+    }
+}
+
+} /* namespace RHI */
@@ -40,7 +40,7 @@ bool CAccessTracker::CalcOverlap(const CImageSubresourceRange& range1,
     return true;
 }
 
-void CAccessTracker::InsertImageBarrier(VkCommandBuffer cmdBuffer, CImageVk* image,
+bool CAccessTracker::InsertImageBarrier(VkCommandBuffer cmdBuffer, CImageVk* image,
                                         const CImageSubresourceRange& range,
                                         const CAccessRecord& oldAccess,
                                         const CAccessRecord& newAccess)
@@ -48,14 +48,14 @@ void CAccessTracker::InsertImageBarrier(VkCommandBuffer cmdBuffer, CImageVk* ima
     // Nop if read-read
     if (!oldAccess.IsWrite() && !newAccess.IsWrite()
         && oldAccess.ImageLayout == newAccess.ImageLayout)
-        return;
+        return false;
 
     // WAR only needs an execution barrier
     if (oldAccess.IsRead() && oldAccess.ImageLayout == newAccess.ImageLayout)
     {
         vkCmdPipelineBarrier(cmdBuffer, oldAccess.Stages, newAccess.Stages, 0, 0, nullptr, 0,
                              nullptr, 0, nullptr);
-        return;
+        return true;
     }
 
     VkImageMemoryBarrier barrier = {};
@@ -75,6 +75,7 @@ void CAccessTracker::InsertImageBarrier(VkCommandBuffer cmdBuffer, CImageVk* ima
     barrier.subresourceRange.levelCount = range.LevelCount;
     vkCmdPipelineBarrier(cmdBuffer, oldAccess.Stages, newAccess.Stages, 0, 0, nullptr, 0, nullptr,
                          1, &barrier);
+    return true;
 }
 
 void CAccessTracker::TransitionBuffer(CBufferVk* buffer, size_t offset, size_t size,
@@ -87,6 +88,8 @@ void CAccessTracker::TransitionImageState(VkCommandBuffer cmdBuffer, CImageVk* i
                                           const CImageSubresourceRange& range,
                                           EResourceState targetState, bool isTransferQueue)
 {
+    if (image->HasPendingAcquire())
+        OwnershipAcquires.insert(image);
     if (image->IsTrackingDisabled())
         return;
 
@@ -108,6 +111,8 @@ void CAccessTracker::TransitionImage(VkCommandBuffer cmdBuffer, CImageVk* image,
                                      const CImageSubresourceRange& range, VkAccessFlags access,
                                      VkPipelineStageFlags stages, VkImageLayout layout)
 {
+    if (image->HasPendingAcquire())
+        OwnershipAcquires.insert(image);
     if (image->IsTrackingDisabled())
         return;
 
@@ -119,24 +124,28 @@ void CAccessTracker::TransitionImage(VkCommandBuffer cmdBuffer, CImageVk* image,
     HandleImageLastAccess(cmdBuffer, image, range, currAccess);
 }
 
-void CAccessTracker::DeployAllBarriers(VkCommandBuffer cmdBuffer)
+bool CAccessTracker::DeployAllBarriers(VkCommandBuffer cmdBuffer)
 {
     // Transition all relevant images to the needed state
+    bool recorded = false;
     for (const auto& iter : ImageFirstAccess)
     {
         if (iter.second.ImageLayout == VK_IMAGE_LAYOUT_UNDEFINED
             || iter.second.ImageLayout == VK_IMAGE_LAYOUT_PREINITIALIZED)
             continue;
-        iter.first.Image->TransitionAccess(cmdBuffer, iter.first.Range, iter.second);
+        recorded |= iter.first.Image->TransitionAccess(cmdBuffer, iter.first.Range, iter.second);
     }
     for (const auto& iter : ImageLastAccess)
     {
         iter.first.Image->UpdateAccess(iter.first.Range, iter.second);
     }
+    return recorded;
 }
 
-void CAccessTracker::Merge(VkCommandBuffer cmdBuffer, const CAccessTracker& rhs)
+bool CAccessTracker::Merge(VkCommandBuffer cmdBuffer, const CAccessTracker& rhs)
 {
+    bool recorded = false;
+    OwnershipAcquires.insert(rhs.OwnershipAcquires.begin(), rhs.OwnershipAcquires.end());
     for (const auto& iter : rhs.ImageFirstAccess)
     {
         if (iter.second.ImageLayout == VK_IMAGE_LAYOUT_UNDEFINED
@@ -146,7 +155,7 @@ void CAccessTracker::Merge(VkCommandBuffer cmdBuffer, const CAccessTracker& rhs)
         const auto& range = iter.first.Range;
         const auto& access = iter.second;
         HandleImageFirstAccess(image, range, access);
-        HandleImageLastAccess(cmdBuffer, image, range, access);
+        recorded |= HandleImageLastAccess(cmdBuffer, image, range, access);
     }
     for (const auto& iter : rhs.ImageLastAccess)
     {
@@ -154,6 +163,7 @@ void CAccessTracker::Merge(VkCommandBuffer cmdBuffer, const CAccessTracker& rhs)
         const auto& range = iter.first.Range;
         HandleImageLastAccess(VK_NULL_HANDLE, image, range, iter.second);
     }
+    return recorded;
 }
 
 void CAccessTracker::HandleImageFirstAccess(CImageVk* image, const CImageSubresourceRange& range,
@@ -275,7 +285,7 @@ void CAccessTracker::HandleImageFirstAccess(CImageVk* image, const CImageSubreso
     ImageFirstAccess.emplace(CImageRange { image, range }, record);
 }
 
-void CAccessTracker::HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk* image,
+bool CAccessTracker::HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk* image,
                                            const CImageSubresourceRange& range,
                                            const CAccessRecord& record)
 {
@@ -284,9 +294,11 @@ void CAccessTracker::HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk*
     {
         // This image is never accessed before
         ImageLastAccess.emplace(CImageRange { image, range }, record);
-        return;
+        return false;
     }
 
+    bool recorded = false;
+
     while (iter != ImageLastAccess.end() && iter->first.Image == image)
     {
         if (!range.Overlaps(iter->first.Range))
@@ -307,7 +319,7 @@ void CAccessTracker::HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk*
             overlapRange.LevelCount = bottom - top + 1;
             overlapRange.BaseArrayLayer = left;
             overlapRange.LayerCount = right - left + 1;
-            InsertImageBarrier(cmdBuffer, image, overlapRange, iter->second, record);
+            recorded |= InsertImageBarrier(cmdBuffer, image, overlapRange, iter->second, record);
         }
 
         // Split the old region into 4 and remove the overlapping one from the store
@@ -405,6 +417,7 @@ void CAccessTracker::HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk*
     }
     // We insert the whole range if we've found no overlapping
     ImageLastAccess.emplace(CImageRange { image, range }, record);
+    return recorded;
 }
 
 }
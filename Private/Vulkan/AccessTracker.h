@@ -3,6 +3,7 @@
 #include "VkCommon.h"
 #include "VkHelpers.h"
 #include <map>
+#include <set>
 
 namespace RHI
 {
@@ -78,7 +79,8 @@ public:
     static bool CalcOverlap(const CImageSubresourceRange& range1,
                             const CImageSubresourceRange& range2, uint32_t& top, uint32_t& bottom,
                             uint32_t& left, uint32_t& right);
-    static void InsertImageBarrier(VkCommandBuffer cmdBuffer, CImageVk* image,
+    // The functions recording barriers return whether they recorded any
+    static bool InsertImageBarrier(VkCommandBuffer cmdBuffer, CImageVk* image,
                                    const CImageSubresourceRange& range,
                                    const CAccessRecord& oldAccess, const CAccessRecord& newAccess);
 
@@ -91,21 +93,25 @@ public:
                          const CImageSubresourceRange& range, VkAccessFlags access,
                          VkPipelineStageFlags stages, VkImageLayout layout);
 
-    void DeployAllBarriers(VkCommandBuffer cmdBuffer);
+    bool DeployAllBarriers(VkCommandBuffer cmdBuffer);
 
     // Merge two access trackers together, and record the intermediate transitions
-    void Merge(VkCommandBuffer cmdBuffer, const CAccessTracker& rhs);
+    bool Merge(VkCommandBuffer cmdBuffer, const CAccessTracker& rhs);
+
+    // Images that may still have to be acquired from another queue family before first use
+    const std::set<CImageVk*>& GetOwnershipAcquires() const { return OwnershipAcquires; }
 
     void Clear()
     {
         ImageFirstAccess.clear();
         ImageLastAccess.clear();
+        OwnershipAcquires.clear();
     }
 
 private:
     void HandleImageFirstAccess(CImageVk* image, const CImageSubresourceRange& range,
                                 const CAccessRecord& record);
-    void HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk* image,
+    bool HandleImageLastAccess(VkCommandBuffer cmdBuffer, CImageVk* image,
                                const CImageSubresourceRange& range, const CAccessRecord& record);
 
     // Not tracking buffers for now
@@ -114,6 +120,7 @@ private:
 
     std::map<CImageRange, CAccessRecord> ImageFirstAccess;
     std::map<CImageRange, CAccessRecord> ImageLastAccess;
+    std::set<CImageVk*> OwnershipAcquires;
 };
 
 }
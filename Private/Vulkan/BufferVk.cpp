@@ -1,7 +1,10 @@
 #include "BufferVk.h"
 #include "DeviceVk.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <iterator>
 
 namespace RHI
 {
@@ -27,7 +30,10 @@ CBufferVk::CBufferVk(CDeviceVk& p, size_t size, EBufferUsageFlags usage, const v
         gpuOnly = false;
     }
     if (Any(usage, EBufferUsageFlags::Streaming))
+    {
+        bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
         gpuOnly = false;
+    }
 
     if (gpuOnly)
     {
@@ -39,7 +45,36 @@ CBufferVk::CBufferVk(CDeviceVk& p, size_t size, EBufferUsageFlags usage, const v
         allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
     }
 
-    vmaCreateBuffer(Parent.GetAllocator(), &bufferInfo, &allocInfo, &Buffer, &Allocation, nullptr);
+    BufferUsage = bufferInfo.usage;
+    if (Any(usage, EBufferUsageFlags::Streaming))
+    {
+        VersionUsage = bufferInfo.usage;
+        CreateVersion(bufferInfo);
+        if (initialData)
+            memcpy(Versions[0].MappedData, initialData, size);
+        // Without initial data the GPU can't be reading anything useful yet, so the first Map may
+        //   keep version 0
+        bIsDiscardPending = initialData != nullptr;
+        return;
+    }
+
+    if (Any(usage, EBufferUsageFlags::Pooled) && size <= CBufferPoolVk::MaxPooledSize)
+    {
+        Pool = &Parent.GetBufferPool(bufferInfo.usage, allocInfo.usage);
+        PooledSize = size;
+        auto range = Pool->Allocate(PooledSize);
+        Buffer = range.Buffer;
+        Allocation = range.BlockAllocation;
+        Offset = range.Offset;
+        PooledMappedData = range.MappedData;
+    }
+    else
+    {
+        vmaCreateBuffer(Parent.GetAllocator(), &bufferInfo, &allocInfo, &Buffer, &Allocation,
+                        nullptr);
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, Allocation, true);
+        bIsMovable = gpuOnly;
+    }
 
     if (initialData && gpuOnly)
     {
@@ -56,62 +91,421 @@ CBufferVk::CBufferVk(CDeviceVk& p, size_t size, EBufferUsageFlags usage, const v
 
         vmaCreateBuffer(Parent.GetAllocator(), &stgbufferInfo, &stgallocInfo, &stagingBuffer,
                         &stagingAlloc, nullptr);
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Staging, stagingAlloc, true);
 
         void* mappedData;
         vmaMapMemory(Parent.GetAllocator(), stagingAlloc, &mappedData);
         memcpy(mappedData, initialData, size);
         vmaUnmapMemory(Parent.GetAllocator(), stagingAlloc);
 
-        // Copy the content
-        auto cmdList = Parent.GetDefaultCopyQueue()->CreateCommandList();
+        // Copy the content, on the render queue since buffers are exclusive to its family
+        auto cmdList = Parent.GetDefaultRenderQueue()->CreateCommandList();
         cmdList->Enqueue();
         auto ctx = std::static_pointer_cast<CCommandContextVk>(cmdList->CreateCopyContext());
         auto cmdBuffer = ctx->GetCmdBuffer();
         VkBufferCopy copy;
         copy.srcOffset = 0;
-        copy.dstOffset = 0;
+        copy.dstOffset = Offset;
         copy.size = size;
         vkCmdCopyBuffer(cmdBuffer, stagingBuffer, Buffer, 1, &copy);
+        ctx->InvalidateState();
         ctx->FinishRecording();
         cmdList->Commit();
-        Parent.GetDefaultCopyQueue()->Flush();
+        Parent.GetDefaultRenderQueue()->Flush();
 
-        Parent.AddPostFrameCleanup([stagingBuffer, stagingAlloc](CDeviceVk& p) {
-            vmaDestroyBuffer(p.GetAllocator(), stagingBuffer, stagingAlloc);
-        });
+        Parent.GetDeferredDeleter().DestroyBuffer(
+            stagingBuffer, stagingAlloc, static_cast<int>(CDeviceVk::EMemoryCategory::Staging));
     }
     else if (initialData)
     {
-        void* mappedData;
-        vmaMapMemory(Parent.GetAllocator(), Allocation, &mappedData);
-        memcpy(mappedData, initialData, size);
-        vmaUnmapMemory(Parent.GetAllocator(), Allocation);
+        memcpy(Map(0, size), initialData, size);
+        Unmap();
     }
+
+    // Only once the upload is recorded with the current handle
+    if (bIsMovable)
+        Parent.GetDefragmenter().Register(this);
+}
+
+CBufferVk::CBufferVk(CDeviceVk& p, VkBuffer buffer, size_t size, EBufferUsageFlags usage,
+                     CMemoryHeapVk::Ref heap, size_t offset)
+    : CBuffer(size, usage)
+    , Parent(p)
+    , Buffer(buffer)
+    , Allocation(VK_NULL_HANDLE)
+    , BufferUsage(GetPlacedBufferUsage(usage))
+    , Heap(std::move(heap))
+    , HeapOffset(offset)
+{
+}
+
+CBufferVk::CBufferVk(CDeviceVk& p, const void* hostPointer, size_t size,
+                     CFenceVk::Ref releaseFence)
+    : CBuffer(size, EBufferUsageFlags::None)
+    , Parent(p)
+    , Allocation(VK_NULL_HANDLE)
+    , BufferUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+    , ReleaseFence(std::move(releaseFence))
+{
+#ifdef VK_EXT_external_memory_host
+    VkExternalMemoryBufferCreateInfoKHR externalInfo = {
+        VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR
+    };
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.pNext = &externalInfo;
+    bufferInfo.size = size;
+    bufferInfo.usage = BufferUsage;
+    VK(vkCreateBuffer(Parent.GetVkDevice(), &bufferInfo, nullptr, &Buffer));
+
+    // Coherent memory saves flushing the whole range through a mapping
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(Parent.GetVkDevice(), Buffer, &memReqs);
+    uint32_t typeBits = memReqs.memoryTypeBits & Parent.GetHostPointerMemoryTypeBits(hostPointer);
+    const VkPhysicalDeviceMemoryProperties* memProps;
+    vmaGetMemoryProperties(Parent.GetAllocator(), &memProps);
+    uint32_t memoryType = UINT32_MAX;
+    for (uint32_t i = 0; i < memProps->memoryTypeCount; i++)
+    {
+        if (!(typeBits & (1u << i)))
+            continue;
+        if (memoryType == UINT32_MAX
+            || (memProps->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+            memoryType = i;
+    }
+    if (memoryType == UINT32_MAX)
+    {
+        vkDestroyBuffer(Parent.GetVkDevice(), Buffer, nullptr);
+        throw CRHIRuntimeError("Host memory can't back a transfer source buffer");
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {
+        VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT
+    };
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = const_cast<void*>(hostPointer);
+    VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    VkResult result = vkAllocateMemory(Parent.GetVkDevice(), &allocInfo, nullptr, &ImportedMemory);
+    if (result != VK_SUCCESS)
+    {
+        vkDestroyBuffer(Parent.GetVkDevice(), Buffer, nullptr);
+        throw CRHIRuntimeError("Could not import host memory");
+    }
+    VK(vkBindBufferMemory(Parent.GetVkDevice(), Buffer, ImportedMemory, 0));
+
+    VkMemoryPropertyFlags flags = memProps->memoryTypes[memoryType].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        void* mapped;
+        VK(vkMapMemory(Parent.GetVkDevice(), ImportedMemory, 0, VK_WHOLE_SIZE, 0, &mapped));
+        VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+        range.memory = ImportedMemory;
+        range.size = VK_WHOLE_SIZE;
+        VK(vkFlushMappedMemoryRanges(Parent.GetVkDevice(), 1, &range));
+        vkUnmapMemory(Parent.GetVkDevice(), ImportedMemory);
+    }
+#else
+    throw CRHIRuntimeError("Device can't import host memory");
+#endif
+}
+
+CBufferVk::CBufferVk(CDeviceVk& p, const CScratchRange& range)
+    : CBuffer(static_cast<size_t>(range.Size),
+              EBufferUsageFlags::VertexBuffer | EBufferUsageFlags::IndexBuffer)
+    , Parent(p)
+    , Buffer(range.Buffer)
+    , Allocation(VK_NULL_HANDLE)
+    , Offset(range.Offset)
+    , BufferUsage(CLinearScratchAllocator::BufferUsage)
+    , bIsScratch(true)
+{
 }
 
 CBufferVk::~CBufferVk()
 {
-    auto b = Buffer;
-    auto a = Allocation;
-    Parent.AddPostFrameCleanup([b, a](CDeviceVk& p) { vmaDestroyBuffer(p.GetAllocator(), b, a); });
+    if (bIsScratch)
+        return;
+
+    if (ImportedMemory)
+    {
+        // The caller may reuse the memory once nothing in flight reads it
+        Parent.GetDeferredDeleter().DestroyImportedBuffer(Buffer, ImportedMemory, ReleaseFence);
+        return;
+    }
+
+    if (Heap)
+    {
+        // The heap frees its memory after this, in the same frame or a later one
+        Parent.GetDeferredDeleter().DestroyBuffer(Buffer);
+        return;
+    }
+
+    if (!Versions.empty())
+    {
+        for (const auto& v : Versions)
+            Parent.GetDeferredDeleter().DestroyBuffer(
+                v.Buffer, v.Allocation, static_cast<int>(CDeviceVk::EMemoryCategory::Buffers));
+        return;
+    }
+
+    if (Pool)
+    {
+        Parent.GetDeferredDeleter().FreePoolRange(*Pool, Buffer, Offset, PooledSize);
+        return;
+    }
+
+    if (bIsMovable)
+        Parent.GetDefragmenter().Unregister(this);
+    Parent.GetDeferredDeleter().DestroyBuffer(
+        Buffer, Allocation, static_cast<int>(CDeviceVk::EMemoryCategory::Buffers));
 }
 
 void* CBufferVk::Map(size_t offset, size_t size)
 {
+    if (!Versions.empty())
+    {
+        if (bIsDiscardPending)
+            Discard();
+        bIsDiscardPending = true;
+        return static_cast<uint8_t*>(Versions[CurrVersion].MappedData) + offset;
+    }
+
+    if (Pool)
+        return static_cast<uint8_t*>(PooledMappedData) + offset;
+
+    if (ImportedMemory)
+        throw CRHIRuntimeError("Imported host buffers are written through the host pointer");
+
+    if (bIsScratch)
+        throw CRHIRuntimeError("Scratch memory is only accessible to the GPU");
+
+    if (Heap)
+    {
+        if (!Heap->GetMappedData())
+            throw CRHIRuntimeError("Only buffers in upload and readback heaps can be mapped");
+        if (Heap->GetType() == EMemoryHeapType::Readback)
+            vmaInvalidateAllocation(Parent.GetAllocator(), Heap->GetAllocation(),
+                                    HeapOffset + offset, size);
+        return static_cast<uint8_t*>(Heap->GetMappedData()) + HeapOffset + offset;
+    }
+
     void* result;
     vmaMapMemory(Parent.GetAllocator(), Allocation, &result);
     return static_cast<uint8_t*>(result) + offset;
 }
 
-void CBufferVk::Unmap() { vmaUnmapMemory(Parent.GetAllocator(), Allocation); }
+void CBufferVk::Unmap()
+{
+    if (!Versions.empty())
+    {
+        vmaFlushAllocation(Parent.GetAllocator(), Allocation, 0, VK_WHOLE_SIZE);
+        return;
+    }
+    if (Pool)
+    {
+        vmaFlushAllocation(Parent.GetAllocator(), Allocation, Offset, PooledSize);
+        return;
+    }
+    if (Heap)
+    {
+        vmaFlushAllocation(Parent.GetAllocator(), Heap->GetAllocation(), HeapOffset, Size);
+        return;
+    }
+    vmaUnmapMemory(Parent.GetAllocator(), Allocation);
+}
+
+VkBufferUsageFlags CBufferVk::GetPlacedBufferUsage(EBufferUsageFlags usage)
+{
+    if (Any(usage, EBufferUsageFlags::Streaming | EBufferUsageFlags::Pooled))
+        throw CRHIRuntimeError("Streaming and pooled buffers can't be placed in a heap");
+
+    VkBufferUsageFlags vkUsage =
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (Any(usage, EBufferUsageFlags::VertexBuffer))
+        vkUsage |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    if (Any(usage, EBufferUsageFlags::IndexBuffer))
+        vkUsage |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    if (Any(usage, EBufferUsageFlags::ConstantBuffer))
+        vkUsage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    return vkUsage;
+}
+
+void CBufferVk::Relocate(VkBuffer buffer, VmaAllocation allocation)
+{
+    Buffer = buffer;
+    Allocation = allocation;
+}
+
+void CBufferVk::CreateVersion(const VkBufferCreateInfo& bufferInfo)
+{
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    CVersion version;
+    VmaAllocationInfo info;
+    VK(vmaCreateBuffer(Parent.GetAllocator(), &bufferInfo, &allocInfo, &version.Buffer,
+                       &version.Allocation, &info));
+    Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, version.Allocation, true);
+    version.MappedData = info.pMappedData;
+    version.FrameSerial = 0;
+    version.CopyFrameSerial = 0;
+
+    CurrVersion = Versions.size();
+    Versions.push_back(version);
+    Buffer = version.Buffer;
+    Allocation = version.Allocation;
+}
+
+void CBufferVk::Discard()
+{
+    // The outgoing version may be referenced by anything recorded during the current frame, on
+    //   the render queue or as a copy source on the copy queue
+    auto queue = Parent.GetDefaultRenderQueue();
+    auto copyQueue = Parent.GetDefaultCopyQueue();
+    Versions[CurrVersion].FrameSerial = queue->GetFrameSerial();
+    Versions[CurrVersion].CopyFrameSerial = copyQueue->GetFrameSerial();
+    uint64_t completed = queue->GetCompletedFrameSerial();
+    uint64_t copyCompleted = copyQueue->GetCompletedFrameSerial();
+    for (size_t i = 1; i <= Versions.size(); i++)
+    {
+        size_t candidate = (CurrVersion + i) % Versions.size();
+        if (candidate != CurrVersion && Versions[candidate].FrameSerial <= completed
+            && Versions[candidate].CopyFrameSerial <= copyCompleted)
+        {
+            CurrVersion = candidate;
+            Buffer = Versions[candidate].Buffer;
+            Allocation = Versions[candidate].Allocation;
+            return;
+        }
+    }
+
+    // Every version is still in flight
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = Size;
+    bufferInfo.usage = VersionUsage;
+    CreateVersion(bufferInfo);
+}
+
+CBufferPoolVk::CBufferPoolVk(CDeviceVk& p, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+                             size_t alignment)
+    : Parent(p)
+    , Usage(usage)
+    , MemoryUsage(memoryUsage)
+    , Alignment(alignment)
+{
+}
+
+CBufferPoolVk::~CBufferPoolVk()
+{
+    for (const auto& block : Blocks)
+    {
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, block.Allocation, false);
+        vmaDestroyBuffer(Parent.GetAllocator(), block.Buffer, block.Allocation);
+    }
+}
+
+CBufferPoolVk::CAllocation CBufferPoolVk::Allocate(size_t& size)
+{
+    size = (size + Alignment - 1) / Alignment * Alignment;
+
+    std::lock_guard<std::mutex> lk(Mutex);
+    for (;;)
+    {
+        // First fit, the blocks are small enough for that to be fine
+        for (auto& block : Blocks)
+        {
+            for (auto iter = block.FreeRanges.begin(); iter != block.FreeRanges.end(); ++iter)
+            {
+                if (iter->second < size)
+                    continue;
+                size_t offset = iter->first;
+                size_t remaining = iter->second - size;
+                block.FreeRanges.erase(iter);
+                if (remaining)
+                    block.FreeRanges.emplace(offset + size, remaining);
+                void* mapped = block.MappedData
+                    ? static_cast<uint8_t*>(block.MappedData) + offset
+                    : nullptr;
+                return CAllocation { block.Buffer, block.Allocation, offset, mapped };
+            }
+        }
+
+        VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        bufferInfo.size = BlockSize;
+        bufferInfo.usage = Usage;
+
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = MemoryUsage;
+        if (MemoryUsage != VMA_MEMORY_USAGE_GPU_ONLY)
+            allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        CBlock block;
+        VmaAllocationInfo info;
+        VK(vmaCreateBuffer(Parent.GetAllocator(), &bufferInfo, &allocInfo, &block.Buffer,
+                           &block.Allocation, &info));
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, block.Allocation, true);
+        block.MappedData = info.pMappedData;
+        block.FreeRanges.emplace(0, BlockSize);
+        Blocks.push_back(std::move(block));
+    }
+}
+
+void CBufferPoolVk::Free(VkBuffer buffer, VkDeviceSize offset, size_t size)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    auto block = std::find_if(Blocks.begin(), Blocks.end(),
+                              [buffer](const CBlock& b) { return b.Buffer == buffer; });
+    assert(block != Blocks.end());
+
+    auto& ranges = block->FreeRanges;
+    auto next = ranges.lower_bound(offset);
+    size_t begin = offset;
+    size_t end = offset + size;
+    if (next != ranges.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == begin)
+        {
+            begin = prev->first;
+            ranges.erase(prev);
+        }
+    }
+    if (next != ranges.end() && next->first == end)
+    {
+        end += next->second;
+        ranges.erase(next);
+    }
+    ranges.emplace(begin, end - begin);
+}
+
+namespace
+{
+
+// The chunk a thread currently allocates from, only valid for the ring and epoch it came from
+struct CThreadChunk
+{
+    uint64_t InstanceId = 0;
+    uint64_t Epoch = 0;
+    size_t Offset = 0; // Virtual
+    size_t End = 0;
+};
+thread_local CThreadChunk tlsChunk;
+
+std::atomic<uint64_t> nextRingInstanceId { 1 };
+
+} /* anonymous namespace */
 
 CPersistentMappedRingBuffer::CPersistentMappedRingBuffer(CDeviceVk& p, size_t size,
                                                          VkBufferUsageFlags usage)
     : Parent(p)
-    , TotalSize(size)
+    , TotalSize((size + ChunkSize - 1) / ChunkSize * ChunkSize)
+    , InstanceId(nextRingInstanceId++)
 {
-    Remaining = TotalSize;
-
     VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     bufferInfo.size = TotalSize;
     bufferInfo.usage = usage;
@@ -121,60 +515,288 @@ CPersistentMappedRingBuffer::CPersistentMappedRingBuffer(CDeviceVk& p, size_t si
     allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
     vmaCreateBuffer(Parent.GetAllocator(), &bufferInfo, &allocInfo, &Handle, &Allocation, nullptr);
+    Parent.TrackAllocation(CDeviceVk::EMemoryCategory::ConstantRing, Allocation, true);
 
     vmaMapMemory(Parent.GetAllocator(), Allocation, &MappedData);
 }
 
 CPersistentMappedRingBuffer::~CPersistentMappedRingBuffer()
 {
+    Parent.TrackAllocation(CDeviceVk::EMemoryCategory::ConstantRing, Allocation, false);
     vmaUnmapMemory(Parent.GetAllocator(), Allocation);
     vmaDestroyBuffer(Parent.GetAllocator(), Handle, Allocation);
 }
 
+size_t CPersistentMappedRingBuffer::ClaimChunks(size_t chunkCount)
+{
+    size_t claimSize = chunkCount * ChunkSize;
+    if (claimSize > TotalSize)
+        return SIZE_MAX;
+
+    size_t head = Head.load(std::memory_order_relaxed);
+    size_t begin, newHead;
+    do
+    {
+        // Claims never straddle the end of the buffer, skip to the start instead
+        begin = head;
+        if (begin % TotalSize + claimSize > TotalSize)
+            begin = (begin / TotalSize + 1) * TotalSize;
+        newHead = begin + claimSize;
+        if (newHead - Tail.load(std::memory_order_acquire) > TotalSize)
+            return SIZE_MAX;
+    } while (!Head.compare_exchange_weak(head, newHead, std::memory_order_acq_rel,
+                                         std::memory_order_relaxed));
+    return begin;
+}
+
 void* CPersistentMappedRingBuffer::Allocate(size_t size, size_t alignment, size_t& outOffset)
 {
-    if (CurrBlock.End + size + alignment > TotalSize)
+    CThreadChunk& chunk = tlsChunk;
+    uint64_t epoch = Epoch.load(std::memory_order_acquire);
+    if (chunk.InstanceId != InstanceId || chunk.Epoch != epoch)
+        chunk = CThreadChunk { InstanceId, epoch, 0, 0 };
+
+    size_t allocOffset = (chunk.Offset + alignment - 1) / alignment * alignment;
+    if (chunk.End == 0 || allocOffset + size > chunk.End)
     {
-        size_t wastedSpace = TotalSize - CurrBlock.End;
-        if (wastedSpace > Remaining)
-            return nullptr; // Not enough free space to wrap around
-        // Wrap around
-        CurrBlock.End = 0;
-        Remaining -= wastedSpace;
+        // Chunks start aligned to ChunkSize, which is good for any alignment Vulkan asks for
+        size_t chunkCount = (size + ChunkSize - 1) / ChunkSize;
+        size_t begin = ClaimChunks(chunkCount);
+        if (begin == SIZE_MAX)
+            return nullptr;
+        // Big allocations get chunks of their own, the thread keeps filling its current one
+        if (chunkCount > 1)
+        {
+            outOffset = begin % TotalSize;
+            return static_cast<uint8_t*>(MappedData) + outOffset;
+        }
+        chunk.Offset = begin;
+        chunk.End = begin + ChunkSize;
+        allocOffset = begin;
     }
-    size_t allocOffset = (CurrBlock.End + alignment - 1) / alignment * alignment;
-    size_t wastedOnAlighment = allocOffset - CurrBlock.End;
-    if (allocOffset + size > TotalSize)
-        return nullptr;
-
-    Remaining = Remaining - wastedOnAlighment - size;
-    CurrBlock.End = allocOffset + size;
+    chunk.Offset = allocOffset + size;
 
-    outOffset = allocOffset;
-    return reinterpret_cast<void*>(reinterpret_cast<size_t>(MappedData) + allocOffset);
+    outOffset = allocOffset % TotalSize;
+    return static_cast<uint8_t*>(MappedData) + outOffset;
 }
 
-void CPersistentMappedRingBuffer::MarkBlockEnd()
+size_t CPersistentMappedRingBuffer::MarkBlockEnd()
 {
-    vmaFlushAllocation(Parent.GetAllocator(), Allocation, CurrBlock.Begin,
-                       CurrBlock.End - CurrBlock.Begin);
+    BlockInfo block;
+    block.Begin = BlockBegin;
+    block.End = Head.load(std::memory_order_acquire);
+    Epoch.fetch_add(1, std::memory_order_acq_rel);
+
+    size_t blockSize = block.End - block.Begin;
+    size_t physBegin = block.Begin % TotalSize;
+    if (blockSize >= TotalSize)
+        vmaFlushAllocation(Parent.GetAllocator(), Allocation, 0, TotalSize);
+    else if (physBegin + blockSize > TotalSize)
+    {
+        vmaFlushAllocation(Parent.GetAllocator(), Allocation, physBegin, TotalSize - physBegin);
+        vmaFlushAllocation(Parent.GetAllocator(), Allocation, 0,
+                           physBegin + blockSize - TotalSize);
+    }
+    else if (blockSize > 0)
+        vmaFlushAllocation(Parent.GetAllocator(), Allocation, physBegin, blockSize);
 
-    AllocatedBlocks.push(CurrBlock);
-    CurrBlock.Begin = CurrBlock.End;
-    if (CurrBlock.Begin == TotalSize)
-        CurrBlock.Begin = 0;
-    CurrBlock.End = CurrBlock.Begin;
+    AllocatedBlocks.push(block);
+    BlockBegin = block.End;
+    return blockSize;
 }
 
 void CPersistentMappedRingBuffer::FreeBlock()
 {
     const auto& firstBlock = AllocatedBlocks.front();
-    size_t blockSize = firstBlock.End - firstBlock.Begin;
-    if (firstBlock.End < firstBlock.Begin)
-        blockSize = firstBlock.End - firstBlock.Begin + TotalSize;
-    Remaining += blockSize;
-    assert(Remaining <= TotalSize);
+    assert(firstBlock.Begin == Tail.load(std::memory_order_relaxed));
+    Tail.store(firstBlock.End, std::memory_order_release);
     AllocatedBlocks.pop();
 }
 
+CGrowableRingBuffer::CGrowableRingBuffer(CDeviceVk& p, size_t ringSize, VkBufferUsageFlags usage)
+    : Parent(p)
+    , RingSize(ringSize)
+    , Usage(usage)
+{
+    CRing ring;
+    ring.Buffer = std::make_unique<CPersistentMappedRingBuffer>(Parent, RingSize, Usage);
+    ring.FirstBlock = 0;
+    CurrRing = ring.Buffer.get();
+    Rings.push_back(std::move(ring));
+}
+
+CGrowableRingBuffer::~CGrowableRingBuffer() = default;
+
+void* CGrowableRingBuffer::Allocate(size_t size, size_t alignment, size_t& outOffset,
+                                    VkBuffer& outBuffer)
+{
+    for (;;)
+    {
+        CPersistentMappedRingBuffer* ring = CurrRing.load(std::memory_order_acquire);
+        if (void* result = ring->Allocate(size, alignment, outOffset))
+        {
+            outBuffer = ring->GetHandle();
+            return result;
+        }
+
+        std::lock_guard<std::mutex> lk(Mutex);
+        if (CurrRing.load(std::memory_order_relaxed) != ring)
+            continue; // Someone else moved on already
+
+        // Try the rings after the full one before adding another
+        auto iter = std::find_if(Rings.begin(), Rings.end(),
+                                 [ring](const CRing& r) { return r.Buffer.get() == ring; });
+        if (iter != Rings.end() && ++iter != Rings.end())
+        {
+            CurrRing.store(iter->Buffer.get(), std::memory_order_release);
+            continue;
+        }
+
+        CRing newRing;
+        newRing.Buffer = std::make_unique<CPersistentMappedRingBuffer>(
+            Parent, std::max(RingSize, size + alignment), Usage);
+        newRing.FirstBlock = MarkedBlocks;
+        CurrRing.store(newRing.Buffer.get(), std::memory_order_release);
+        Rings.push_back(std::move(newRing));
+    }
+}
+
+void CGrowableRingBuffer::MarkBlockEnd()
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    size_t frameUsage = 0;
+    for (size_t i = 0; i < Rings.size(); i++)
+    {
+        size_t blockSize = Rings[i].Buffer->MarkBlockEnd();
+        frameUsage += blockSize;
+        Rings[i].IdleFrames = blockSize ? 0 : Rings[i].IdleFrames + 1;
+    }
+    MarkedBlocks++;
+    LastFrameUsage = frameUsage;
+    HighWaterMark = std::max(HighWaterMark, frameUsage);
+
+    // Extra rings that went unused for long enough wait for their blocks to be freed, then go
+    for (size_t i = Rings.size() - 1; i > 0; i--)
+    {
+        if (Rings[i].IdleFrames < ShrinkAfterFrames)
+            continue;
+        Rings[i].EndBlock = MarkedBlocks;
+        RetiredRings.push_back(std::move(Rings[i]));
+        Rings.erase(Rings.begin() + i);
+    }
+    CurrRing.store(Rings.front().Buffer.get(), std::memory_order_release);
+}
+
+void CGrowableRingBuffer::FreeBlock()
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    uint64_t block = FreedBlocks++;
+    for (auto& ring : Rings)
+        if (ring.FirstBlock <= block)
+            ring.Buffer->FreeBlock();
+    for (auto& ring : RetiredRings)
+        if (ring.FirstBlock <= block && block < ring.EndBlock)
+            ring.Buffer->FreeBlock();
+    RetiredRings.erase(std::remove_if(RetiredRings.begin(), RetiredRings.end(),
+                                      [this](const CRing& r) { return r.EndBlock <= FreedBlocks; }),
+                       RetiredRings.end());
+}
+
+CRingBufferStats CGrowableRingBuffer::GetStats() const
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    CRingBufferStats stats;
+    for (const auto& ring : Rings)
+        stats.Capacity += ring.Buffer->GetSize();
+    stats.RingCount = static_cast<uint32_t>(Rings.size());
+    stats.LastFrameUsage = LastFrameUsage;
+    stats.HighWaterMark = HighWaterMark;
+    return stats;
+}
+
+CLinearScratchAllocator::CLinearScratchAllocator(CDeviceVk& p, size_t blockSize)
+    : Parent(p)
+    , BlockSize(blockSize)
+{
+}
+
+CLinearScratchAllocator::~CLinearScratchAllocator()
+{
+    for (const auto& block : Blocks)
+    {
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, block->Allocation, false);
+        vmaDestroyBuffer(Parent.GetAllocator(), block->Buffer, block->Allocation);
+    }
+}
+
+CScratchRange CLinearScratchAllocator::Allocate(size_t size, size_t alignment)
+{
+    for (;;)
+    {
+        CBlock* block = CurrBlock.load(std::memory_order_acquire);
+        if (block)
+        {
+            size_t used = block->Used.load(std::memory_order_relaxed);
+            size_t begin = (used + alignment - 1) / alignment * alignment;
+            while (begin + size <= block->Size
+                   && !block->Used.compare_exchange_weak(used, begin + size,
+                                                         std::memory_order_relaxed))
+                begin = (used + alignment - 1) / alignment * alignment;
+            if (begin + size <= block->Size)
+                return CScratchRange { block->Buffer, begin, size };
+        }
+
+        std::lock_guard<std::mutex> lk(Mutex);
+        if (CurrBlock.load(std::memory_order_relaxed) != block)
+            continue; // Someone else moved on already
+
+        // Blocks kept from earlier frames come first
+        auto iter = std::find_if(Blocks.begin(), Blocks.end(), [block](const auto& b) {
+            return b.get() == block;
+        });
+        if (block && iter != Blocks.end() && ++iter != Blocks.end())
+        {
+            CurrBlock.store(iter->get(), std::memory_order_release);
+            continue;
+        }
+        if (!block && !Blocks.empty())
+        {
+            CurrBlock.store(Blocks.front().get(), std::memory_order_release);
+            continue;
+        }
+
+        auto newBlock = std::make_unique<CBlock>();
+        newBlock->Size = std::max(BlockSize, size + alignment);
+
+        VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        bufferInfo.size = newBlock->Size;
+        bufferInfo.usage = BufferUsage;
+
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        VK(vmaCreateBuffer(Parent.GetAllocator(), &bufferInfo, &allocInfo, &newBlock->Buffer,
+                           &newBlock->Allocation, nullptr));
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, newBlock->Allocation, true);
+        CurrBlock.store(newBlock.get(), std::memory_order_release);
+        Blocks.push_back(std::move(newBlock));
+    }
+}
+
+void CLinearScratchAllocator::Reset()
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    for (size_t i = Blocks.size(); i-- > 1;)
+    {
+        if (Blocks[i]->Used.load(std::memory_order_relaxed) != 0)
+            continue;
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, Blocks[i]->Allocation, false);
+        vmaDestroyBuffer(Parent.GetAllocator(), Blocks[i]->Buffer, Blocks[i]->Allocation);
+        Blocks.erase(Blocks.begin() + i);
+    }
+    for (const auto& block : Blocks)
+        block->Used.store(0, std::memory_order_relaxed);
+    CurrBlock.store(Blocks.empty() ? nullptr : Blocks.front().get(), std::memory_order_release);
+}
+
 }
@@ -1,31 +1,155 @@
 #pragma once
+#include "FenceVk.h"
+#include "MemoryHeapVk.h"
 #include "Resources.h"
 #include "VkCommon.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <vector>
 
 namespace RHI
 {
 
+class CBufferPoolVk;
+struct CScratchRange;
+
 class CBufferVk : public CBuffer
 {
 public:
     typedef std::shared_ptr<CBufferVk> Ref;
 
     CBufferVk(CDeviceVk& p, size_t size, EBufferUsageFlags usage, const void* initialData);
+    // Takes over buffer, which is already bound to heap at offset
+    CBufferVk(CDeviceVk& p, VkBuffer buffer, size_t size, EBufferUsageFlags usage,
+              CMemoryHeapVk::Ref heap, size_t offset);
+    // Imports host memory the caller owns as a transfer source, releaseFence is signaled once
+    //   the buffer is destroyed and the GPU is done with it
+    CBufferVk(CDeviceVk& p, const void* hostPointer, size_t size, CFenceVk::Ref releaseFence);
+    // Refers to a range of a queue frame's scratch memory, which outlives it
+    CBufferVk(CDeviceVk& p, const CScratchRange& range);
     ~CBufferVk() override;
 
+    // Placed buffers can't be streaming or pooled, everything else may also be copied around
+    static VkBufferUsageFlags GetPlacedBufferUsage(EBufferUsageFlags usage);
+
+    // For streaming buffers this is the version the last Map handed out, so commands recorded
+    //   after a Map read what it wrote
     const VkBuffer& GetHandle() const { return Buffer; }
+    // Where the buffer starts inside GetHandle(), only pooled buffers have one
+    VkDeviceSize GetOffset() const { return Offset; }
+    VmaAllocation GetAllocation() const { return Allocation; }
+
+    // Device local buffers with an allocation of their own may be moved by the defragmenter,
+    //   which copies the contents and hands over the new place. The old one is up to the caller.
+    bool IsMovable() const { return bIsMovable; }
+    VkBufferUsageFlags GetBufferUsage() const { return BufferUsage; }
+    void Relocate(VkBuffer buffer, VmaAllocation allocation);
+    // Streaming buffers change their handle on Map
+    bool IsStreaming() const { return !Versions.empty(); }
 
+    // Streaming buffers are persistently mapped and discard on Map: the previous contents stay
+    //   with the frames that use them and a free version of the buffer is returned instead
     void* Map(size_t offset, size_t size);
     void Unmap();
 
 private:
+    struct CVersion
+    {
+        VkBuffer Buffer;
+        VmaAllocation Allocation;
+        void* MappedData;
+        // Frames of the render and copy queue that last had this version bound
+        uint64_t FrameSerial;
+        uint64_t CopyFrameSerial;
+    };
+
+    void CreateVersion(const VkBufferCreateInfo& bufferInfo);
+    void Discard();
+
     CDeviceVk& Parent;
 
     VkBuffer Buffer;
     VmaAllocation Allocation;
+    VkDeviceSize Offset = 0;
+    VkBufferUsageFlags BufferUsage = 0;
+    bool bIsMovable = false;
+
+    // Set for buffers placed in a memory heap
+    CMemoryHeapVk::Ref Heap;
+    size_t HeapOffset = 0;
+
+    // Set for buffers wrapping imported host memory
+    VkDeviceMemory ImportedMemory = VK_NULL_HANDLE;
+    CFenceVk::Ref ReleaseFence;
+
+    // Set for buffers referring to scratch memory
+    bool bIsScratch = false;
+
+    // Set for buffers carved out of a shared one
+    CBufferPoolVk* Pool = nullptr;
+    void* PooledMappedData = nullptr;
+    size_t PooledSize = 0;
+
+    std::vector<CVersion> Versions;
+    VkBufferUsageFlags VersionUsage = 0;
+    size_t CurrVersion = 0;
+    bool bIsDiscardPending = false;
+};
+
+// Hands out ranges of large buffers, one pool per usage and memory type. Host visible blocks are
+//   persistently mapped.
+class CBufferPoolVk
+{
+public:
+    struct CAllocation
+    {
+        VkBuffer Buffer;
+        VmaAllocation BlockAllocation;
+        VkDeviceSize Offset;
+        void* MappedData;
+    };
+
+    CBufferPoolVk(CDeviceVk& p, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+                  size_t alignment);
+    ~CBufferPoolVk();
+    CBufferPoolVk(const CBufferPoolVk&) = delete;
+    CBufferPoolVk& operator=(const CBufferPoolVk&) = delete;
+
+    // size is rounded up to the alignment, Free takes the rounded size
+    CAllocation Allocate(size_t& size);
+    void Free(VkBuffer buffer, VkDeviceSize offset, size_t size);
+
+    // Bigger buffers get their own allocation
+    static const size_t MaxPooledSize = 256 * 1024;
+    static const size_t BlockSize = 8 * 1024 * 1024;
+
+private:
+    struct CBlock
+    {
+        VkBuffer Buffer;
+        VmaAllocation Allocation;
+        void* MappedData;
+        // Free ranges, offset to size, neighbours are always merged
+        std::map<size_t, size_t> FreeRanges;
+    };
+
+    CDeviceVk& Parent;
+    VkBufferUsageFlags Usage;
+    VmaMemoryUsage MemoryUsage;
+    size_t Alignment;
+
+    std::mutex Mutex;
+    std::vector<CBlock> Blocks;
 };
 
+// Per frame scratch memory, e.g. for constants. Safe to allocate from any number of recording
+//   threads: each one claims chunks of the ring with a CAS and bump allocates inside its chunk
+//   without further synchronization. MarkBlockEnd and FreeBlock delimit frames and must not run
+//   concurrently with recording.
 class CPersistentMappedRingBuffer
 {
 public:
@@ -36,30 +160,146 @@ public:
     CPersistentMappedRingBuffer& operator=(const CPersistentMappedRingBuffer&) = delete;
     CPersistentMappedRingBuffer& operator=(CPersistentMappedRingBuffer&&) = delete;
 
+    // Returns nullptr if the frames in flight use up the whole ring
     void* Allocate(size_t size, size_t alignment, size_t& outOffset);
-    void MarkBlockEnd();
+    // Returns the size of the block, including space lost to chunking and wrapping
+    size_t MarkBlockEnd();
     void FreeBlock();
 
     VkBuffer GetHandle() const { return Handle; }
+    size_t GetSize() const { return TotalSize; }
+
+    // Unit in which threads claim the ring, the size has to be a multiple of it
+    static const size_t ChunkSize = 64 * 1024;
 
 private:
+    // Claims chunkCount contiguous chunks, returns the virtual offset or SIZE_MAX if full
+    size_t ClaimChunks(size_t chunkCount);
+
     CDeviceVk& Parent;
 
     VkBuffer Handle;
     VmaAllocation Allocation;
 
     size_t TotalSize;
-    size_t Remaining;
+    // Distinguishes rings in the thread local chunk cache
+    uint64_t InstanceId;
+
+    // Virtual offsets only ever grow, the physical offset is modulo TotalSize. Everything between
+    //   Tail and Head is in use by some frame.
+    std::atomic<size_t> Head { 0 };
+    std::atomic<size_t> Tail { 0 };
+    // Bumped by MarkBlockEnd, so that no thread keeps filling a chunk of a finished frame
+    std::atomic<uint64_t> Epoch { 0 };
 
     struct BlockInfo
     {
         size_t Begin = 0;
         size_t End = 0;
     };
-    BlockInfo CurrBlock;
+    size_t BlockBegin = 0;
     std::queue<BlockInfo> AllocatedBlocks;
 
     void* MappedData;
 };
 
+struct CRingBufferStats
+{
+    size_t Capacity = 0;
+    uint32_t RingCount = 0;
+    // Ring space taken by the last finished frame, and the most any frame has taken so far
+    size_t LastFrameUsage = 0;
+    size_t HighWaterMark = 0;
+};
+
+// A chain of ring buffers that grows by another ring whenever a frame fills all of them, and
+//   drops the extra rings again once they've sat idle for ShrinkAfterFrames frames. Every frame
+//   starts allocating from the first ring, so the extras only see use under load.
+class CGrowableRingBuffer
+{
+public:
+    CGrowableRingBuffer(CDeviceVk& p, size_t ringSize, VkBufferUsageFlags usage);
+    ~CGrowableRingBuffer();
+    CGrowableRingBuffer(const CGrowableRingBuffer&) = delete;
+    CGrowableRingBuffer& operator=(const CGrowableRingBuffer&) = delete;
+
+    // Thread safe, only takes a lock when a new ring has to be added
+    void* Allocate(size_t size, size_t alignment, size_t& outOffset, VkBuffer& outBuffer);
+    void MarkBlockEnd();
+    void FreeBlock();
+
+    CRingBufferStats GetStats() const;
+
+    static const uint32_t ShrinkAfterFrames = 300;
+
+private:
+    struct CRing
+    {
+        std::unique_ptr<CPersistentMappedRingBuffer> Buffer;
+        // Blocks are numbered by the MarkBlockEnd that closed them. This ring has one for each
+        //   of [FirstBlock, EndBlock), EndBlock is only set once the ring is retired.
+        uint64_t FirstBlock;
+        uint64_t EndBlock = UINT64_MAX;
+        uint32_t IdleFrames = 0;
+    };
+
+    CDeviceVk& Parent;
+    size_t RingSize;
+    VkBufferUsageFlags Usage;
+
+    mutable std::mutex Mutex;
+    std::vector<CRing> Rings;
+    std::vector<CRing> RetiredRings;
+    std::atomic<CPersistentMappedRingBuffer*> CurrRing;
+    uint64_t MarkedBlocks = 0;
+    uint64_t FreedBlocks = 0;
+
+    size_t LastFrameUsage = 0;
+    size_t HighWaterMark = 0;
+};
+
+// A piece of device local scratch memory
+struct CScratchRange
+{
+    VkBuffer Buffer;
+    VkDeviceSize Offset;
+    VkDeviceSize Size;
+};
+
+// Linear allocator for GPU only data that lives within one frame, e.g. indirect arguments or
+//   compute temporaries. Any thread can allocate, the owner resets it once the GPU is done.
+class CLinearScratchAllocator
+{
+public:
+    explicit CLinearScratchAllocator(CDeviceVk& p, size_t blockSize = 16 << 20);
+    ~CLinearScratchAllocator();
+    CLinearScratchAllocator(const CLinearScratchAllocator&) = delete;
+    CLinearScratchAllocator& operator=(const CLinearScratchAllocator&) = delete;
+
+    CScratchRange Allocate(size_t size, size_t alignment);
+    // Blocks are made for anything the GPU may do with a buffer
+    static constexpr VkBufferUsageFlags BufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+        | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+        | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    // Blocks that saw no use since the last reset are released, except for the first
+    void Reset();
+
+private:
+    struct CBlock
+    {
+        VkBuffer Buffer;
+        VmaAllocation Allocation;
+        size_t Size;
+        std::atomic<size_t> Used { 0 };
+    };
+
+    CDeviceVk& Parent;
+    size_t BlockSize;
+
+    std::mutex Mutex;
+    std::vector<std::unique_ptr<CBlock>> Blocks;
+    std::atomic<CBlock*> CurrBlock { nullptr };
+};
+
 } /* namespace RHI */
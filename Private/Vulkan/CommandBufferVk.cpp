@@ -1,19 +1,16 @@
 #include "CommandBufferVk.h"
 #include "DeviceVk.h"
 #include "RenderPassVk.h"
+#include <unordered_map>
 
 namespace RHI
 {
 
-CCommandPoolVk::CCommandPoolVk(CDeviceVk& p, EQueueType queueType, bool resetIndividualBuffer)
+CCommandPoolVk::CCommandPoolVk(CDeviceVk& p, EQueueType queueType)
     : Parent(p)
-    , bResetIndividualBuffer(resetIndividualBuffer)
-    , bCanAllocateFromFreedList(false)
 {
     VkCommandPoolCreateInfo ci = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
     ci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
-    if (resetIndividualBuffer)
-        ci.flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     ci.queueFamilyIndex = Parent.GetQueueFamily(queueType);
     VK(vkCreateCommandPool(Parent.GetVkDevice(), &ci, nullptr, &Handle));
 }
@@ -22,47 +19,32 @@ CCommandPoolVk::~CCommandPoolVk() { vkDestroyCommandPool(Parent.GetVkDevice(), H
 
 std::unique_ptr<CCommandBufferVk> CCommandPoolVk::AllocateCommandBuffer(bool secondary)
 {
-    if (bResetIndividualBuffer || !bCanAllocateFromFreedList)
-        return std::make_unique<CCommandBufferVk>(shared_from_this(), secondary);
-
-    std::unique_lock<tc::FSpinLock> lk(BufferListLock);
-    if (secondary)
-    {
-        if (FreedSecondaryBuffers.empty())
-            return std::make_unique<CCommandBufferVk>(shared_from_this(), secondary);
-        VkCommandBuffer buffer = FreedSecondaryBuffers.front();
-        FreedSecondaryBuffers.pop();
-        return std::make_unique<CCommandBufferVk>(shared_from_this(), buffer, secondary);
-    }
-    else
+    // Whatever was recorded has finished executing or was never submitted
+    if (BuffersInUse.load(std::memory_order_acquire) == 0 && (NextPrimary || NextSecondary))
     {
-        if (FreedPrimaryBuffers.empty())
-            return std::make_unique<CCommandBufferVk>(shared_from_this(), secondary);
-        VkCommandBuffer buffer = FreedPrimaryBuffers.front();
-        FreedPrimaryBuffers.pop();
-        return std::make_unique<CCommandBufferVk>(shared_from_this(), buffer, secondary);
+        VK(vkResetCommandPool(Parent.GetVkDevice(), Handle, 0));
+        NextPrimary = 0;
+        NextSecondary = 0;
     }
-}
 
-void CCommandPoolVk::ResetPool()
-{
-    VK(vkResetCommandPool(Parent.GetVkDevice(), Handle, 0));
-    bCanAllocateFromFreedList = true;
-}
+    auto& buffers = secondary ? SecondaryBuffers : PrimaryBuffers;
+    auto& next = secondary ? NextSecondary : NextPrimary;
+    if (next == buffers.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+        allocInfo.commandPool = Handle;
+        if (secondary)
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        else
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
 
-CCommandBufferVk::CCommandBufferVk(CCommandPoolVk::Ref pool, bool secondary)
-    : CommandPool(pool)
-    , bIsSecondary(secondary)
-{
-    VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-    allocInfo.commandPool = pool->GetHandle();
-    if (secondary)
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-    else
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
-
-    VK(vkAllocateCommandBuffers(CommandPool->GetParent().GetVkDevice(), &allocInfo, &Handle));
+        VkCommandBuffer handle;
+        VK(vkAllocateCommandBuffers(Parent.GetVkDevice(), &allocInfo, &handle));
+        buffers.push_back(handle);
+    }
+    BuffersInUse.fetch_add(1, std::memory_order_relaxed);
+    return std::make_unique<CCommandBufferVk>(shared_from_this(), buffers[next++], secondary);
 }
 
 CCommandBufferVk::CCommandBufferVk(CCommandPoolVk::Ref pool, VkCommandBuffer handle, bool secondary)
@@ -74,27 +56,15 @@ CCommandBufferVk::CCommandBufferVk(CCommandPoolVk::Ref pool, VkCommandBuffer han
 
 CCommandBufferVk::~CCommandBufferVk()
 {
-    if (CommandPool->bResetIndividualBuffer)
-        vkFreeCommandBuffers(CommandPool->GetParent().GetVkDevice(), CommandPool->GetHandle(), 1,
-                             &Handle);
-    else
-    {
-        std::unique_lock<tc::FSpinLock> lk(CommandPool->BufferListLock);
-        if (bIsSecondary)
-            CommandPool->FreedSecondaryBuffers.push(Handle);
-        else
-            CommandPool->FreedPrimaryBuffers.push(Handle);
-        CommandPool->bCanAllocateFromFreedList = false;
-    }
-
-    if (BufferAllocator)
-        BufferAllocator->UnlockPool(AllocatorPoolIndex);
-    BufferAllocator = nullptr;
+    // The handle stays with the pool until it is reset
+    CommandPool->BuffersInUse.fetch_sub(1, std::memory_order_release);
 }
 
-void CCommandBufferVk::BeginRecording(CRenderPass::Ref renderPass, uint32_t subpass)
+void CCommandBufferVk::BeginRecording(CRenderPass::Ref renderPass, uint32_t subpass,
+                                      VkCommandBufferUsageFlags usage)
 {
     VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    beginInfo.flags = usage;
     VkCommandBufferInheritanceInfo inheritInfo = {
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO
     };
@@ -116,7 +86,6 @@ void CCommandBufferVk::BeginRecording(CRenderPass::Ref renderPass, uint32_t subp
         beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
     }
 
-    beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     VK(vkBeginCommandBuffer(Handle, &beginInfo));
 }
 
@@ -125,44 +94,50 @@ void CCommandBufferVk::EndRecording()
     VkResult result = vkEndCommandBuffer(Handle);
     if (result != VK_SUCCESS)
         throw CRHIRuntimeError("Could not end command buffer");
-
-    if (BufferAllocator)
-        BufferAllocator->UnlockPool(AllocatorPoolIndex);
-    BufferAllocator = nullptr;
 }
 
+namespace
+{
+
+std::atomic<uint64_t> nextAllocatorInstanceId { 1 };
+
+} /* anonymous namespace */
+
 CCommandBufferAllocatorVk::CCommandBufferAllocatorVk(CDeviceVk& deviceVk, EQueueType queueType)
+    : Parent(deviceVk)
+    , QueueType(queueType)
+    , InstanceId(nextAllocatorInstanceId++)
 {
-    for (size_t i = 0; i < kNumPools; i++)
-    {
-        auto pool = std::make_shared<CCommandPoolVk>(deviceVk, queueType, true);
-        Pools.emplace_back(std::move(pool));
-        AvailablePools.push(i);
-    }
 }
 
 std::unique_ptr<CCommandBufferVk> CCommandBufferAllocatorVk::Allocate(bool secondary)
 {
-    Mutex.Lock();
-    while (AvailablePools.empty())
-    {
-        Mutex.Unlock();
-        Mutex.Lock();
-    }
-    size_t poolIndex = AvailablePools.top();
-    AvailablePools.pop();
-    Mutex.Unlock();
-
-    auto cmdBuffer = Pools[poolIndex]->AllocateCommandBuffer(secondary);
-    cmdBuffer->BufferAllocator = this;
-    cmdBuffer->AllocatorPoolIndex = poolIndex;
-    return cmdBuffer;
+    auto& pools = GetThreadPools();
+    uint64_t frame = Frame.load(std::memory_order_acquire);
+    uint32_t frameCount = FrameCount.load(std::memory_order_acquire);
+    if (pools.Pools.size() < frameCount)
+        pools.Pools.resize(frameCount);
+    auto& pool = pools.Pools[frame % frameCount];
+    if (!pool)
+        pool = std::make_shared<CCommandPoolVk>(Parent, QueueType);
+    return pool->AllocateCommandBuffer(secondary);
 }
 
-void CCommandBufferAllocatorVk::UnlockPool(size_t index)
+CCommandBufferAllocatorVk::CThreadPools& CCommandBufferAllocatorVk::GetThreadPools()
 {
-    std::lock_guard<tc::FSpinLock> lk(Mutex);
-    AvailablePools.push(index);
+    // Keyed by allocator, ids are never reused so entries of destroyed ones are just never found
+    thread_local std::unordered_map<uint64_t, CThreadPools*> tlsPools;
+    auto& entry = tlsPools[InstanceId];
+    if (!entry)
+    {
+        auto pools = std::make_unique<CThreadPools>();
+        entry = pools.get();
+
+        // Owned by the allocator, threads may well exit before their command lists finish
+        std::lock_guard<std::mutex> lk(Mutex);
+        ThreadPools.push_back(std::move(pools));
+    }
+    return *entry;
 }
 
 }
@@ -2,10 +2,9 @@
 #include "CommandQueue.h"
 #include "RenderPass.h"
 #include "VkCommon.h"
-#include <SpinLock.h>
+#include <atomic>
 #include <memory>
-#include <queue>
-#include <stack>
+#include <mutex>
 #include <vector>
 
 namespace RHI
@@ -13,71 +12,94 @@ namespace RHI
 
 class CCommandBufferVk;
 
+// Command buffers come out of a pool in order and go back all at once when the pool is reset.
+//   Each pool belongs to one recording thread, which is the only one to allocate, record and reset,
+//   so none of that needs a lock.
 class CCommandPoolVk : public std::enable_shared_from_this<CCommandPoolVk>
 {
 public:
     typedef std::shared_ptr<CCommandPoolVk> Ref;
 
-    CCommandPoolVk(CDeviceVk& p, EQueueType queueType, bool resetIndividualBuffer = true);
+    CCommandPoolVk(CDeviceVk& p, EQueueType queueType);
     ~CCommandPoolVk();
+    CCommandPoolVk(const CCommandPoolVk&) = delete;
+    CCommandPoolVk& operator=(const CCommandPoolVk&) = delete;
 
     CDeviceVk& GetParent() const { return Parent; }
     VkCommandPool GetHandle() const { return Handle; }
+    // Recycles every command buffer first if none is still held by a command list
     std::unique_ptr<CCommandBufferVk> AllocateCommandBuffer(bool secondary = false);
-    void ResetPool();
 
 private:
     friend class CCommandBufferVk;
 
     CDeviceVk& Parent;
     VkCommandPool Handle;
-    bool bResetIndividualBuffer;
-
-    // If this pool doesn't support freeing individual buffers, used ones go into freed list first,
-    // after reset pool, they go into reset list ready for reallocation
-    tc::FSpinLock BufferListLock;
-    std::queue<VkCommandBuffer> FreedPrimaryBuffers;
-    std::queue<VkCommandBuffer> FreedSecondaryBuffers;
-    bool bCanAllocateFromFreedList;
+
+    // Everything ever allocated from the pool, the ones before Next* are handed out
+    std::vector<VkCommandBuffer> PrimaryBuffers;
+    std::vector<VkCommandBuffer> SecondaryBuffers;
+    size_t NextPrimary = 0;
+    size_t NextSecondary = 0;
+    // Dropped from whichever thread releases the command list
+    std::atomic<uint32_t> BuffersInUse { 0 };
 };
 
-// Purpose is to allow dynamic assignment of pools
+// Hands every recording thread a pool per frame in flight, so that the pools of frames the queue
+//   has waited for drain and get reset while the current one fills. Contexts have to be recorded
+//   on the thread that created them.
 class CCommandBufferAllocatorVk
 {
 public:
     CCommandBufferAllocatorVk(CDeviceVk& deviceVk, EQueueType queueType);
+    CCommandBufferAllocatorVk(const CCommandBufferAllocatorVk&) = delete;
+    CCommandBufferAllocatorVk& operator=(const CCommandBufferAllocatorVk&) = delete;
 
     std::unique_ptr<CCommandBufferVk> Allocate(bool secondary = false);
 
-    void UnlockPool(size_t index);
+    // Called by the queue once the frame it moves on to has finished on the GPU
+    void AdvanceFrame() { Frame.fetch_add(1, std::memory_order_acq_rel); }
+    // Follows the frames in flight of the queue. Pools are only reset once none of their command
+    //   buffers is in use, so changing this between frames is fine.
+    void SetFrameCount(uint32_t count) { FrameCount.store(count, std::memory_order_release); }
 
 private:
-    tc::FSpinLock Mutex;
-    static const size_t kNumPools = 12;
-    std::vector<CCommandPoolVk::Ref> Pools;
-    std::stack<size_t> AvailablePools;
+    // Pools are created as the frame count grows
+    struct CThreadPools
+    {
+        std::vector<CCommandPoolVk::Ref> Pools;
+    };
+
+    CThreadPools& GetThreadPools();
+
+    CDeviceVk& Parent;
+    EQueueType QueueType;
+    // Distinguishes allocators in the thread local pool cache
+    uint64_t InstanceId;
+    std::atomic<uint64_t> Frame { 1 };
+    std::atomic<uint32_t> FrameCount { 3 };
+
+    std::mutex Mutex;
+    std::vector<std::unique_ptr<CThreadPools>> ThreadPools;
 };
 
 class CCommandBufferVk
 {
 public:
-    explicit CCommandBufferVk(CCommandPoolVk::Ref pool, bool secondary = false);
+    // Keeps the pool from being reset until destroyed
     CCommandBufferVk(CCommandPoolVk::Ref pool, VkCommandBuffer handle, bool secondary = false);
     ~CCommandBufferVk();
 
     VkCommandBuffer GetHandle() const { return Handle; }
-    void BeginRecording(CRenderPass::Ref renderPass, uint32_t subpass);
+    void BeginRecording(
+        CRenderPass::Ref renderPass, uint32_t subpass,
+        VkCommandBufferUsageFlags usage = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
     void EndRecording();
 
 private:
     CCommandPoolVk::Ref CommandPool;
     VkCommandBuffer Handle;
     bool bIsSecondary;
-
-    // If this command buffer is allocated from an allocator, we need to unlock the pool
-    friend class CCommandBufferAllocatorVk;
-    CCommandBufferAllocatorVk* BufferAllocator = nullptr;
-    size_t AllocatorPoolIndex = 0;
 };
 
 }
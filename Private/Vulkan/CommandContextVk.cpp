@@ -7,6 +7,7 @@
 #include "ImageVk.h"
 #include "PipelineVk.h"
 #include "RenderPassVk.h"
+#include <cstring>
 
 namespace RHI
 {
@@ -51,6 +52,18 @@ IRenderContext::Ref CRenderPassContextVk::CreateRenderContext(uint32_t subpass)
     return std::make_shared<CCommandContextVk>(shared_from_this(), subpass);
 }
 
+void CRenderPassContextVk::ExecuteBundle(uint32_t subpass, IRenderBundle& bundle)
+{
+    auto& impl = static_cast<CRenderBundleVk&>(bundle);
+    if (impl.GetSubpass() != subpass)
+        throw CRHIRuntimeError("Render bundle was recorded for a different subpass");
+    auto recording = impl.GetRecording();
+
+    std::lock_guard<tc::FSpinLock> lk(SpinLock);
+    SubpassInfos[subpass].emplace_back();
+    SubpassInfos[subpass].back().Bundle = std::move(recording);
+}
+
 void CRenderPassContextVk::FinishRecording()
 {
     static_assert(sizeof(VkClearValue) == sizeof(CClearValue), "Struct sizes mismatch");
@@ -72,9 +85,7 @@ void CRenderPassContextVk::FinishRecording()
             section.WaitSemaphores.push_back(semaphore);
             section.WaitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
 
-            CmdList->GetQueue().GetDevice().AddPostFrameCleanup([semaphore](CDeviceVk& p) {
-                vkDestroySemaphore(p.GetVkDevice(), semaphore, nullptr);
-            });
+            CmdList->GetQueue().GetDevice().GetDeferredDeleter().DestroySemaphore(semaphore);
         }
 
         renderPass->UpdateImageInitialAccess(section.AccessTracker);
@@ -91,6 +102,15 @@ void CRenderPassContextVk::FinishRecording()
             std::vector<VkCommandBuffer> secondaryBuffers;
             for (auto& subpassInfo : SubpassInfos[i])
             {
+                if (subpassInfo.Bundle)
+                {
+                    auto& bundle = subpassInfo.Bundle;
+                    secondaryBuffers.emplace_back(bundle->CmdBuffer->GetHandle());
+                    section.AccessTracker.Merge(VK_NULL_HANDLE, bundle->AccessTracker);
+                    section.Bundles.emplace_back(std::move(bundle));
+                    continue;
+                }
+
                 auto& bufferRef = subpassInfo.SecondaryBuffer;
                 secondaryBuffers.emplace_back(bufferRef->GetHandle());
                 section.SecondaryBuffers.emplace_back(std::move(bufferRef));
@@ -118,10 +138,14 @@ void CRenderPassContextVk::FinishRecording()
         CmdList->Sections.back().PreCmdBuffer =
             CmdList->GetQueue().GetCmdBufferAllocator().Allocate();
         CmdList->Sections.back().PreCmdBuffer->BeginRecording(VK_NULL_HANDLE, 0);
-        CmdList->Sections[0].AccessTracker.Merge(CmdList->Sections.back().PreCmdBuffer->GetHandle(),
-                                                 CmdList->Sections.back().AccessTracker);
+        bool recorded = CmdList->Sections[0].AccessTracker.Merge(
+            CmdList->Sections.back().PreCmdBuffer->GetHandle(),
+            CmdList->Sections.back().AccessTracker);
         CmdList->Sections.back().PreCmdBuffer->EndRecording();
         CmdList->Sections.back().AccessTracker.Clear();
+        // Not worth submitting if no barriers were needed
+        if (!recorded)
+            CmdList->Sections.back().PreCmdBuffer.reset();
     }
 
     // Drop reference
@@ -229,6 +253,8 @@ CCommandContextVk::CCommandContextVk(const CCommandListVk::Ref& cmdList)
     section.CmdBuffer = allocator.Allocate(false);
     section.CmdBuffer->BeginRecording(nullptr, 0);
     CmdList->Sections.emplace_back(std::move(section));
+    CachedCmdBuffer = CmdList->Sections.back().CmdBuffer->GetHandle();
+    CachedAccessTracker = &CmdList->Sections.back().AccessTracker;
 }
 
 CCommandContextVk::CCommandContextVk(const CRenderPassContextVk::Ref& renderPassContext,
@@ -244,8 +270,26 @@ CCommandContextVk::CCommandContextVk(const CRenderPassContextVk::Ref& renderPass
 
     auto& subpassInfo = renderPassContext->GetSubpassInfo(subpass, CmdBufferIndex);
     subpassInfo.SecondaryBuffer = std::move(cmdBuffer);
+    CachedCmdBuffer = subpassInfo.SecondaryBuffer->GetHandle();
+    CachedAccessTracker = &subpassInfo.AccessTracker;
 
-    auto rpImpl = std::static_pointer_cast<CRenderPassVk>(RenderPassContext->GetRenderPass());
+    SetRenderPassViewport(RenderPassContext->GetRenderPass());
+}
+
+CCommandContextVk::CCommandContextVk(CRenderBundleVk::Ref bundle,
+                                     CBundleRecordingVk::Ref recording, uint64_t moveSerial)
+    : Bundle(std::move(bundle))
+    , BundleRecording(std::move(recording))
+    , BundleMoveSerial(moveSerial)
+{
+    CachedCmdBuffer = BundleRecording->CmdBuffer->GetHandle();
+    CachedAccessTracker = &BundleRecording->AccessTracker;
+    SetRenderPassViewport(Bundle->GetRenderPass());
+}
+
+void CCommandContextVk::SetRenderPassViewport(const CRenderPass::Ref& renderPass)
+{
+    auto rpImpl = std::static_pointer_cast<CRenderPassVk>(renderPass);
     CViewportDesc vp {};
     vp.X = 0.0f;
     vp.Y = 0.0f;
@@ -325,11 +369,18 @@ void CCommandContextVk::CopyBuffer(CBuffer& src, CBuffer& dst,
                                    const std::vector<CBufferCopy>& regions)
 {
     static_assert(sizeof(CBufferCopy) == sizeof(VkBufferCopy), "struct size mismatch");
-    const auto* r = reinterpret_cast<const VkBufferCopy*>(regions.data());
+    auto& srcImpl = static_cast<CBufferVk&>(src);
+    auto& dstImpl = static_cast<CBufferVk&>(dst);
+    std::vector<VkBufferCopy> r(regions.size());
+    memcpy(r.data(), regions.data(), regions.size() * sizeof(VkBufferCopy));
+    for (auto& region : r)
+    {
+        region.srcOffset += srcImpl.GetOffset();
+        region.dstOffset += dstImpl.GetOffset();
+    }
 
-    vkCmdCopyBuffer(CmdBuffer(), static_cast<CBufferVk&>(src).GetHandle(),
-                    static_cast<CBufferVk&>(dst).GetHandle(), static_cast<uint32_t>(regions.size()),
-                    r);
+    vkCmdCopyBuffer(CmdBuffer(), srcImpl.GetHandle(), dstImpl.GetHandle(),
+                    static_cast<uint32_t>(r.size()), r.data());
 }
 
 void CCommandContextVk::CopyImage(CImage& src, CImage& dst, const std::vector<CImageCopy>& regions)
@@ -361,6 +412,7 @@ void CCommandContextVk::CopyBufferToImage(CBuffer& src, CImage& dst,
     {
         VkBufferImageCopy next;
         Convert(next, rs);
+        next.bufferOffset += static_cast<CBufferVk&>(src).GetOffset();
         vkregions.push_back(next);
 
         TransitionImage(dst, rs.ImageSubresource.MipLevel, 1, rs.ImageSubresource.BaseArrayLayer,
@@ -380,6 +432,7 @@ void CCommandContextVk::CopyImageToBuffer(CImage& src, CBuffer& dst,
     {
         VkBufferImageCopy next;
         Convert(next, rs);
+        next.bufferOffset += static_cast<CBufferVk&>(dst).GetOffset();
         vkregions.push_back(next);
 
         TransitionImage(src, rs.ImageSubresource.MipLevel, 1, rs.ImageSubresource.BaseArrayLayer,
@@ -436,6 +489,58 @@ void CCommandContextVk::ResolveImage(CImage& src, CImage& dst,
                       static_cast<uint32_t>(r.size()), r.data());
 }
 
+void CCommandContextVk::AliasingBarrier(CImage* newImage)
+{
+    if (RenderPassContext)
+        throw CRHIRuntimeError("AliasingBarrier is not allowed inside a render pass");
+
+    // The previous occupants aren't known, so everything waits for everything
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(CmdBuffer(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                         nullptr);
+    if (!newImage)
+        return;
+
+    // Forget the layout, the next use transitions from UNDEFINED. No barrier is recorded for
+    //   this, the one above already covers the execution dependency.
+    auto& imageImpl = static_cast<CImageVk&>(*newImage);
+    CImageSubresourceRange range;
+    range.BaseArrayLayer = 0;
+    range.BaseMipLevel = 0;
+    range.LayerCount = imageImpl.GetArrayLayers();
+    range.LevelCount = imageImpl.GetMipLevels();
+    AccessTracker().TransitionImage(VK_NULL_HANDLE, &imageImpl, range, 0,
+                                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+}
+
+void CCommandContextVk::InvalidateState()
+{
+    BindingDirty.fill(true);
+    BoundRenderPipeline = VK_NULL_HANDLE;
+    VertexBuffers.fill(VK_NULL_HANDLE);
+    VertexOffsets.fill(0);
+    DirtyVertexBindings = 0;
+    IndexBuffer = VK_NULL_HANDLE;
+    IndexOffset = 0;
+    bHasViewport = false;
+    bHasScissor = false;
+    bHasBlendConstants = false;
+    bHasStencilReference = false;
+}
+
+CBuffer::Ref CCommandContextVk::AllocateScratch(size_t size, size_t alignment)
+{
+    // Bundles are executed in later frames, long after their scratch memory was reused
+    if (Bundle)
+        throw CRHIRuntimeError("Render bundles can't use scratch memory");
+    auto& queue = RenderPassContext ? RenderPassContext->GetCmdList()->GetQueue()
+                                    : CmdList->GetQueue();
+    return std::make_shared<CBufferVk>(queue.GetDevice(), queue.AllocateScratch(size, alignment));
+}
+
 void CCommandContextVk::BindComputePipeline(CPipeline& pipeline)
 {
     auto& impl = static_cast<CPipelineVk&>(pipeline);
@@ -461,13 +566,16 @@ void CCommandContextVk::DispatchIndirect(CBuffer& buffer, size_t offset)
 {
     WriteDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE);
     auto& impl = static_cast<CBufferVk&>(buffer);
-    vkCmdDispatchIndirect(CmdBuffer(), impl.GetHandle(), offset);
+    vkCmdDispatchIndirect(CmdBuffer(), impl.GetHandle(), impl.GetOffset() + offset);
 }
 
 void CCommandContextVk::BindRenderPipeline(CPipeline& pipeline)
 {
     auto& impl = static_cast<CPipelineVk&>(pipeline);
     CurrPipeline = &impl;
+    if (impl.GetHandle() == BoundRenderPipeline)
+        return;
+    BoundRenderPipeline = impl.GetHandle();
     vkCmdBindPipeline(CmdBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, impl.GetHandle());
 }
 
@@ -475,6 +583,12 @@ void CCommandContextVk::SetViewport(const CViewportDesc& viewportDesc)
 {
     VkViewport vp;
     Convert(vp, viewportDesc);
+    if (bHasViewport && vp.x == Viewport.x && vp.y == Viewport.y && vp.width == Viewport.width
+        && vp.height == Viewport.height && vp.minDepth == Viewport.minDepth
+        && vp.maxDepth == Viewport.maxDepth)
+        return;
+    bHasViewport = true;
+    Viewport = vp;
     vkCmdSetViewport(CmdBuffer(), 0, 1, &vp);
 }
 
@@ -482,16 +596,30 @@ void CCommandContextVk::SetScissor(const CRect2D& scissor)
 {
     VkRect2D region;
     Convert(region, scissor);
+    if (bHasScissor && region.offset.x == Scissor.offset.x && region.offset.y == Scissor.offset.y
+        && region.extent.width == Scissor.extent.width
+        && region.extent.height == Scissor.extent.height)
+        return;
+    bHasScissor = true;
+    Scissor = region;
     vkCmdSetScissor(CmdBuffer(), 0, 1, &region);
 }
 
 void CCommandContextVk::SetBlendConstants(const std::array<float, 4>& blendConstants)
 {
+    if (bHasBlendConstants && blendConstants == BlendConstants)
+        return;
+    bHasBlendConstants = true;
+    BlendConstants = blendConstants;
     vkCmdSetBlendConstants(CmdBuffer(), blendConstants.data());
 }
 
 void CCommandContextVk::SetStencilReference(uint32_t reference)
 {
+    if (bHasStencilReference && reference == StencilReference)
+        return;
+    bHasStencilReference = true;
+    StencilReference = reference;
     vkCmdSetStencilReference(CmdBuffer(), VK_STENCIL_FRONT_AND_BACK, reference);
 }
 
@@ -508,21 +636,33 @@ void CCommandContextVk::BindIndexBuffer(CBuffer& buffer, size_t offset, EFormat
     auto& impl = static_cast<CBufferVk&>(buffer);
     VkIndexType indexType =
         format == EFormat::R16_UINT ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
-    vkCmdBindIndexBuffer(CmdBuffer(), impl.GetHandle(), offset, indexType);
+    VkDeviceSize vkOffset = impl.GetOffset() + offset;
+    if (impl.GetHandle() == IndexBuffer && vkOffset == IndexOffset && indexType == IndexType)
+        return;
+    IndexBuffer = impl.GetHandle();
+    IndexOffset = vkOffset;
+    IndexType = indexType;
+    vkCmdBindIndexBuffer(CmdBuffer(), IndexBuffer, IndexOffset, IndexType);
 }
 
 void CCommandContextVk::BindVertexBuffer(uint32_t binding, CBuffer& buffer, size_t offset)
 {
+    if (binding >= MaxVertexBindings)
+        throw CRHIRuntimeError("Vertex buffer binding out of range");
     auto& impl = static_cast<CBufferVk&>(buffer);
     // Workaround for systems where size_t != 8
-    VkDeviceSize vkOffset = offset;
-    vkCmdBindVertexBuffers(CmdBuffer(), binding, 1, &impl.GetHandle(), &vkOffset);
+    VkDeviceSize vkOffset = impl.GetOffset() + offset;
+    if (impl.GetHandle() == VertexBuffers[binding] && vkOffset == VertexOffsets[binding])
+        return;
+    VertexBuffers[binding] = impl.GetHandle();
+    VertexOffsets[binding] = vkOffset;
+    DirtyVertexBindings |= 1u << binding;
 }
 
 void CCommandContextVk::Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex,
                              uint32_t firstInstance)
 {
-    WriteDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS);
+    PrepareDraw();
     vkCmdDraw(CmdBuffer(), vertexCount, instanceCount, firstVertex, firstInstance);
 }
 
@@ -530,7 +670,7 @@ void CCommandContextVk::DrawIndexed(uint32_t indexCount, uint32_t instanceCount,
                                     uint32_t firstIndex, int32_t vertexOffset,
                                     uint32_t firstInstance)
 {
-    WriteDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS);
+    PrepareDraw();
     vkCmdDrawIndexed(CmdBuffer(), indexCount, instanceCount, firstIndex, vertexOffset,
                      firstInstance);
 }
@@ -538,17 +678,18 @@ void CCommandContextVk::DrawIndexed(uint32_t indexCount, uint32_t instanceCount,
 void CCommandContextVk::DrawIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount,
                                      uint32_t stride)
 {
-    WriteDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS);
-    VkBuffer vkBuffer = static_cast<CBufferVk&>(buffer).GetHandle();
-    vkCmdDrawIndirect(CmdBuffer(), vkBuffer, offset, drawCount, stride);
+    PrepareDraw();
+    auto& impl = static_cast<CBufferVk&>(buffer);
+    vkCmdDrawIndirect(CmdBuffer(), impl.GetHandle(), impl.GetOffset() + offset, drawCount, stride);
 }
 
 void CCommandContextVk::DrawIndexedIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount,
                                             uint32_t stride)
 {
-    WriteDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS);
-    VkBuffer vkBuffer = static_cast<CBufferVk&>(buffer).GetHandle();
-    vkCmdDrawIndirect(CmdBuffer(), vkBuffer, offset, drawCount, stride);
+    PrepareDraw();
+    auto& impl = static_cast<CBufferVk&>(buffer);
+    vkCmdDrawIndexedIndirect(CmdBuffer(), impl.GetHandle(), impl.GetOffset() + offset, drawCount,
+                             stride);
 }
 
 void CCommandContextVk::FinishRecording()
@@ -563,38 +704,31 @@ void CCommandContextVk::FinishRecording()
             CmdList->Sections.back().PreCmdBuffer =
                 CmdList->GetQueue().GetCmdBufferAllocator().Allocate();
             CmdList->Sections.back().PreCmdBuffer->BeginRecording(VK_NULL_HANDLE, 0);
-            CmdList->Sections[0].AccessTracker.Merge(
+            bool recorded = CmdList->Sections[0].AccessTracker.Merge(
                 CmdList->Sections.back().PreCmdBuffer->GetHandle(),
                 CmdList->Sections.back().AccessTracker);
             CmdList->Sections.back().PreCmdBuffer->EndRecording();
             CmdList->Sections.back().AccessTracker.Clear();
+            if (!recorded)
+                CmdList->Sections.back().PreCmdBuffer.reset();
         }
 
         // Drop reference
         CmdList->bIsContextActive = false;
         CmdList.reset();
     }
-    else
+    else if (RenderPassContext)
     {
         RenderPassContext->GetSubpassInfo(SubpassIndex, CmdBufferIndex)
             .SecondaryBuffer->EndRecording();
         RenderPassContext.reset();
     }
-}
-
-CAccessTracker& CCommandContextVk::AccessTracker()
-{
-    if (CmdList)
-        return CmdList->Sections.back().AccessTracker;
-    return RenderPassContext->GetSubpassInfo(SubpassIndex, CmdBufferIndex).AccessTracker;
-}
-
-VkCommandBuffer CCommandContextVk::CmdBuffer()
-{
-    if (CmdList)
-        return CmdList->Sections.back().CmdBuffer->GetHandle();
-    return RenderPassContext->GetSubpassInfo(SubpassIndex, CmdBufferIndex)
-        .SecondaryBuffer->GetHandle();
+    else
+    {
+        BundleRecording->CmdBuffer->EndRecording();
+        Bundle->FinishRecording(std::move(BundleRecording), BundleMoveSerial);
+        Bundle.reset();
+    }
 }
 
 void CCommandContextVk::WriteDescriptorSets(VkPipelineBindPoint bindPoint)
@@ -604,6 +738,10 @@ void CCommandContextVk::WriteDescriptorSets(VkPipelineBindPoint bindPoint)
     {
         if (ds)
         {
+            // The ring block is reused a few frames later, while bundles are executed for good
+            if (Bundle && ds->HasRingConstants())
+                throw CRHIRuntimeError("Render bundles can't use sets with constants bound "
+                                       "through BindConstants");
             if (ds->IsContentDirty() || BindingDirty[set])
             {
                 if (bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE)
@@ -621,4 +759,35 @@ void CCommandContextVk::WriteDescriptorSets(VkPipelineBindPoint bindPoint)
         set++;
     }
 }
+
+void CCommandContextVk::PrepareDraw()
+{
+    WriteDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS);
+    if (DirtyVertexBindings)
+        BindVertexBuffers();
+}
+
+void CCommandContextVk::BindVertexBuffers()
+{
+    // One call per run of changed bindings. Unchanged ones in between are bound again if that
+    //   joins two runs, as long as they have a buffer.
+    uint32_t binding = 0;
+    while (DirtyVertexBindings)
+    {
+        if (!(DirtyVertexBindings & (1u << binding)))
+        {
+            binding++;
+            continue;
+        }
+        uint32_t first = binding;
+        while (binding + 1 < MaxVertexBindings && VertexBuffers[binding + 1] != VK_NULL_HANDLE
+               && (DirtyVertexBindings >> (binding + 1)) != 0)
+            binding++;
+        uint32_t count = binding - first + 1;
+        vkCmdBindVertexBuffers(CmdBuffer(), first, count, &VertexBuffers[first],
+                               &VertexOffsets[first]);
+        DirtyVertexBindings &= ~(((1u << count) - 1) << first);
+        binding++;
+    }
+}
 }
@@ -5,6 +5,7 @@
 #include "DescriptorSet.h"
 #include "RenderContext.h"
 #include <SpinLock.h>
+#include <deque>
 
 namespace RHI
 {
@@ -13,6 +14,8 @@ struct CSubpassInfo
 {
     std::unique_ptr<CCommandBufferVk> SecondaryBuffer;
     CAccessTracker AccessTracker;
+    // Executed instead of SecondaryBuffer if set
+    CBundleRecordingVk::Ref Bundle;
 };
 
 class CRenderPassContextVk : public std::enable_shared_from_this<CRenderPassContextVk>,
@@ -34,6 +37,7 @@ public:
     uint32_t MakeSubpassInfo(uint32_t subpass);
 
     IRenderContext::Ref CreateRenderContext(uint32_t subpass) override;
+    void ExecuteBundle(uint32_t subpass, IRenderBundle& bundle) override;
     void FinishRecording() override;
 
 private:
@@ -44,7 +48,8 @@ private:
 
     // Holds info for render contexts to write to. Cleared when FinishRecording
     tc::FSpinLock SpinLock;
-    std::vector<std::vector<CSubpassInfo>> SubpassInfos;
+    // Deques keep references to the infos valid while other threads add theirs
+    std::vector<std::deque<CSubpassInfo>> SubpassInfos;
 };
 
 class CCommandContextVk : public ICopyContext, public IComputeContext, public IRenderContext
@@ -67,12 +72,19 @@ public:
     explicit CCommandContextVk(const CCommandListVk::Ref& cmdList);
     explicit CCommandContextVk(const CRenderPassContextVk::Ref& renderPassContext,
                                uint32_t subpass);
+    // Records into a bundle, moveSerial is the defragmenter's as recording started
+    CCommandContextVk(CRenderBundleVk::Ref bundle, CBundleRecordingVk::Ref recording,
+                      uint64_t moveSerial);
     ~CCommandContextVk() override;
 
     void TransitionImage(CImage& image, EResourceState newState);
     void TransitionImage(CImage& image, uint32_t baseMip, uint32_t mipCount, uint32_t baseLayer,
                          uint32_t layerCount, EResourceState newState);
-    VkCommandBuffer GetCmdBuffer() { return CmdBuffer(); }
+    // Whoever records into it directly has to call InvalidateState afterwards
+    VkCommandBuffer GetCmdBuffer() const { return CachedCmdBuffer; }
+    // Forgets the state the command buffer was told, so that none of it is skipped next time.
+    //   Bound descriptor sets are bound again before the next draw or dispatch.
+    void InvalidateState();
 
     // Copy commands
     void ClearImage(CImage& image, const CClearValue& clearValue,
@@ -86,6 +98,8 @@ public:
     void BlitImage(CImage& src, CImage& dst, const std::vector<CImageBlit>& regions,
                    EFilter filter) override;
     void ResolveImage(CImage& src, CImage& dst, const std::vector<CImageResolve>& regions) override;
+    void AliasingBarrier(CImage* newImage) override;
+    CBuffer::Ref AllocateScratch(size_t size, size_t alignment = 256) override;
 
     // Compute commands
     void BindComputePipeline(CPipeline& pipeline) override;
@@ -114,9 +128,14 @@ public:
     void FinishRecording() override;
 
 protected:
-    CAccessTracker& AccessTracker();
-    VkCommandBuffer CmdBuffer();
+    // Neither changes for the lifetime of the context
+    CAccessTracker& AccessTracker() { return *CachedAccessTracker; }
+    VkCommandBuffer CmdBuffer() const { return CachedCmdBuffer; }
     void WriteDescriptorSets(VkPipelineBindPoint bindPoint);
+    // Descriptor sets and vertex buffers are bound lazily, right before a draw
+    void PrepareDraw();
+    void BindVertexBuffers();
+    void SetRenderPassViewport(const CRenderPass::Ref& renderPass);
 
 private:
     // The target we are recording into
@@ -127,10 +146,39 @@ private:
     uint32_t SubpassIndex;
     uint32_t CmdBufferIndex;
 
+    // The target when we record a bundle
+    CRenderBundleVk::Ref Bundle;
+    CBundleRecordingVk::Ref BundleRecording;
+    uint64_t BundleMoveSerial = 0;
+
+    // Whichever of the targets above we record into
+    VkCommandBuffer CachedCmdBuffer = VK_NULL_HANDLE;
+    CAccessTracker* CachedAccessTracker = nullptr;
+
     // Temporary states
     CPipelineVk* CurrPipeline = nullptr;
     std::array<CDescriptorSetVk*, 8> BoundDescriptorSets {};
     std::array<bool, 8> BindingDirty {};
+
+    // What the command buffer has been told last, calls that would repeat it are skipped. Every
+    //   context records into a command buffer of its own, which starts out with nothing set.
+    static constexpr uint32_t MaxVertexBindings = 16;
+    VkPipeline BoundRenderPipeline = VK_NULL_HANDLE;
+    std::array<VkBuffer, MaxVertexBindings> VertexBuffers {};
+    std::array<VkDeviceSize, MaxVertexBindings> VertexOffsets {};
+    // Vertex bindings changed since the last draw
+    uint32_t DirtyVertexBindings = 0;
+    VkBuffer IndexBuffer = VK_NULL_HANDLE;
+    VkDeviceSize IndexOffset = 0;
+    VkIndexType IndexType = VK_INDEX_TYPE_UINT16;
+    bool bHasViewport = false;
+    VkViewport Viewport;
+    bool bHasScissor = false;
+    VkRect2D Scissor;
+    bool bHasBlendConstants = false;
+    std::array<float, 4> BlendConstants;
+    bool bHasStencilReference = false;
+    uint32_t StencilReference;
 };
 
 }
@@ -1,24 +1,109 @@
 #include "CommandListVk.h"
 #include "CommandContextVk.h"
 #include "CommandQueueVk.h"
+#include "DeviceVk.h"
+#include "ImageVk.h"
 
 namespace RHI
 {
 
-VkSubmitInfo CCommandListSection::MakeSubmitInfo(std::vector<VkCommandBuffer>& stagingArray) const
+void CSubmitBatcherVk::Wait(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stages)
 {
-    stagingArray.push_back(PreCmdBuffer->GetHandle());
-    stagingArray.push_back(CmdBuffer->GetHandle());
+    PendingWaits.WaitSemaphores.push_back(semaphore);
+    PendingWaits.WaitStages.push_back(stages);
+    PendingWaits.WaitValues.push_back(value);
+}
+
+void CSubmitBatcherVk::AddSection(const CCommandListSection& section)
+{
+    if (BatchCount == 0 || !Batches[BatchCount - 1].SignalSemaphores.empty()
+        || !section.WaitSemaphores.empty() || !PendingWaits.WaitSemaphores.empty())
+    {
+        CBatch& batch = StartBatch();
+        batch.WaitSemaphores.swap(PendingWaits.WaitSemaphores);
+        batch.WaitStages.swap(PendingWaits.WaitStages);
+        batch.WaitValues.swap(PendingWaits.WaitValues);
+        batch.WaitSemaphores.insert(batch.WaitSemaphores.end(), section.WaitSemaphores.begin(),
+                                    section.WaitSemaphores.end());
+        batch.WaitStages.insert(batch.WaitStages.end(), section.WaitStages.begin(),
+                                section.WaitStages.end());
+        batch.WaitValues.resize(batch.WaitSemaphores.size(), 0);
+    }
 
-    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(WaitSemaphores.size());
-    submitInfo.pWaitSemaphores = WaitSemaphores.data();
-    submitInfo.pWaitDstStageMask = WaitStages.data();
-    submitInfo.commandBufferCount = 2;
-    submitInfo.pCommandBuffers = stagingArray.data() + stagingArray.size() - 2;
-    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(SignalSemaphores.size());
-    submitInfo.pSignalSemaphores = SignalSemaphores.data();
-    return submitInfo;
+    // Sections that needed no barriers have no pre-command buffer
+    CBatch& batch = Batches[BatchCount - 1];
+    if (section.PreCmdBuffer)
+    {
+        CmdBuffers.push_back(section.PreCmdBuffer->GetHandle());
+        batch.CmdBufferCount++;
+    }
+    CmdBuffers.push_back(section.CmdBuffer->GetHandle());
+    batch.CmdBufferCount++;
+    batch.SignalSemaphores.insert(batch.SignalSemaphores.end(), section.SignalSemaphores.begin(),
+                                  section.SignalSemaphores.end());
+    batch.SignalValues.resize(batch.SignalSemaphores.size(), 0);
+}
+
+void CSubmitBatcherVk::Signal(VkSemaphore semaphore, uint64_t value)
+{
+    CBatch& batch = BatchCount == 0 ? StartBatch() : Batches[BatchCount - 1];
+    batch.SignalSemaphores.push_back(semaphore);
+    batch.SignalValues.push_back(value);
+}
+
+const std::vector<VkSubmitInfo>& CSubmitBatcherVk::MakeSubmitInfos()
+{
+    // Built only now since the vectors may have moved while growing
+    SubmitInfos.clear();
+    TimelineInfos.clear();
+    TimelineInfos.reserve(BatchCount);
+    for (size_t i = 0; i < BatchCount; i++)
+    {
+        const CBatch& batch = Batches[i];
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {
+            VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR
+        };
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(batch.WaitValues.size());
+        timelineInfo.pWaitSemaphoreValues = batch.WaitValues.data();
+        timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(batch.SignalValues.size());
+        timelineInfo.pSignalSemaphoreValues = batch.SignalValues.data();
+        TimelineInfos.push_back(timelineInfo);
+
+        VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+        submitInfo.pNext = &TimelineInfos.back();
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(batch.WaitSemaphores.size());
+        submitInfo.pWaitSemaphores = batch.WaitSemaphores.data();
+        submitInfo.pWaitDstStageMask = batch.WaitStages.data();
+        submitInfo.commandBufferCount = batch.CmdBufferCount;
+        submitInfo.pCommandBuffers = CmdBuffers.data() + batch.FirstCmdBuffer;
+        submitInfo.signalSemaphoreCount = static_cast<uint32_t>(batch.SignalSemaphores.size());
+        submitInfo.pSignalSemaphores = batch.SignalSemaphores.data();
+        SubmitInfos.push_back(submitInfo);
+    }
+    return SubmitInfos;
+}
+
+void CSubmitBatcherVk::Clear()
+{
+    CmdBuffers.clear();
+    BatchCount = 0;
+    SubmitInfos.clear();
+    TimelineInfos.clear();
+}
+
+CSubmitBatcherVk::CBatch& CSubmitBatcherVk::StartBatch()
+{
+    if (BatchCount == Batches.size())
+        Batches.emplace_back();
+    CBatch& batch = Batches[BatchCount++];
+    batch.FirstCmdBuffer = CmdBuffers.size();
+    batch.CmdBufferCount = 0;
+    batch.WaitSemaphores.clear();
+    batch.WaitStages.clear();
+    batch.WaitValues.clear();
+    batch.SignalSemaphores.clear();
+    batch.SignalValues.clear();
+    return batch;
 }
 
 CCommandListVk::CCommandListVk(CCommandQueueVk& p)
@@ -31,7 +116,8 @@ void CCommandListVk::Enqueue()
     if (bIsQueued)
         return;
 
-    Parent.EnqueueCommandList(std::static_pointer_cast<CCommandListVk>(shared_from_this()));
+    SubmitSerial =
+        Parent.EnqueueCommandList(std::static_pointer_cast<CCommandListVk>(shared_from_this()));
     bIsQueued = true;
 }
 
@@ -47,6 +133,8 @@ void CCommandListVk::Commit()
         throw CRHIRuntimeError("Can't commit when the list is still being recorded");
 
     bIsCommitted = true;
+    if (SubmitSerial != 0)
+        Parent.CommitCommandList(std::static_pointer_cast<CCommandListVk>(shared_from_this()));
 }
 
 ICopyContext::Ref CCommandListVk::CreateCopyContext()
@@ -69,21 +157,87 @@ CCommandListVk::CreateParallelRenderContext(CRenderPass::Ref renderPass,
         std::static_pointer_cast<CCommandListVk>(shared_from_this()), renderPass, clearValues);
 }
 
-void CCommandListVk::MakeSubmitInfos(std::vector<VkSubmitInfo>& submitInfos,
-                                     std::vector<VkCommandBuffer>& stagingArray)
+void CCommandListVk::AddWaitSemaphore(VkSemaphore semaphore, VkPipelineStageFlags stages)
+{
+    if (Sections.empty())
+        throw CRHIRuntimeError("Can't add semaphores to an empty command list");
+    Sections.front().WaitSemaphores.push_back(semaphore);
+    Sections.front().WaitStages.push_back(stages);
+}
+
+void CCommandListVk::AddSignalSemaphore(VkSemaphore semaphore)
+{
+    if (Sections.empty())
+        throw CRHIRuntimeError("Can't add semaphores to an empty command list");
+    Sections.back().SignalSemaphores.push_back(semaphore);
+}
+
+void CCommandListVk::WaitForQueue(CCommandQueue& queue, uint64_t point)
+{
+    if (&queue == &Parent)
+        return;
+    QueueWaits.emplace_back(static_cast<CCommandQueueVk*>(&queue), point);
+}
+
+void CCommandListVk::PrepareSubmit(CSubmitBatcherVk& batcher)
 {
     if (!Sections.empty())
     {
+        for (const auto& wait : QueueWaits)
+            batcher.Wait(wait.first->GetTimeline(), wait.second,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
         assert(Sections[0].PreCmdBuffer == nullptr);
         Sections[0].PreCmdBuffer = GetQueue().GetCmdBufferAllocator().Allocate();
         Sections[0].PreCmdBuffer->BeginRecording(VK_NULL_HANDLE, 0);
-        Sections[0].AccessTracker.DeployAllBarriers(Sections[0].PreCmdBuffer->GetHandle());
+        bool recorded = AcquireOwnership(Sections[0].PreCmdBuffer->GetHandle());
+        recorded |=
+            Sections[0].AccessTracker.DeployAllBarriers(Sections[0].PreCmdBuffer->GetHandle());
         Sections[0].AccessTracker.Clear();
         Sections[0].PreCmdBuffer->EndRecording();
+        if (!recorded)
+            Sections[0].PreCmdBuffer.reset();
     }
 
     for (const auto& iter : Sections)
-        submitInfos.emplace_back(iter.MakeSubmitInfo(stagingArray));
+        batcher.AddSection(iter);
+}
+
+bool CCommandListVk::AcquireOwnership(VkCommandBuffer cmdBuffer)
+{
+    bool recorded = false;
+    CDeviceVk& device = GetQueue().GetDevice();
+    uint32_t queueFamily = device.GetQueueFamily(GetQueue().GetType());
+    for (CImageVk* image : Sections[0].AccessTracker.GetOwnershipAcquires())
+    {
+        CQueueOwnershipAcquire acquire;
+        if (!image->TakePendingAcquire(queueFamily, acquire))
+            continue;
+
+        // The acquire half of the transfer, has to match the release exactly
+        VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.oldLayout = acquire.OldLayout;
+        barrier.newLayout = acquire.NewLayout;
+        barrier.srcQueueFamilyIndex = acquire.SrcQueueFamily;
+        barrier.dstQueueFamilyIndex = acquire.DstQueueFamily;
+        barrier.image = image->GetVkImage();
+        barrier.subresourceRange.aspectMask = GetImageAspectFlags(image->GetVkFormat());
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = image->GetMipLevels();
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = image->GetArrayLayers();
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                             &barrier);
+        recorded = true;
+
+        Sections[0].WaitSemaphores.push_back(acquire.Semaphore);
+        Sections[0].WaitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        device.GetDeferredDeleter().DestroySemaphore(acquire.Semaphore);
+    }
+    return recorded;
 }
 
 void CCommandListVk::ReleaseAllResources() { Sections.clear(); }
@@ -3,6 +3,7 @@
 #include "CommandBufferVk.h"
 #include "ComputeContext.h"
 #include "CopyContext.h"
+#include "RenderBundleVk.h"
 #include "RenderContext.h"
 #include "VkCommon.h"
 #include <memory>
@@ -20,12 +21,49 @@ struct CCommandListSection
     std::unique_ptr<CCommandBufferVk> PreCmdBuffer;
     std::unique_ptr<CCommandBufferVk> CmdBuffer;
     std::vector<std::unique_ptr<CCommandBufferVk>> SecondaryBuffers;
+    std::vector<CBundleRecordingVk::Ref> Bundles;
 
     std::vector<VkSemaphore> SignalSemaphores;
 
     CAccessTracker AccessTracker;
+};
+
+// Packs the sections of consecutive command lists into as few VkSubmitInfos as possible, a new
+//   one is only started where a section waits on semaphores or the previous one signals some
+class CSubmitBatcherVk
+{
+public:
+    // Timeline semaphore wait before the next section added
+    void Wait(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stages);
+    void AddSection(const CCommandListSection& section);
+    // Timeline semaphore signal after the sections added so far, goes into an empty submit info
+    //   if there are none
+    void Signal(VkSemaphore semaphore, uint64_t value);
+    // Valid until the next change to the batcher
+    const std::vector<VkSubmitInfo>& MakeSubmitInfos();
+    void Clear();
 
-    VkSubmitInfo MakeSubmitInfo(std::vector<VkCommandBuffer>& stagingArray) const;
+private:
+    // Binary semaphores of the sections get a value of 0, which Vulkan ignores
+    struct CBatch
+    {
+        size_t FirstCmdBuffer = 0;
+        uint32_t CmdBufferCount = 0;
+        std::vector<VkSemaphore> WaitSemaphores;
+        std::vector<VkPipelineStageFlags> WaitStages;
+        std::vector<uint64_t> WaitValues;
+        std::vector<VkSemaphore> SignalSemaphores;
+        std::vector<uint64_t> SignalValues;
+    };
+    CBatch& StartBatch();
+
+    std::vector<VkCommandBuffer> CmdBuffers;
+    // Only the first BatchCount are in use, the rest are kept for their storage
+    std::vector<CBatch> Batches;
+    size_t BatchCount = 0;
+    CBatch PendingWaits;
+    std::vector<VkSubmitInfo> SubmitInfos;
+    std::vector<VkTimelineSemaphoreSubmitInfoKHR> TimelineInfos;
 };
 
 class CCommandListVk : public CCommandList
@@ -41,6 +79,7 @@ public:
     CCommandQueueVk& GetQueue() const { return Parent; }
     bool IsQueued() const { return bIsQueued; }
     bool IsCommitted() const { return bIsCommitted; }
+    uint64_t GetSubmitSerial() const { return SubmitSerial; }
 
     void Enqueue() override;
     void Commit() override;
@@ -51,21 +90,34 @@ public:
     CreateParallelRenderContext(CRenderPass::Ref renderPass,
                                 const std::vector<CClearValue>& clearValues) override;
 
-    void MakeSubmitInfos(std::vector<VkSubmitInfo>& submitInfos,
-                         std::vector<VkCommandBuffer>& stagingArray);
+    // Semaphores for the whole list, waited on before the first section and signaled after the last
+    void AddWaitSemaphore(VkSemaphore semaphore, VkPipelineStageFlags stages);
+    void AddSignalSemaphore(VkSemaphore semaphore);
+    void WaitForQueue(CCommandQueue& queue, uint64_t point) override;
+
+    // Records the barriers needed before the first section and adds all sections to batcher
+    void PrepareSubmit(CSubmitBatcherVk& batcher);
     void ReleaseAllResources();
 
 private:
+    // Take over images uploaded on another queue family, right before their first use. Returns
+    //   whether anything was recorded.
+    bool AcquireOwnership(VkCommandBuffer cmdBuffer);
+
     // Not holding a reference to prevent circular reference
     CCommandQueueVk& Parent;
     // Whether this command list is enqueued
     bool bIsQueued = false;
     // Whether this command list is ready for submission
     bool bIsCommitted = false;
+    // Order of submission when the queue runs a submission thread, 0 otherwise
+    uint64_t SubmitSerial = 0;
+    // Points of other queues to wait for, see WaitForQueue
+    std::vector<std::pair<CCommandQueueVk*, uint64_t>> QueueWaits;
 
     // The context has access to all the temporary states
     // NOTE: Sections[0].AccessTracker tracks the entire command list
-    // NOTE: Each of these "sections" become a VkSubmitInfo
+    // NOTE: Sections without semaphores in between share a VkSubmitInfo, see CSubmitBatcherVk
     std::vector<CCommandListSection> Sections;
     // Whether there is a context currently recording into this
     bool bIsContextActive = false;
@@ -10,101 +10,473 @@ CCommandQueueVk::CCommandQueueVk(CDeviceVk& p, EQueueType queueType, VkQueue han
     , Type(queueType)
     , Handle(handle)
     , CmdBufferAllocator(p, queueType)
-    , FrameResources { p, p, p }
 {
-    // Fences are created signaled, unsignal the first one
-    VK(vkResetFences(Parent.GetVkDevice(), 1, &FrameResources[0].Fence));
+    for (uint32_t i = 0; i < FramesInFlight; i++)
+        FrameResources.push_back(std::make_unique<CFrameResources>(p));
+    FrameResources[0]->Serial = FrameSerial.load();
+    Timeline = Parent.CreateTimelineSemaphore();
 }
 
-CCommandQueueVk::~CCommandQueueVk() { Finish(); }
+CCommandQueueVk::~CCommandQueueVk()
+{
+    Finish();
+    if (IsSubmissionThreadEnabled())
+        StopSubmissionThread();
+    Parent.GetDeferredDeleter().OnQueueDestroyed(Timeline);
+    vkDestroySemaphore(Parent.GetVkDevice(), Timeline, nullptr);
+}
 
 CCommandList::Ref CCommandQueueVk::CreateCommandList()
 {
     return std::make_shared<CCommandListVk>(*this);
 }
 
-void CCommandQueueVk::Flush() { Submit(); }
+IRenderBundle::Ref CCommandQueueVk::CreateRenderBundle(CRenderPass::Ref renderPass,
+                                                       uint32_t subpass)
+{
+    return std::make_shared<CRenderBundleVk>(*this, std::move(renderPass), subpass);
+}
+
+uint64_t CCommandQueueVk::Flush()
+{
+    // The submission thread submits lists as soon as they are committed, and signals the position
+    //   of the last item it handled
+    if (IsSubmissionThreadEnabled())
+        return ItemsPushed.load();
+    return Submit();
+}
+
+void CCommandQueueVk::Finish() { WaitForPoint(Flush()); }
+
+uint64_t CCommandQueueVk::GetCompletedPoint() const { return Parent.GetTimelineValue(Timeline); }
 
-void CCommandQueueVk::Finish()
+bool CCommandQueueVk::WaitForPoint(uint64_t point, uint32_t timeoutMs) const
 {
-    Flush();
-    vkQueueWaitIdle(GetHandle());
+    uint64_t timeoutNs = timeoutMs == UINT32_MAX ? UINT64_MAX : timeoutMs * 1000000ull;
+    return Parent.WaitTimeline(Timeline, point, timeoutNs);
 }
 
-void CCommandQueueVk::EnqueueCommandList(CCommandListVk::Ref cmdList)
+void CCommandQueueVk::SetSubmissionThreadEnabled(bool enabled)
 {
+    if (enabled == IsSubmissionThreadEnabled())
+        return;
+
+    if (enabled)
+    {
+        Flush();
+        {
+            std::lock_guard<std::mutex> lk(Mutex);
+            if (!QueuedLists.empty())
+                throw CRHIRuntimeError("Can't start the submission thread with lists enqueued");
+        }
+        NextSubmitSerial = NextEnqueueSerial.load(std::memory_order_acquire);
+        // Points continue from where the inline submissions left off
+        ItemsPushed.store(SubmittedPoint.load());
+        ItemsDone.store(SubmittedPoint.load());
+        bIsThreadStopping = false;
+        bIsThreaded.store(true, std::memory_order_release);
+        Thread = std::thread([this]() { SubmissionThread(); });
+    }
+    else
+    {
+        WaitForSubmissionThread();
+        if (NextSubmitSerial != NextEnqueueSerial.load(std::memory_order_acquire))
+            throw CRHIRuntimeError("Can't stop the submission thread with lists enqueued");
+        StopSubmissionThread();
+        bIsThreaded.store(false, std::memory_order_release);
+    }
+}
+
+void CCommandQueueVk::SetFramesInFlight(uint32_t count)
+{
+    if (count == 0)
+        throw CRHIRuntimeError("There has to be at least one frame in flight");
+    if (count == FramesInFlight)
+        return;
+
+    // Simplest with the GPU idle, every frame can be recycled right away
+    if (IsSubmissionThreadEnabled())
+        WaitForSubmissionThread();
+    Finish();
+    for (auto& frame : FrameResources)
+        frame->Reset();
+    FrameResources.resize(count);
+    for (auto& frame : FrameResources)
+    {
+        if (!frame)
+            frame = std::make_unique<CFrameResources>(Parent);
+        frame->Serial = 0;
+    }
+    FramesInFlight = count;
+    CurrFrameIndex = 0;
+    SubmitFrameIndex = 0;
+    SubmitFrameSerial = FrameSerial.load();
+    FrameResources[0]->Serial = SubmitFrameSerial;
+    CmdBufferAllocator.SetFrameCount(count);
+}
+
+void CCommandQueueVk::WaitForNextFrame()
+{
+    if (!bIsLowLatency)
+        return;
+
+    // Whatever SubmitFrame would wait for to recycle the next slot
+    uint32_t nextIndex = (CurrFrameIndex + 1) % FramesInFlight;
+    if (IsSubmissionThreadEnabled() && FramesPushed + 2 > FramesInFlight)
+        WaitForFramesSubmitted(FramesPushed + 2 - FramesInFlight);
+    uint64_t point;
+    {
+        std::lock_guard<std::mutex> lk(Mutex);
+        point = FrameResources[nextIndex]->Point;
+    }
+    Parent.WaitTimeline(Timeline, point);
+}
+
+uint64_t CCommandQueueVk::EnqueueCommandList(CCommandListVk::Ref cmdList)
+{
+    if (IsSubmissionThreadEnabled())
+        return NextEnqueueSerial.fetch_add(1, std::memory_order_acq_rel);
+
     std::lock_guard<std::mutex> lk(Mutex);
     QueuedLists.push_back(std::move(cmdList));
+    return 0;
 }
 
-void CCommandQueueVk::Submit(bool setFence)
+void CCommandQueueVk::CommitCommandList(CCommandListVk::Ref cmdList)
 {
-    std::lock_guard<std::mutex> lk(Mutex);
+    PushSubmitItem(CSubmitItem { ESubmitItemType::List, std::move(cmdList), nullptr });
+}
+
+uint64_t CCommandQueueVk::Submit(uint64_t point)
+{
+    // The submission thread may get to the next frame's slot before the recording thread has
+    //   retired it, see AdvanceFrame. Inline submits always find it retired.
+    std::unique_lock<std::mutex> lk(Mutex);
+    SlotRetired.wait(lk, [this]() {
+        return FrameResources[SubmitFrameIndex]->Serial == SubmitFrameSerial;
+    });
+
+    // Serials are completed in order across all queues, so whatever was retired before this also
+    //   waits for everything the other queues submitted before it. Reserved before gathering, so
+    //   that a list committed meanwhile can't use anything this submit lets go of.
+    uint64_t deleteSerial = GetDevice().GetDeferredDeleter().ReserveSubmit(Timeline);
 
-    // Try to submit all queued lists that are committed
-    std::vector<VkCommandBuffer> cmdBufferStaging;
-    cmdBufferStaging.reserve(512);
-    std::vector<VkSubmitInfo> submitInfos;
+    // Submit the committed lists at the front, a list that is still being recorded holds back
+    //   the ones enqueued after it
+    SubmitBatcher.Clear();
     size_t submittedCount = 0;
     for (const auto& list : QueuedLists)
     {
-        bool ready = list->IsCommitted();
-        if (ready)
-        {
-            list->MakeSubmitInfos(submitInfos, cmdBufferStaging);
+        if (!list->IsCommitted())
+            break;
+        list->PrepareSubmit(SubmitBatcher);
 
-            // Move this list to the in flight list
-            FrameResources[CurrFrameIndex].ListsInFlight.emplace_back(list);
-            submittedCount++;
-        }
+        // Move this list to the in flight list
+        FrameResources[SubmitFrameIndex]->ListsInFlight.emplace_back(list);
+        submittedCount++;
     }
     QueuedLists.erase(QueuedLists.begin(), QueuedLists.begin() + submittedCount);
-    if (cmdBufferStaging.size() > 512)
-        throw CRHIException("Umm, tell Toby about this");
-    if (setFence)
-        VK(vkQueueSubmit(GetHandle(), static_cast<uint32_t>(submitInfos.size()), submitInfos.data(),
-                         FrameResources[CurrFrameIndex].Fence));
+
+    // Nothing new, the last point already covers everything
+    if (point == 0 && submittedCount == 0)
+        point = SubmittedPoint.load();
     else
+    {
+        if (point == 0)
+            point = SubmittedPoint.load() + 1;
+        SubmitBatcher.Signal(Timeline, point);
+        const auto& submitInfos = SubmitBatcher.MakeSubmitInfos();
         VK(vkQueueSubmit(GetHandle(), static_cast<uint32_t>(submitInfos.size()), submitInfos.data(),
                          VK_NULL_HANDLE));
+        SubmittedPoint.store(point);
+    }
+    FrameResources[SubmitFrameIndex]->Point = point;
+    GetDevice().GetDeferredDeleter().OnSubmit(deleteSerial, point);
+
+    // Device wide cleanups wait for the queues that may still use the resources, which a copy
+    //   queue can't vouch for
+    if (Type == EQueueType::Copy)
+        return point;
 
     std::lock_guard<std::mutex> lkd(GetDevice().DeviceMutex);
-    auto& fnList = FrameResources[CurrFrameIndex].PostFrameCleanup;
+    auto& fnList = FrameResources[SubmitFrameIndex]->PostFrameCleanup;
     fnList.insert(fnList.end(), GetDevice().PostFrameCleanup.begin(),
                   GetDevice().PostFrameCleanup.end());
     GetDevice().PostFrameCleanup.clear();
+    return point;
 }
 
-void CCommandQueueVk::SubmitFrame()
+void CCommandQueueVk::SubmitFrame(std::function<void(VkQueue)> afterSubmit)
 {
+    if (IsSubmissionThreadEnabled())
+    {
+        GetDevice().GetHugeConstantBuffer()->MarkBlockEnd();
+        PushSubmitItem(CSubmitItem { ESubmitItemType::Frame, nullptr, std::move(afterSubmit) });
+        FramesPushed++;
+        // At most the position of the frame's item, see SubmissionThread
+        MeasureQueueDepth(ItemsPushed.load());
+
+        // Passes need the frame to be submitted, so this is the one place the recording thread
+        //   waits for the submission thread. Only if defragmentation is on. Lists committed after
+        //   the frame may not be, the thread holds them until the next slot is retired.
+        if (Type == EQueueType::Render && GetDevice().GetDefragmenter().IsEnabled())
+        {
+            WaitForFramesSubmitted(FramesPushed);
+            GetDevice().GetDefragmenter().RunPass(*this);
+        }
+        AdvanceFrame();
+        AdvanceCopyQueue();
+        return;
+    }
+
     // Do Submit() and advance frame index
-    Submit(true);
+    MeasureQueueDepth(Submit());
+    if (afterSubmit)
+    {
+        std::lock_guard<std::mutex> lk(Mutex);
+        afterSubmit(GetHandle());
+    }
+    if (Type == EQueueType::Render)
+        GetDevice().GetDefragmenter().RunPass(*this);
 
     GetDevice().GetHugeConstantBuffer()->MarkBlockEnd();
-    FrameResources[CurrFrameIndex].PostFrameCleanup.emplace_back(
-        [](CDeviceVk& p) { p.GetHugeConstantBuffer()->FreeBlock(); });
+    AddPostFrameCleanup([](CDeviceVk& p) { p.GetHugeConstantBuffer()->FreeBlock(); });
 
-    // Advance
-    CurrFrameIndex++;
-    CurrFrameIndex %= FrameIndexCount;
-    VK(vkWaitForFences(Parent.GetVkDevice(), 1, &FrameResources[CurrFrameIndex].Fence, VK_TRUE,
-                       1000000000)); // 1s timeout
-    VK(vkResetFences(Parent.GetVkDevice(), 1, &FrameResources[CurrFrameIndex].Fence));
-    FrameResources[CurrFrameIndex].Reset();
+    AdvanceFrame();
+    AdvanceCopyQueue();
 }
 
-CCommandQueueVk::CFrameResources::CFrameResources(CDeviceVk& deviceVk)
-    : DeviceVk(deviceVk)
+void CCommandQueueVk::SubmitAndRecycle()
+{
+    if (IsSubmissionThreadEnabled())
+    {
+        PushSubmitItem(CSubmitItem { ESubmitItemType::Recycle, nullptr, nullptr });
+        FramesPushed++;
+    }
+    else
+        Submit();
+    AdvanceFrame();
+}
+
+void CCommandQueueVk::WaitForFramesSubmitted(uint64_t count)
+{
+    std::unique_lock<std::mutex> lk(ThreadMutex);
+    ThreadProgress.wait(lk, [&]() { return FramesSubmitted.load() >= count; });
+}
+
+void CCommandQueueVk::MeasureQueueDepth(uint64_t framePoint)
 {
-    // We create the fences signaled so that vkWaitForFences returns immediately
-    VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    VK(vkCreateFence(DeviceVk.GetVkDevice(), &fenceInfo, nullptr, &Fence));
+    uint64_t completed = GetCompletedPoint();
+    while (!FramePoints.empty() && FramePoints.front() <= completed)
+        FramePoints.pop_front();
+    FramePoints.push_back(framePoint);
+
+    // Smoothed over roughly the last 16 frames
+    float depth = static_cast<float>(FramePoints.size());
+    float average = QueueDepth.load(std::memory_order_relaxed);
+    QueueDepth.store(average + (depth - average) / 16.0f, std::memory_order_relaxed);
 }
 
-CCommandQueueVk::CFrameResources::~CFrameResources()
+void CCommandQueueVk::WaitForSubmissionThread()
+{
+    uint64_t pushed = ItemsPushed.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lk(ThreadMutex);
+    ThreadProgress.wait(lk, [&]() { return ItemsDone.load() >= pushed; });
+}
+
+void CCommandQueueVk::SubmitCommandBuffer(VkCommandBuffer cmdBuffer, VkFence fence)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuffer;
+    VK(vkQueueSubmit(GetHandle(), 1, &submitInfo, fence));
+}
+
+void CCommandQueueVk::AddPostFrameCleanup(std::function<void(CDeviceVk&)> callback)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    FrameResources[CurrFrameIndex]->PostFrameCleanup.push_back(std::move(callback));
+}
+
+CScratchRange CCommandQueueVk::AllocateScratch(size_t size, size_t alignment)
+{
+    return FrameResources[CurrFrameIndex]->Scratch.Allocate(size, alignment);
+}
+
+void CCommandQueueVk::AdvanceFrame()
+{
+    // The submission thread has to be done with the frame that used the slot last, which it
+    //   normally is unless it lags a whole ring behind. It doesn't touch the slot again until it
+    //   is handed over below.
+    uint32_t nextIndex = (CurrFrameIndex + 1) % FramesInFlight;
+    if (IsSubmissionThreadEnabled() && FramesPushed + 1 > FramesInFlight)
+        WaitForFramesSubmitted(FramesPushed + 1 - FramesInFlight);
+
+    // Inline submits from other threads still go to the slot if it is the current one as well, so
+    //   the point is checked again once Mutex is held
+    auto& next = *FrameResources[nextIndex];
+    std::unique_lock<std::mutex> lk(Mutex);
+    uint64_t waitedPoint = 0;
+    while (next.Point > waitedPoint)
+    {
+        waitedPoint = next.Point;
+        lk.unlock();
+        Parent.WaitTimeline(Timeline, waitedPoint);
+        lk.lock();
+    }
+    if (next.Serial > CompletedFrameSerial.load())
+        CompletedFrameSerial.store(next.Serial, std::memory_order_release);
+
+    // Hand the slot to the new frame. The cleanups run without Mutex, they may well destroy
+    //   resources that add cleanups of their own.
+    RetiredLists.swap(next.ListsInFlight);
+    RetiredCleanups.swap(next.PostFrameCleanup);
+    next.Scratch.Reset();
+    next.Serial = FrameSerial.fetch_add(1, std::memory_order_acq_rel) + 1;
+    CurrFrameIndex = nextIndex;
+    if (!IsSubmissionThreadEnabled())
+    {
+        SubmitFrameIndex = nextIndex;
+        SubmitFrameSerial = next.Serial;
+    }
+    lk.unlock();
+    SlotRetired.notify_all();
+
+    for (const auto& ptr : RetiredLists)
+        ptr->ReleaseAllResources();
+    for (const auto& cleanupFn : RetiredCleanups)
+        cleanupFn(Parent);
+    RetiredLists.clear();
+    RetiredCleanups.clear();
+
+    CmdBufferAllocator.AdvanceFrame();
+    Parent.GetDeferredDeleter().Drain();
+}
+
+void CCommandQueueVk::AdvanceCopyQueue()
+{
+    // A separate copy queue never presents and moves on with the render queue's frames instead,
+    //   so that only one thread ever advances it
+    if (Type != EQueueType::Render)
+        return;
+    auto copyQueue = Parent.GetDefaultCopyQueue();
+    if (copyQueue && copyQueue.get() != this)
+        copyQueue->SubmitAndRecycle();
+}
+
+void CCommandQueueVk::PushSubmitItem(CSubmitItem item)
+{
+    ItemsPushed.fetch_add(1);
+    SubmitItems.Push(std::move(item));
+
+    // Only bother the mutex if the thread may be asleep, see SubmissionThread
+    if (bIsThreadSleeping.load())
+    {
+        {
+            std::lock_guard<std::mutex> lk(ThreadMutex);
+        }
+        ThreadWake.notify_one();
+    }
+}
+
+void CCommandQueueVk::SubmissionThread()
+{
+    std::vector<CSubmitItem> items;
+    while (true)
+    {
+        items.clear();
+        if (!SubmitItems.PopAll(items))
+        {
+            // A pusher either sees the flag and wakes us, or pushed before the check below
+            std::unique_lock<std::mutex> lk(ThreadMutex);
+            bIsThreadSleeping.store(true);
+            ThreadWake.wait(lk, [this]() { return bIsThreadStopping || !SubmitItems.IsEmpty(); });
+            bIsThreadSleeping.store(false);
+            if (bIsThreadStopping && SubmitItems.IsEmpty())
+                return;
+            continue;
+        }
+
+        // Each item is a point on the timeline, by its position in push order
+        uint64_t point = ItemsDone.load();
+        for (auto& item : items)
+        {
+            point++;
+            if (item.Type == ESubmitItemType::List)
+            {
+                uint64_t serial = item.List->GetSubmitSerial();
+                CommittedLists.emplace(serial, std::move(item.List));
+                continue;
+            }
+
+            // Ends a frame, whatever is committed by now goes into it
+            TakeCommittedLists();
+            Submit(point);
+            if (item.AfterSubmit)
+            {
+                std::lock_guard<std::mutex> lk(Mutex);
+                item.AfterSubmit(GetHandle());
+            }
+            {
+                std::lock_guard<std::mutex> lk(Mutex);
+                if (item.Type == ESubmitItemType::Frame)
+                    FrameResources[SubmitFrameIndex]->PostFrameCleanup.emplace_back(
+                        [](CDeviceVk& p) { p.GetHugeConstantBuffer()->FreeBlock(); });
+                SubmitFrameIndex = (SubmitFrameIndex + 1) % FramesInFlight;
+                SubmitFrameSerial++;
+            }
+            // The recording thread may be waiting for this before it retires the next slot,
+            //   which the next Submit in turn waits for
+            FramesSubmitted.fetch_add(1);
+            {
+                std::lock_guard<std::mutex> lk(ThreadMutex);
+            }
+            ThreadProgress.notify_all();
+        }
+        if (SubmittedPoint.load() < point)
+        {
+            TakeCommittedLists();
+            Submit(point);
+        }
+
+        ItemsDone.store(point);
+        {
+            std::lock_guard<std::mutex> lk(ThreadMutex);
+        }
+        ThreadProgress.notify_all();
+    }
+}
+
+bool CCommandQueueVk::TakeCommittedLists()
+{
+    bool tookAny = false;
+    std::lock_guard<std::mutex> lk(Mutex);
+    auto iter = CommittedLists.begin();
+    while (iter != CommittedLists.end() && iter->first == NextSubmitSerial)
+    {
+        QueuedLists.push_back(std::move(iter->second));
+        iter = CommittedLists.erase(iter);
+        NextSubmitSerial++;
+        tookAny = true;
+    }
+    return tookAny;
+}
+
+void CCommandQueueVk::StopSubmissionThread()
+{
+    {
+        std::lock_guard<std::mutex> lk(ThreadMutex);
+        bIsThreadStopping = true;
+    }
+    ThreadWake.notify_one();
+    Thread.join();
+}
+
+CCommandQueueVk::CFrameResources::CFrameResources(CDeviceVk& deviceVk)
+    : DeviceVk(deviceVk)
+    , Scratch(deviceVk)
 {
-    vkDestroyFence(DeviceVk.GetVkDevice(), Fence, nullptr);
 }
 
 void CCommandQueueVk::CFrameResources::Reset()
@@ -115,6 +487,7 @@ void CCommandQueueVk::CFrameResources::Reset()
         cleanupFn(DeviceVk);
     ListsInFlight.clear();
     PostFrameCleanup.clear();
+    Scratch.Reset();
 }
 
 }
@@ -1,11 +1,17 @@
 #pragma once
+#include "BufferVk.h"
 #include "CommandBufferVk.h"
 #include "CommandListVk.h"
 #include "CommandQueue.h"
+#include "MPSCQueue.h"
 #include "VkCommon.h"
 #include <SpinLock.h>
-#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 namespace RHI
@@ -25,44 +31,149 @@ public:
     CCommandBufferAllocatorVk& GetCmdBufferAllocator() { return CmdBufferAllocator; }
 
     CCommandList::Ref CreateCommandList() override;
+    IRenderBundle::Ref CreateRenderBundle(CRenderPass::Ref renderPass, uint32_t subpass) override;
 
-    void Flush() override;
+    uint64_t Flush() override;
     void Finish() override;
+    uint64_t GetCompletedPoint() const override;
+    bool WaitForPoint(uint64_t point, uint32_t timeoutMs = UINT32_MAX) const override;
+    void SetSubmissionThreadEnabled(bool enabled) override;
+    bool IsSubmissionThreadEnabled() const { return bIsThreaded.load(std::memory_order_acquire); }
+    void SetFramesInFlight(uint32_t count) override;
+    uint32_t GetFramesInFlight() const { return FramesInFlight; }
+    void SetLowLatencyMode(bool enabled) override { bIsLowLatency = enabled; }
+    void WaitForNextFrame() override;
+    float GetQueueDepth() const override { return QueueDepth.load(std::memory_order_relaxed); }
+
+    // Reserve a spot for the command list in this queue. With the submission thread the list only
+    //   gets the serial it is submitted in order of, and is handed over by CommitCommandList.
+    uint64_t EnqueueCommandList(CCommandListVk::Ref cmdList);
+    void CommitCommandList(CCommandListVk::Ref cmdList);
+
+    // Submit all committed command lists and signal point, 0 picks the next one if there was
+    //   anything to submit. Returns the point that covers the submission.
+    uint64_t Submit(uint64_t point = 0);
+    // Submit and advance frame index, afterSubmit gets to use the VkQueue right after the frame
+    //   went in, e.g. to present
+    void SubmitFrame(std::function<void(VkQueue)> afterSubmit = nullptr);
+    // Submit and recycle the oldest frame, for queues that never present
+    void SubmitAndRecycle();
+    // Blocks until the submission thread has handled everything handed to it so far
+    void WaitForSubmissionThread();
+
+    // Submit a command buffer recorded outside of any command list, in order with the lists
+    void SubmitCommandBuffer(VkCommandBuffer cmdBuffer, VkFence fence);
+
+    // Signaled with the points returned by Flush
+    VkSemaphore GetTimeline() const { return Timeline; }
+
+    // Runs once the GPU is done with what this queue has submitted so far
+    void AddPostFrameCleanup(std::function<void(CDeviceVk&)> callback);
+
+    // Frames are numbered from 1 as they are recorded. Everything of frames up to the completed
+    //   serial has finished executing on the GPU.
+    uint64_t GetFrameSerial() const { return FrameSerial.load(std::memory_order_acquire); }
+    uint64_t GetCompletedFrameSerial() const
+    {
+        return CompletedFrameSerial.load(std::memory_order_acquire);
+    }
 
-    // Reserve a spot for the command list in this queue
-    void EnqueueCommandList(CCommandListVk::Ref cmdList);
-
-    // Submit all committed command lists
-    void Submit(bool setFence = false);
-    // Submit and advance frame index
-    void SubmitFrame();
+    // Device local memory that stays valid until the frame currently being recorded has finished
+    CScratchRange AllocateScratch(size_t size, size_t alignment = 256);
 
 private:
+    // Retires the oldest slot and hands it to the next frame
+    void AdvanceFrame();
+    void AdvanceCopyQueue();
+    // Blocks until the submission thread has handled count frames
+    void WaitForFramesSubmitted(uint64_t count);
+    void MeasureQueueDepth(uint64_t framePoint);
+
+    enum class ESubmitItemType
+    {
+        List,
+        Frame,
+        Recycle
+    };
+    struct CSubmitItem
+    {
+        ESubmitItemType Type;
+        CCommandListVk::Ref List;
+        std::function<void(VkQueue)> AfterSubmit;
+    };
+    void PushSubmitItem(CSubmitItem item);
+    void SubmissionThread();
+    // Moves the committed lists that are next in Enqueue order over to QueuedLists
+    bool TakeCommittedLists();
+    void StopSubmissionThread();
+
     CDeviceVk& Parent;
     EQueueType Type;
     VkQueue Handle = VK_NULL_HANDLE;
     CCommandBufferAllocatorVk CmdBufferAllocator;
+    VkSemaphore Timeline = VK_NULL_HANDLE;
+    std::atomic<uint64_t> SubmittedPoint { 0 };
 
     std::mutex Mutex;
 
     std::vector<CCommandListVk::Ref> QueuedLists;
+    // Kept around so its storage is reused across submits
+    CSubmitBatcherVk SubmitBatcher;
 
-    static const uint32_t FrameIndexCount = 3;
     struct CFrameResources
     {
         CDeviceVk& DeviceVk;
-        VkFence Fence = VK_NULL_HANDLE;
+        // Reached once the frame is done on the GPU
+        uint64_t Point = 0;
+        // Frame the slot was handed to, see AdvanceFrame
+        uint64_t Serial = 0;
 
         std::vector<CCommandListVk::Ref> ListsInFlight;
         std::vector<std::function<void(CDeviceVk&)>> PostFrameCleanup;
+        CLinearScratchAllocator Scratch;
 
         CFrameResources(CDeviceVk& deviceVk);
-        ~CFrameResources();
 
         void Reset();
     };
-    std::array<CFrameResources, FrameIndexCount> FrameResources;
+    uint32_t FramesInFlight = 3;
+    std::vector<std::unique_ptr<CFrameResources>> FrameResources;
+    // Frame being recorded, and the one submissions go to. They only differ while the submission
+    //   thread has not caught up with the recording thread. Changed under Mutex.
     uint32_t CurrFrameIndex = 0;
+    uint32_t SubmitFrameIndex = 0;
+    uint64_t SubmitFrameSerial = 1;
+    // Signaled when AdvanceFrame hands a slot over
+    std::condition_variable SlotRetired;
+    // Kept around so their storage is reused, only touched by AdvanceFrame
+    std::vector<CCommandListVk::Ref> RetiredLists;
+    std::vector<std::function<void(CDeviceVk&)>> RetiredCleanups;
+    std::atomic<uint64_t> FrameSerial { 1 };
+    std::atomic<uint64_t> CompletedFrameSerial { 0 };
+
+    bool bIsLowLatency = false;
+    // Points of the frames that may not have finished yet, for GetQueueDepth
+    std::deque<uint64_t> FramePoints;
+    std::atomic<float> QueueDepth { 0.0f };
+
+    // Submission thread, see SetSubmissionThreadEnabled
+    std::atomic<bool> bIsThreaded { false };
+    std::thread Thread;
+    TMPSCQueue<CSubmitItem> SubmitItems;
+    std::atomic<uint64_t> NextEnqueueSerial { 1 };
+    std::atomic<uint64_t> ItemsPushed { 0 };
+    std::atomic<uint64_t> ItemsDone { 0 };
+    uint64_t FramesPushed = 0;
+    std::atomic<uint64_t> FramesSubmitted { 0 };
+    // Owned by the submission thread
+    uint64_t NextSubmitSerial = 1;
+    std::map<uint64_t, CCommandListVk::Ref> CommittedLists;
+    // Only for sleeping and waking up, never held around queue operations
+    std::mutex ThreadMutex;
+    std::condition_variable ThreadWake;
+    std::condition_variable ThreadProgress;
+    std::atomic<bool> bIsThreadSleeping { false };
+    bool bIsThreadStopping = false;
 };
 
 }
@@ -0,0 +1,283 @@
+#include "DeferredDeleterVk.h"
+#include "BufferVk.h"
+#include "DeviceVk.h"
+#include "FenceVk.h"
+
+namespace RHI
+{
+
+static_assert((CDeferredDeleterVk::RingSize & (CDeferredDeleterVk::RingSize - 1)) == 0,
+              "Ring positions are masked, the size has to be a power of two");
+
+// Non-dispatchable handles are pointers on 64-bit platforms and uint64_t elsewhere,
+//   reinterpret_cast gets them in and out of an entry either way
+template <typename T> static T FromHandle(uint64_t handle) { return reinterpret_cast<T>(handle); }
+
+template <typename T>
+CDeferredDeleterVk::CEntry CDeferredDeleterVk::MakeEntry(EDeferredDeleteType type, T handle)
+{
+    CEntry entry;
+    entry.Type = type;
+    entry.Handle = reinterpret_cast<uint64_t>(handle);
+    return entry;
+}
+
+CDeferredDeleterVk::CDeferredDeleterVk(CDeviceVk& p)
+    : Parent(p)
+    , Slots(new CSlot[RingSize])
+{
+    for (uint32_t i = 0; i < RingSize; i++)
+        Slots[i].Sequence.store(i, std::memory_order_relaxed);
+}
+
+CDeferredDeleterVk::~CDeferredDeleterVk() { DrainAll(); }
+
+void CDeferredDeleterVk::DestroyBuffer(VkBuffer buffer)
+{
+    Retire(MakeEntry(EDeferredDeleteType::Buffer, buffer));
+}
+
+void CDeferredDeleterVk::DestroyImage(VkImage image)
+{
+    Retire(MakeEntry(EDeferredDeleteType::Image, image));
+}
+
+void CDeferredDeleterVk::DestroyImageView(VkImageView view)
+{
+    Retire(MakeEntry(EDeferredDeleteType::ImageView, view));
+}
+
+void CDeferredDeleterVk::DestroySemaphore(VkSemaphore semaphore)
+{
+    Retire(MakeEntry(EDeferredDeleteType::Semaphore, semaphore));
+}
+
+void CDeferredDeleterVk::DestroyBuffer(VkBuffer buffer, VmaAllocation allocation, int category)
+{
+    CEntry entry = MakeEntry(EDeferredDeleteType::AllocatedBuffer, buffer);
+    entry.Allocation = allocation;
+    entry.Category = static_cast<int8_t>(category);
+    Retire(entry);
+}
+
+void CDeferredDeleterVk::DestroyImage(VkImage image, VmaAllocation allocation, int category)
+{
+    CEntry entry = MakeEntry(EDeferredDeleteType::AllocatedImage, image);
+    entry.Allocation = allocation;
+    entry.Category = static_cast<int8_t>(category);
+    Retire(entry);
+}
+
+void CDeferredDeleterVk::FreeAllocation(VmaAllocation allocation, int category)
+{
+    CEntry entry;
+    entry.Type = EDeferredDeleteType::Allocation;
+    entry.Allocation = allocation;
+    entry.Category = static_cast<int8_t>(category);
+    Retire(entry);
+}
+
+void CDeferredDeleterVk::FreePoolRange(CBufferPoolVk& pool, VkBuffer buffer, VkDeviceSize offset,
+                                       size_t size)
+{
+    CEntry entry = MakeEntry(EDeferredDeleteType::PoolRange, buffer);
+    entry.Owner = &pool;
+    entry.Offset = offset;
+    entry.Size = size;
+    Retire(entry);
+}
+
+void CDeferredDeleterVk::DestroyImportedBuffer(VkBuffer buffer, VkDeviceMemory memory,
+                                               std::shared_ptr<CFenceVk> releaseFence)
+{
+    CEntry entry = MakeEntry(EDeferredDeleteType::ImportedBuffer, buffer);
+    entry.Memory = memory;
+    entry.Owner = new CFenceVk::Ref(std::move(releaseFence));
+    Retire(entry);
+}
+
+uint64_t CDeferredDeleterVk::ReserveSubmit(VkSemaphore timeline)
+{
+    std::lock_guard<std::mutex> lk(SubmitMutex);
+    uint64_t serial = CurrentSerial.fetch_add(1);
+    PendingSubmits.push_back(CPendingSubmit { serial, timeline, PendingPoint });
+    return serial;
+}
+
+void CDeferredDeleterVk::OnSubmit(uint64_t serial, uint64_t point)
+{
+    std::lock_guard<std::mutex> lk(SubmitMutex);
+    for (auto it = PendingSubmits.rbegin(); it != PendingSubmits.rend(); ++it)
+    {
+        if (it->Serial == serial)
+        {
+            it->Point = point;
+            return;
+        }
+    }
+}
+
+void CDeferredDeleterVk::OnQueueDestroyed(VkSemaphore timeline)
+{
+    std::lock_guard<std::mutex> lk(SubmitMutex);
+    for (auto& submit : PendingSubmits)
+        if (submit.Timeline == timeline)
+            submit.Timeline = VK_NULL_HANDLE;
+}
+
+void CDeferredDeleterVk::Drain()
+{
+    std::unique_lock<std::mutex> lk(DrainMutex, std::try_to_lock);
+    if (!lk.owns_lock())
+        return;
+
+    uint64_t completed = UpdateCompletedSerial();
+
+    // Stop at the first entry that is not done or not written yet. Entries are roughly ordered by
+    //   serial, one that got ahead of an older one just waits a little longer.
+    for (;;)
+    {
+        CSlot& slot = Slots[DequeuePos & (RingSize - 1)];
+        if (slot.Sequence.load(std::memory_order_acquire) != DequeuePos + 1)
+            break;
+        if (slot.Entry.RetireSerial > completed)
+            break;
+        Destroy(slot.Entry);
+        slot.Sequence.store(DequeuePos + RingSize, std::memory_order_release);
+        DequeuePos++;
+    }
+
+    if (!bHasOverflow.load(std::memory_order_acquire))
+        return;
+    std::lock_guard<std::mutex> lko(OverflowMutex);
+    auto it = Overflow.begin();
+    for (const auto& entry : Overflow)
+        if (entry.RetireSerial <= completed)
+            Destroy(entry);
+        else
+            *it++ = entry;
+    Overflow.erase(it, Overflow.end());
+    bHasOverflow.store(!Overflow.empty(), std::memory_order_release);
+}
+
+void CDeferredDeleterVk::DrainAll()
+{
+    std::lock_guard<std::mutex> lk(DrainMutex);
+    for (;;)
+    {
+        CSlot& slot = Slots[DequeuePos & (RingSize - 1)];
+        if (slot.Sequence.load(std::memory_order_acquire) != DequeuePos + 1)
+            break;
+        Destroy(slot.Entry);
+        slot.Sequence.store(DequeuePos + RingSize, std::memory_order_release);
+        DequeuePos++;
+    }
+
+    std::lock_guard<std::mutex> lko(OverflowMutex);
+    for (const auto& entry : Overflow)
+        Destroy(entry);
+    Overflow.clear();
+    bHasOverflow.store(false, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lks(SubmitMutex);
+    PendingSubmits.clear();
+}
+
+void CDeferredDeleterVk::Retire(CEntry entry)
+{
+    entry.RetireSerial = CurrentSerial.load(std::memory_order_acquire);
+
+    // Claim a position whose slot the consumer has released, see Drain
+    uint64_t pos = EnqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        CSlot& slot = Slots[pos & (RingSize - 1)];
+        uint64_t sequence = slot.Sequence.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+        if (diff == 0)
+        {
+            if (EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                slot.Entry = entry;
+                slot.Sequence.store(pos + 1, std::memory_order_release);
+                return;
+            }
+        }
+        else if (diff < 0)
+            break; // Full
+        else
+            pos = EnqueuePos.load(std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lk(OverflowMutex);
+    Overflow.push_back(entry);
+    bHasOverflow.store(true, std::memory_order_release);
+}
+
+void CDeferredDeleterVk::Destroy(const CEntry& entry)
+{
+    VkDevice device = Parent.GetVkDevice();
+    switch (entry.Type)
+    {
+    case EDeferredDeleteType::Buffer:
+        vkDestroyBuffer(device, FromHandle<VkBuffer>(entry.Handle), nullptr);
+        break;
+    case EDeferredDeleteType::Image:
+        vkDestroyImage(device, FromHandle<VkImage>(entry.Handle), nullptr);
+        break;
+    case EDeferredDeleteType::ImageView:
+        vkDestroyImageView(device, FromHandle<VkImageView>(entry.Handle), nullptr);
+        break;
+    case EDeferredDeleteType::Semaphore:
+        vkDestroySemaphore(device, FromHandle<VkSemaphore>(entry.Handle), nullptr);
+        break;
+    case EDeferredDeleteType::AllocatedBuffer:
+        Parent.TrackAllocation(static_cast<CDeviceVk::EMemoryCategory>(entry.Category),
+                               entry.Allocation, false);
+        vmaDestroyBuffer(Parent.GetAllocator(), FromHandle<VkBuffer>(entry.Handle),
+                         entry.Allocation);
+        break;
+    case EDeferredDeleteType::AllocatedImage:
+        Parent.TrackAllocation(static_cast<CDeviceVk::EMemoryCategory>(entry.Category),
+                               entry.Allocation, false);
+        vmaDestroyImage(Parent.GetAllocator(), FromHandle<VkImage>(entry.Handle),
+                        entry.Allocation);
+        break;
+    case EDeferredDeleteType::Allocation:
+        Parent.TrackAllocation(static_cast<CDeviceVk::EMemoryCategory>(entry.Category),
+                               entry.Allocation, false);
+        vmaFreeMemory(Parent.GetAllocator(), entry.Allocation);
+        break;
+    case EDeferredDeleteType::PoolRange:
+        static_cast<CBufferPoolVk*>(entry.Owner)
+            ->Free(FromHandle<VkBuffer>(entry.Handle), entry.Offset, entry.Size);
+        break;
+    case EDeferredDeleteType::ImportedBuffer:
+    {
+        // The caller may reuse the memory once the fence is signaled
+        std::unique_ptr<CFenceVk::Ref> fence(static_cast<CFenceVk::Ref*>(entry.Owner));
+        vkDestroyBuffer(device, FromHandle<VkBuffer>(entry.Handle), nullptr);
+        vkFreeMemory(device, entry.Memory, nullptr);
+        (*fence)->Signal();
+        break;
+    }
+    }
+}
+
+uint64_t CDeferredDeleterVk::UpdateCompletedSerial()
+{
+    std::lock_guard<std::mutex> lk(SubmitMutex);
+    while (!PendingSubmits.empty())
+    {
+        const auto& submit = PendingSubmits.front();
+        if (submit.Timeline != VK_NULL_HANDLE
+            && (submit.Point == PendingPoint
+                || Parent.GetTimelineValue(submit.Timeline) < submit.Point))
+            break;
+        CompletedSerial = submit.Serial;
+        PendingSubmits.pop_front();
+    }
+    return CompletedSerial;
+}
+
+} /* namespace RHI */
@@ -0,0 +1,130 @@
+#pragma once
+#include "VkCommon.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace RHI
+{
+
+enum class EDeferredDeleteType : uint8_t
+{
+    Buffer,
+    Image,
+    ImageView,
+    Semaphore,
+    // Buffer and the VMA allocation it was created with
+    AllocatedBuffer,
+    // Image and the VMA allocation it was created with
+    AllocatedImage,
+    // Just the VMA allocation
+    Allocation,
+    // A range that goes back to its CBufferPoolVk
+    PoolRange,
+    // Buffer on imported host memory, whose release fence is signaled once both are gone
+    ImportedBuffer
+};
+
+// Destroys handles once the GPU is done with everything that was submitted before they were
+//   retired, without a std::function or any other allocation per handle. Retiring is lock free and
+//   may happen on any thread. Entries go into a fixed ring and only spill into a locked overflow
+//   list if the GPU falls so far behind that the ring fills up.
+class CBufferPoolVk;
+class CFenceVk;
+
+class CDeferredDeleterVk
+{
+public:
+    explicit CDeferredDeleterVk(CDeviceVk& p);
+    ~CDeferredDeleterVk();
+    CDeferredDeleterVk(const CDeferredDeleterVk&) = delete;
+    CDeferredDeleterVk& operator=(const CDeferredDeleterVk&) = delete;
+
+    void DestroyBuffer(VkBuffer buffer);
+    void DestroyImage(VkImage image);
+    void DestroyImageView(VkImageView view);
+    void DestroySemaphore(VkSemaphore semaphore);
+    // category is the CDeviceVk::EMemoryCategory the allocation is tracked under
+    void DestroyBuffer(VkBuffer buffer, VmaAllocation allocation, int category);
+    void DestroyImage(VkImage image, VmaAllocation allocation, int category);
+    void FreeAllocation(VmaAllocation allocation, int category);
+    void FreePoolRange(CBufferPoolVk& pool, VkBuffer buffer, VkDeviceSize offset, size_t size);
+    // The only kind that allocates, imported memory is rare enough
+    void DestroyImportedBuffer(VkBuffer buffer, VkDeviceMemory memory,
+                               std::shared_ptr<CFenceVk> releaseFence);
+
+    // Called by every queue before it gathers the lists of a submit, copy queues included.
+    //   Everything retired before this call may be destroyed once the submit is done, see OnSubmit,
+    //   and all earlier submits are done too.
+    uint64_t ReserveSubmit(VkSemaphore timeline);
+    // The submit reserved as serial signals point on the timeline once it is done
+    void OnSubmit(uint64_t serial, uint64_t point);
+    // The queue waited for all its work and is about to destroy its timeline
+    void OnQueueDestroyed(VkSemaphore timeline);
+
+    // Destroys whatever the GPU is done with. Cheap if there is nothing to do, and returns at once
+    //   if another thread is already draining.
+    void Drain();
+    // Destroys everything regardless, the device must be idle
+    void DrainAll();
+
+    static constexpr uint32_t RingSize = 16384;
+
+private:
+    struct CEntry
+    {
+        EDeferredDeleteType Type = EDeferredDeleteType::Buffer;
+        int8_t Category = -1;
+        uint64_t Handle = 0;
+        VmaAllocation Allocation = VK_NULL_HANDLE;
+        VkDeviceMemory Memory = VK_NULL_HANDLE;
+        // The pool of a range, or a heap allocated CFenceVk::Ref for imported memory
+        void* Owner = nullptr;
+        VkDeviceSize Offset = 0;
+        size_t Size = 0;
+        // Serial of the submit the handle has to wait for
+        uint64_t RetireSerial = 0;
+    };
+    struct CSlot
+    {
+        // Ring position the slot is ready to be written at, or position + 1 once written
+        std::atomic<uint64_t> Sequence;
+        CEntry Entry;
+    };
+    struct CPendingSubmit
+    {
+        uint64_t Serial;
+        VkSemaphore Timeline;
+        // PendingPoint until the submit went in
+        uint64_t Point;
+    };
+    static constexpr uint64_t PendingPoint = UINT64_MAX;
+
+    template <typename T> static CEntry MakeEntry(EDeferredDeleteType type, T handle);
+    void Retire(CEntry entry);
+    void Destroy(const CEntry& entry);
+    // Latest submit serial whose timeline point has been reached
+    uint64_t UpdateCompletedSerial();
+
+    CDeviceVk& Parent;
+
+    std::unique_ptr<CSlot[]> Slots;
+    std::atomic<uint64_t> EnqueuePos { 0 };
+    // Only touched while holding DrainMutex
+    uint64_t DequeuePos = 0;
+    std::mutex DrainMutex;
+
+    std::mutex OverflowMutex;
+    std::vector<CEntry> Overflow;
+    std::atomic<bool> bHasOverflow { false };
+
+    // Entries carry the serial current when they were retired, ReserveSubmit closes it
+    std::atomic<uint64_t> CurrentSerial { 1 };
+    uint64_t CompletedSerial = 0;
+    std::mutex SubmitMutex;
+    std::deque<CPendingSubmit> PendingSubmits;
+};
+
+} /* namespace RHI */
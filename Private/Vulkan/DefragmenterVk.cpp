@@ -0,0 +1,241 @@
+#include "DefragmenterVk.h"
+#include "BufferVk.h"
+#include "CommandQueueVk.h"
+#include "DeviceVk.h"
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+namespace RHI
+{
+
+CDefragmenterVk::CDefragmenterVk(CDeviceVk& p)
+    : Parent(p)
+{
+    VkCommandPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = Parent.GetQueueFamily(EQueueType::Render);
+    VK(vkCreateCommandPool(Parent.GetVkDevice(), &poolInfo, nullptr, &CmdPool));
+
+    VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+    allocInfo.commandPool = CmdPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VK(vkAllocateCommandBuffers(Parent.GetVkDevice(), &allocInfo, &CmdBuffer));
+
+    VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    VK(vkCreateFence(Parent.GetVkDevice(), &fenceInfo, nullptr, &Fence));
+}
+
+CDefragmenterVk::~CDefragmenterVk()
+{
+    vkWaitForFences(Parent.GetVkDevice(), 1, &Fence, VK_TRUE, UINT64_MAX);
+    for (const auto& old : RetiredPlaces)
+        Parent.GetDeferredDeleter().DestroyBuffer(
+            old.first, old.second, static_cast<int>(CDeviceVk::EMemoryCategory::Buffers));
+    vkDestroyFence(Parent.GetVkDevice(), Fence, nullptr);
+    vkDestroyCommandPool(Parent.GetVkDevice(), CmdPool, nullptr);
+}
+
+void CDefragmenterVk::Register(CBufferVk* buffer)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    Buffers.insert(buffer);
+}
+
+void CDefragmenterVk::Unregister(CBufferVk* buffer)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    Buffers.erase(buffer);
+}
+
+void CDefragmenterVk::SetBudget(float milliseconds)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    BudgetMs = milliseconds;
+}
+
+bool CDefragmenterVk::IsEnabled() const
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    return BudgetMs > 0.0f;
+}
+
+void CDefragmenterVk::RunPass(CCommandQueueVk& queue)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lk(Mutex);
+    if (BudgetMs <= 0.0f || Buffers.empty())
+        return;
+    // The previous pass is still copying, its command buffer and old places have to wait
+    if (vkGetFenceStatus(Parent.GetVkDevice(), Fence) != VK_SUCCESS)
+        return;
+    // Frames recorded before that pass may still read the old places, the deleter waits for them
+    for (const auto& old : RetiredPlaces)
+        Parent.GetDeferredDeleter().DestroyBuffer(
+            old.first, old.second, static_cast<int>(CDeviceVk::EMemoryCategory::Buffers));
+    RetiredPlaces.clear();
+
+    // Checking walks every VMA block, so it waits a while once there was nothing to do
+    if (FramesUntilCheck > 0)
+    {
+        FramesUntilCheck--;
+        return;
+    }
+    if (!IsFragmented())
+    {
+        FramesUntilCheck = FramesPerCheck;
+        return;
+    }
+
+    // Empty the block holding the fewest buffer bytes into free space of the others. New places
+    //   only come from blocks that exist already, so that the emptied one can be released.
+    VmaAllocator allocator = Parent.GetAllocator();
+    std::unordered_map<VkDeviceMemory, VkDeviceSize> blockUsage;
+    std::vector<std::pair<VkDeviceMemory, CBufferVk*>> placed;
+    for (auto* buffer : Buffers)
+    {
+        VmaAllocationInfo info;
+        vmaGetAllocationInfo(allocator, buffer->GetAllocation(), &info);
+        blockUsage[info.deviceMemory] += info.size;
+        placed.emplace_back(info.deviceMemory, buffer);
+    }
+    if (blockUsage.size() < 2)
+    {
+        FramesUntilCheck = FramesPerCheck;
+        return;
+    }
+    VkDeviceMemory source =
+        std::min_element(blockUsage.begin(), blockUsage.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second;
+        })->first;
+
+    BeginCmdBuffer();
+
+    // Anything submitted so far may still be writing the buffers
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    struct CMove
+    {
+        CBufferVk* Buffer;
+        VkBuffer NewBuffer;
+        VmaAllocation NewAllocation;
+    };
+    std::vector<CMove> moves;
+    VkDeviceSize bytesMoved = 0;
+    for (const auto& entry : placed)
+    {
+        CBufferVk* buffer = entry.second;
+        if (entry.first != source)
+            continue;
+        if (moves.size() >= MaxMovesPerPass || bytesMoved + buffer->GetSize() > BytesPerPass)
+            break;
+
+        VmaAllocationInfo oldInfo;
+        vmaGetAllocationInfo(allocator, buffer->GetAllocation(), &oldInfo);
+        VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        bufferInfo.size = buffer->GetSize();
+        bufferInfo.usage = buffer->GetBufferUsage();
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.flags =
+            VMA_ALLOCATION_CREATE_NEVER_ALLOCATE_BIT | VMA_ALLOCATION_CREATE_STRATEGY_BEST_FIT_BIT;
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.memoryTypeBits = 1u << oldInfo.memoryType;
+
+        CMove move { buffer, VK_NULL_HANDLE, VK_NULL_HANDLE };
+        VmaAllocationInfo newInfo;
+        if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &move.NewBuffer,
+                            &move.NewAllocation, &newInfo)
+            != VK_SUCCESS)
+            break;
+        // Only room left in the block being emptied
+        if (newInfo.deviceMemory == source)
+        {
+            vmaDestroyBuffer(allocator, move.NewBuffer, move.NewAllocation);
+            break;
+        }
+        Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Buffers, move.NewAllocation, true);
+
+        VkBufferCopy region = { 0, 0, buffer->GetSize() };
+        vkCmdCopyBuffer(CmdBuffer, buffer->GetHandle(), move.NewBuffer, 1, &region);
+        moves.push_back(move);
+        bytesMoved += buffer->GetSize();
+    }
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                         nullptr);
+    VK(vkEndCommandBuffer(CmdBuffer));
+
+    if (moves.empty())
+    {
+        FramesUntilCheck = FramesPerCheck;
+        return;
+    }
+
+    // Later submits on the queue see the copies, so commands recorded from now on may use the new
+    //   places right away. Nothing waits for the fence, the next pass checks it.
+    Submit(queue);
+    for (const auto& move : moves)
+    {
+        RetiredPlaces.emplace_back(move.Buffer->GetHandle(), move.Buffer->GetAllocation());
+        move.Buffer->Relocate(move.NewBuffer, move.NewAllocation);
+    }
+    MoveSerial.fetch_add(1, std::memory_order_acq_rel);
+
+    // Fit the next pass into the budget
+    float elapsed =
+        std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+    if (elapsed > BudgetMs)
+        BytesPerPass = std::max(MinBytesPerPass, BytesPerPass / 2);
+    else if (elapsed < BudgetMs / 2)
+        BytesPerPass = std::min(MaxBytesPerPass, BytesPerPass * 2);
+}
+
+bool CDefragmenterVk::IsFragmented() const
+{
+    const VkPhysicalDeviceMemoryProperties* memProps;
+    vmaGetMemoryProperties(Parent.GetAllocator(), &memProps);
+    VmaStats stats;
+    vmaCalculateStats(Parent.GetAllocator(), &stats);
+
+    VkDeviceSize used = 0;
+    VkDeviceSize unused = 0;
+    for (uint32_t i = 0; i < memProps->memoryHeapCount; i++)
+    {
+        if (!(memProps->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+            continue;
+        used += stats.memoryHeap[i].usedBytes;
+        unused += stats.memoryHeap[i].unusedBytes;
+    }
+    return unused >= MinBytesPerPass && unused >= (used + unused) * MinUnusedRatio;
+}
+
+void CDefragmenterVk::BeginCmdBuffer()
+{
+    // Only called once the fence has signaled
+    VK(vkResetCommandPool(Parent.GetVkDevice(), CmdPool, 0));
+
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK(vkBeginCommandBuffer(CmdBuffer, &beginInfo));
+}
+
+void CDefragmenterVk::Submit(CCommandQueueVk& queue)
+{
+    VK(vkResetFences(Parent.GetVkDevice(), 1, &Fence));
+    queue.SubmitCommandBuffer(CmdBuffer, Fence);
+}
+
+} /* namespace RHI */
@@ -0,0 +1,74 @@
+#pragma once
+#include "VkCommon.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace RHI
+{
+
+class CBufferVk;
+class CCommandQueueVk;
+
+// Moves device local allocations closer together a few at a time, so that processes that churn
+//   through resources for weeks get their memory blocks back. Buffers register themselves if they
+//   can be moved. Images never do: optimal tiling texels only survive a move of their raw bytes
+//   with VK_IMAGE_CREATE_ALIAS_BIT, which a 1.0 device doesn't have. Passes run between frames on
+//   the render queue and must not overlap command recording, since moved buffers get new handles.
+//   They empty the sparsest block into the free space of the others and never wait for the GPU:
+//   VMA's own defragmentation would keep the allocator locked until the copies are done.
+class CDefragmenterVk
+{
+public:
+    explicit CDefragmenterVk(CDeviceVk& p);
+    ~CDefragmenterVk();
+    CDefragmenterVk(const CDefragmenterVk&) = delete;
+    CDefragmenterVk& operator=(const CDefragmenterVk&) = delete;
+
+    void Register(CBufferVk* buffer);
+    void Unregister(CBufferVk* buffer);
+
+    // Milliseconds a pass may take, 0 turns defragmentation off which is the default
+    void SetBudget(float milliseconds);
+    bool IsEnabled() const;
+    // Called once the frame has been submitted to queue
+    void RunPass(CCommandQueueVk& queue);
+
+    // Bumped whenever a pass gave resources new handles, for whoever keeps them around
+    uint64_t GetMoveSerial() const { return MoveSerial.load(std::memory_order_acquire); }
+
+    // Passes are skipped unless at least this share of device local block space is unused
+    static constexpr float MinUnusedRatio = 0.25f;
+    static constexpr uint32_t MaxMovesPerPass = 64;
+    static constexpr VkDeviceSize MinBytesPerPass = 256 * 1024;
+    static constexpr VkDeviceSize MaxBytesPerPass = 256 * 1024 * 1024;
+    // Frames between fragmentation checks while passes find nothing to move
+    static constexpr uint32_t FramesPerCheck = 120;
+
+private:
+    bool IsFragmented() const;
+    void BeginCmdBuffer();
+    void Submit(CCommandQueueVk& queue);
+
+    CDeviceVk& Parent;
+
+    mutable std::mutex Mutex;
+    std::unordered_set<CBufferVk*> Buffers;
+
+    float BudgetMs = 0.0f;
+    // Adjusted after every pass to what fits in the budget
+    VkDeviceSize BytesPerPass = 4 * 1024 * 1024;
+    // Buffers and allocations moved away from by the last pass, retired once its fence signaled
+    std::vector<std::pair<VkBuffer, VmaAllocation>> RetiredPlaces;
+    uint32_t FramesUntilCheck = 0;
+
+    VkCommandPool CmdPool = VK_NULL_HANDLE;
+    VkCommandBuffer CmdBuffer = VK_NULL_HANDLE;
+    VkFence Fence = VK_NULL_HANDLE;
+
+    std::atomic<uint64_t> MoveSerial { 0 };
+};
+
+} /* namespace RHI */
@@ -63,6 +63,17 @@ CDescriptorPoolVk::~CDescriptorPoolVk()
     {
         vkDestroyDescriptorPool(Layout->GetDevice().GetVkDevice(), pool, nullptr);
     }
+    Layout->GetDevice().TrackMemory(CDeviceVk::EMemoryCategory::DescriptorPools,
+                                    -static_cast<int64_t>(Pools.size() * GetPoolSizeEstimate()));
+}
+
+size_t CDescriptorPoolVk::GetPoolSizeEstimate() const
+{
+    // Drivers don't tell, 64 bytes per descriptor is on the generous side of what they use
+    size_t descriptorCount = 0;
+    for (const auto& poolSize : PoolSizes)
+        descriptorCount += poolSize.descriptorCount;
+    return descriptorCount * 64;
 }
 
 VkDescriptorSet CDescriptorPoolVk::AllocateDescriptorSet()
@@ -96,6 +107,9 @@ VkDescriptorSet CDescriptorPoolVk::AllocateDescriptorSet()
             if (result != VK_SUCCESS)
                 return VK_NULL_HANDLE;
 
+            Layout->GetDevice().TrackMemory(CDeviceVk::EMemoryCategory::DescriptorPools,
+                                            static_cast<int64_t>(GetPoolSizeEstimate()));
+
             // Add the Vulkan handle to the descriptor pool instance.
             Pools.push_back(handle);
             AllocatedSets.push_back(0);
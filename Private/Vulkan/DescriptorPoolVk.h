@@ -44,6 +44,8 @@ public:
     VkResult FreeDescriptorSet(VkDescriptorSet descriptorSet);
 
 private:
+    size_t GetPoolSizeEstimate() const;
+
     const CDescriptorSetLayoutVk* Layout = nullptr;
     std::vector<VkDescriptorPoolSize> PoolSizes;
     std::vector<VkDescriptorPool> Pools;
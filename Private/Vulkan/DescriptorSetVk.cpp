@@ -18,8 +18,16 @@ RHI::CDescriptorSetVk::~CDescriptorSetVk() {}
 void RHI::CDescriptorSetVk::BindBuffer(CBuffer::Ref buffer, size_t offset, size_t range,
                                        uint32_t binding, uint32_t index)
 {
-    auto handle = std::static_pointer_cast<CBufferVk>(buffer)->GetHandle();
-    ResourceBindings.BindBuffer(handle, offset, range, 0, binding, index);
+    auto impl = std::static_pointer_cast<CBufferVk>(buffer);
+    // A whole size range would run into the neighbours of a pooled buffer
+    if (range == VK_WHOLE_SIZE)
+        range = impl->GetSize() - offset;
+    // The handle of moved and streaming buffers is looked up again when the set is written
+    bool isChanging = impl->IsMovable() || impl->IsStreaming();
+    bHasStreamingBuffers |= impl->IsStreaming();
+    RingConstants.erase(std::make_pair(binding, index));
+    ResourceBindings.BindBuffer(impl->GetHandle(), impl->GetOffset() + offset, range, 0, binding,
+                                index, isChanging ? impl.get() : nullptr);
 }
 
 void CDescriptorSetVk::BindConstants(const void* data, size_t size, uint32_t binding,
@@ -28,9 +36,11 @@ void CDescriptorSetVk::BindConstants(const void* data, size_t size, uint32_t bin
     auto* bufferImpl = Layout->GetDevice().GetHugeConstantBuffer();
     size_t offset;
     size_t minAlignment = Layout->GetDevice().GetVkLimits().minUniformBufferOffsetAlignment;
-    void* bufferData = bufferImpl->Allocate(size, minAlignment, offset);
+    VkBuffer handle;
+    void* bufferData = bufferImpl->Allocate(size, minAlignment, offset, handle);
     memcpy(bufferData, data, size);
-    ResourceBindings.BindBuffer(bufferImpl->GetHandle(), offset, size, 0, binding, index);
+    ResourceBindings.BindBuffer(handle, offset, size, 0, binding, index);
+    RingConstants.emplace(binding, index);
 }
 
 void RHI::CDescriptorSetVk::BindImageView(CImageView::Ref imageView, uint32_t binding,
@@ -88,6 +98,15 @@ void CDescriptorSetVk::DiscardAndRecreate()
 
 void CDescriptorSetVk::WriteUpdates(CAccessTracker& tracker, VkCommandBuffer cmdBuffer)
 {
+    // Buffers the defragmenter moved since the last write have new handles, and streaming
+    //   buffers get a new version whenever they are mapped
+    uint64_t moveSerial = Layout->GetDevice().GetDefragmenter().GetMoveSerial();
+    if (moveSerial != WrittenMoveSerial || bHasStreamingBuffers)
+    {
+        WrittenMoveSerial = moveSerial;
+        ResourceBindings.PatchChangedBuffers();
+    }
+
     if (!ResourceBindings.IsDirty())
     {
         // Update access tracker only
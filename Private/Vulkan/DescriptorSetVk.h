@@ -2,6 +2,8 @@
 #include "AccessTracker.h"
 #include "DescriptorSetLayoutVk.h"
 #include "ResourceBindingsVk.h"
+#include <set>
+#include <utility>
 
 namespace RHI
 {
@@ -28,6 +30,8 @@ public:
     void DiscardAndRecreate(); // Similar to the DX11 MapDiscard semantics
     void WriteUpdates(CAccessTracker& tracker, VkCommandBuffer cmdBuffer);
     void SetUsed() { bIsUsed = true; }
+    // Constants live in the ring of the frame they were bound in
+    bool HasRingConstants() const { return !RingConstants.empty(); }
 
 private:
     // Holds the layout alive
@@ -39,6 +43,12 @@ private:
 
     // If used, we can't freely update this anymore
     bool bIsUsed = false;
+    // Defragmenter move serial as of the last write
+    uint64_t WrittenMoveSerial = 0;
+    // Whose handles have to be checked on every write
+    bool bHasStreamingBuffers = false;
+    // Binding and array index of everything bound through BindConstants
+    std::set<std::pair<uint32_t, uint32_t>> RingConstants;
 };
 
 }
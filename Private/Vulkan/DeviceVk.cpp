@@ -1,15 +1,20 @@
 #include "DeviceVk.h"
 #include "AbstractionBreaker.h"
 #include "CommandQueueVk.h"
+#include "FenceVk.h"
 #include "ImageViewVk.h"
 #include "ImageVk.h"
+#include "MemoryHeapVk.h"
+#include "MipChainBuilder.h"
 #include "PipelineVk.h"
 #include "RenderPassVk.h"
 #include "SamplerVk.h"
 #include "ShaderModuleVk.h"
 #include "SwapChainVk.h"
+#include "TexelConversion.h"
 #include "VkHelpers.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <vector>
@@ -90,6 +95,15 @@ void InitRHIInstance()
 #endif
     };
 
+    // Needed for memory budget queries and host memory import on 1.0 instances
+    for (const auto& extProp : extensionProps)
+    {
+        if (strcmp(extProp.extensionName, "VK_KHR_get_physical_device_properties2") == 0)
+            requiredExtensions.push_back("VK_KHR_get_physical_device_properties2");
+        if (strcmp(extProp.extensionName, "VK_KHR_external_memory_capabilities") == 0)
+            requiredExtensions.push_back("VK_KHR_external_memory_capabilities");
+    }
+
     const std::vector<const char*> validationLayers = { "VK_LAYER_LUNARG_standard_validation" };
 
 #if defined(NDEBUG)
@@ -195,79 +209,128 @@ CDeviceVk::CDeviceVk(EDeviceCreateHints hints)
     vkGetPhysicalDeviceQueueFamilyProperties(PhysicalDevice, &queueFamilyCount,
                                              queueFamilyProperites.data());
 
+    // Graphics goes to the first family that can do it. Compute and copy prefer families that
+    //   can't do more, which is where the async compute and DMA engines live.
     for (uint32_t i = 0; i < queueFamilyCount; i++)
     {
         VkQueueFlags flags = queueFamilyProperites[i].queueFlags;
+        if (queueFamilyProperites[i].queueCount == 0)
+            continue;
         if ((flags & VK_QUEUE_GRAPHICS_BIT) != 0)
         {
-            QueueFamilies[static_cast<int>(EQueueType::Render)] = i;
-            QueueFamilies[static_cast<int>(EQueueType::Compute)] = i;
-            QueueFamilies[static_cast<int>(EQueueType::Copy)] = i;
-            break;
+            if (QueueFamilies[static_cast<int>(EQueueType::Render)] == (uint32_t)-1)
+                QueueFamilies[static_cast<int>(EQueueType::Render)] = i;
+        }
+        else if ((flags & VK_QUEUE_COMPUTE_BIT) != 0)
+        {
+            if (QueueFamilies[static_cast<int>(EQueueType::Compute)] == (uint32_t)-1)
+                QueueFamilies[static_cast<int>(EQueueType::Compute)] = i;
+        }
+        else if ((flags & VK_QUEUE_TRANSFER_BIT) != 0)
+        {
+            if (QueueFamilies[static_cast<int>(EQueueType::Copy)] == (uint32_t)-1)
+                QueueFamilies[static_cast<int>(EQueueType::Copy)] = i;
         }
-        if ((flags & VK_QUEUE_COMPUTE_BIT) != 0 && (flags & VK_QUEUE_GRAPHICS_BIT) == 0)
-            QueueFamilies[static_cast<int>(EQueueType::Compute)] = i;
-        if ((flags & VK_QUEUE_TRANSFER_BIT) != 0 && (flags & VK_QUEUE_GRAPHICS_BIT) == 0)
-            QueueFamilies[static_cast<int>(EQueueType::Copy)] = i;
     }
+    if (QueueFamilies[static_cast<int>(EQueueType::Render)] == (uint32_t)-1)
+        throw CRHIRuntimeError("Device has no graphics queue");
+    // Compute families always support transfers, graphics is the last resort for both
+    if (QueueFamilies[static_cast<int>(EQueueType::Compute)] == (uint32_t)-1)
+        QueueFamilies[static_cast<int>(EQueueType::Compute)] =
+            QueueFamilies[static_cast<int>(EQueueType::Render)];
+    if (QueueFamilies[static_cast<int>(EQueueType::Copy)] == (uint32_t)-1)
+        QueueFamilies[static_cast<int>(EQueueType::Copy)] =
+            QueueFamilies[static_cast<int>(EQueueType::Compute)];
 
     // Enable all features
     VkPhysicalDeviceFeatures requiredFeatures;
     vkGetPhysicalDeviceFeatures(PhysicalDevice, &requiredFeatures);
 
+    // Every queue of the used families is created, CreateCommandQueue picks among them
     std::vector<VkDeviceQueueCreateInfo> queueInfos;
     std::vector<float> queuePriorities;
     queuePriorities.reserve(1024);
-
+    for (uint32_t family : QueueFamilies)
     {
+        if (std::find(ConcurrentQueueFamilies.begin(), ConcurrentQueueFamilies.end(), family)
+            != ConcurrentQueueFamilies.end())
+            continue;
+        ConcurrentQueueFamilies.push_back(family);
+
         VkDeviceQueueCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-        queueFamilyProperites.at(QueueFamilies[static_cast<int>(EQueueType::Render)]).queueCount =
-            1;
-        info.queueCount =
-            queueFamilyProperites.at(QueueFamilies[static_cast<int>(EQueueType::Render)])
-                .queueCount;
-        info.queueFamilyIndex = QueueFamilies[static_cast<int>(EQueueType::Render)];
+        info.queueCount = std::min(queueFamilyProperites.at(family).queueCount, MaxQueuesPerFamily);
+        info.queueFamilyIndex = family;
         for (uint32_t unused = 0; unused < info.queueCount; unused++)
             queuePriorities.push_back(1.0f);
         info.pQueuePriorities = &queuePriorities.back() - info.queueCount + 1;
         queueInfos.push_back(info);
     }
-    if (QueueFamilies[static_cast<int>(EQueueType::Compute)]
-        != QueueFamilies[static_cast<int>(EQueueType::Render)])
+
+    std::vector<const char*> extensionNames = { "VK_KHR_swapchain" };
+
+    uint32_t deviceExtensionCount;
+    vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &deviceExtensionCount, nullptr);
+    std::vector<VkExtensionProperties> deviceExtensions(deviceExtensionCount);
+    vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &deviceExtensionCount,
+                                         deviceExtensions.data());
+    auto isDeviceExtensionSupported = [&](const char* name) {
+        return std::any_of(
+            deviceExtensions.begin(), deviceExtensions.end(),
+            [name](const VkExtensionProperties& p) { return strcmp(p.extensionName, name) == 0; });
+    };
+#ifdef VK_EXT_memory_budget
+    GetMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+        vkGetInstanceProcAddr(Instance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    if (isDeviceExtensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) && GetMemoryProperties2)
     {
-        VkDeviceQueueCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-        queueFamilyProperites.at(QueueFamilies[static_cast<int>(EQueueType::Compute)]).queueCount =
-            1;
-        info.queueCount =
-            queueFamilyProperites.at(QueueFamilies[static_cast<int>(EQueueType::Compute)])
-                .queueCount;
-        info.queueFamilyIndex = QueueFamilies[static_cast<int>(EQueueType::Compute)];
-        for (uint32_t unused = 0; unused < info.queueCount; unused++)
-            queuePriorities.push_back(1.0f);
-        info.pQueuePriorities = &queuePriorities.back() - info.queueCount + 1;
-        queueInfos.push_back(info);
+        extensionNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        bIsMemoryBudgetSupported = true;
     }
-    if (QueueFamilies[static_cast<int>(EQueueType::Copy)]
-            != QueueFamilies[static_cast<int>(EQueueType::Compute)]
-        && QueueFamilies[static_cast<int>(EQueueType::Copy)]
-            != QueueFamilies[static_cast<int>(EQueueType::Render)])
+#endif
+#ifdef VK_EXT_external_memory_host
+    auto getProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+        vkGetInstanceProcAddr(Instance, "vkGetPhysicalDeviceProperties2KHR"));
+    if (isDeviceExtensionSupported(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME)
+        && isDeviceExtensionSupported(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)
+        && getProperties2)
     {
-        VkDeviceQueueCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
-        queueFamilyProperites.at(QueueFamilies[static_cast<int>(EQueueType::Copy)]).queueCount = 1;
-        info.queueCount =
-            queueFamilyProperites.at(QueueFamilies[static_cast<int>(EQueueType::Copy)]).queueCount;
-        info.queueFamilyIndex = QueueFamilies[static_cast<int>(EQueueType::Copy)];
-        for (uint32_t unused = 0; unused < info.queueCount; unused++)
-            queuePriorities.push_back(1.0f);
-        info.pQueuePriorities = &queuePriorities.back() - info.queueCount + 1;
-        queueInfos.push_back(info);
+        extensionNames.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+        extensionNames.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProps = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT
+        };
+        VkPhysicalDeviceProperties2KHR props2 = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR
+        };
+        props2.pNext = &hostProps;
+        getProperties2(PhysicalDevice, &props2);
+        HostImportAlignment = static_cast<size_t>(hostProps.minImportedHostPointerAlignment);
     }
+#endif
 
-    std::vector<const char*> extensionNames = { "VK_KHR_swapchain" };
+    // Queues synchronize through timeline semaphores, there is no fallback to fences
+    auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+        vkGetInstanceProcAddr(Instance, "vkGetPhysicalDeviceFeatures2KHR"));
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR
+    };
+    if (getFeatures2 && isDeviceExtensionSupported(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+    {
+        VkPhysicalDeviceFeatures2KHR features2 = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR
+        };
+        features2.pNext = &timelineFeatures;
+        getFeatures2(PhysicalDevice, &features2);
+    }
+    if (!timelineFeatures.timelineSemaphore)
+        throw CRHIRuntimeError("Device does not support timeline semaphores");
+    extensionNames.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    timelineFeatures.pNext = nullptr;
 
     // Logical Device
     VkDeviceCreateInfo deviceInfo = {};
     deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = &timelineFeatures;
     deviceInfo.queueCreateInfoCount = (uint32_t)queueInfos.size();
     deviceInfo.pQueueCreateInfos = queueInfos.data();
     deviceInfo.enabledExtensionCount = (uint32_t)extensionNames.size();
@@ -275,12 +338,22 @@ CDeviceVk::CDeviceVk(EDeviceCreateHints hints)
     deviceInfo.pEnabledFeatures = &requiredFeatures;
 
     vkCreateDevice(PhysicalDevice, &deviceInfo, nullptr, &Device);
+    WaitSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+        vkGetDeviceProcAddr(Device, "vkWaitSemaphoresKHR"));
+    GetSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+        vkGetDeviceProcAddr(Device, "vkGetSemaphoreCounterValueKHR"));
+#ifdef VK_EXT_external_memory_host
+    if (HostImportAlignment)
+        GetMemoryHostPointerProperties = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+            vkGetDeviceProcAddr(Device, "vkGetMemoryHostPointerPropertiesEXT"));
+#endif
 
     for (int type = 0; type < static_cast<int>(EQueueType::Count); type++)
     {
-        int queueCount = queueFamilyProperites.at(QueueFamilies[type]).queueCount;
+        uint32_t queueCount =
+            std::min(queueFamilyProperites.at(QueueFamilies[type]).queueCount, MaxQueuesPerFamily);
         Queues[type].resize(queueCount);
-        for (int i = 0; i < queueCount; i++)
+        for (uint32_t i = 0; i < queueCount; i++)
         {
             vkGetDeviceQueue(Device, QueueFamilies[type], i, &Queues[type][i]);
         }
@@ -291,34 +364,116 @@ CDeviceVk::CDeviceVk(EDeviceCreateHints hints)
     allocatorInfo.device = Device;
 
     vmaCreateAllocator(&allocatorInfo, &Allocator);
+    Defragmenter = std::make_unique<CDefragmenterVk>(*this);
+    DeferredDeleter = std::make_unique<CDeferredDeleterVk>(*this);
 
     VkPipelineCacheCreateInfo pipelineCacheInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
     vkCreatePipelineCache(Device, &pipelineCacheInfo, nullptr, &PipelineCache);
 
-    HugeConstantBuffer = std::make_unique<CPersistentMappedRingBuffer>(
+    HugeConstantBuffer = std::make_unique<CGrowableRingBuffer>(
         *this, 33554432, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT); // 32M
 
     DefaultRenderQueue =
         std::static_pointer_cast<CCommandQueueVk>(CreateCommandQueue(EQueueType::Render));
     if (!IsTransferQueueSeparate())
         DefaultCopyQueue = DefaultRenderQueue;
+    else
+        DefaultCopyQueue =
+            std::static_pointer_cast<CCommandQueueVk>(CreateCommandQueue(EQueueType::Copy));
 }
 
 CDeviceVk::~CDeviceVk()
 {
+    CommandQueues.clear();
     DefaultCopyQueue.reset();
     DefaultRenderQueue.reset();
     HugeConstantBuffer.reset();
+    // Pool ranges still waiting in there go back to their pools
+    DeferredDeleter->DrainAll();
+    BufferPools.clear();
+    Defragmenter.reset();
+    DeferredDeleter.reset();
     vkDestroyPipelineCache(Device, PipelineCache, nullptr);
     vmaDestroyAllocator(Allocator);
     vkDestroyDevice(Device, nullptr);
 }
 
+// The usage bits an image of the given usage needs, and the state it rests in between uses
+static VkImageUsageFlags GetVkImageUsage(EImageUsageFlags usage, EResourceState& defaultState)
+{
+    VkImageUsageFlags vkUsage = 0;
+    defaultState = EResourceState::General;
+    if (Any(usage, EImageUsageFlags::Sampled))
+    {
+        vkUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        defaultState = EResourceState::ShaderResource;
+    }
+    if (Any(usage, EImageUsageFlags::Storage))
+    {
+        vkUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+            | VK_IMAGE_USAGE_STORAGE_BIT;
+        defaultState = EResourceState::General;
+    }
+    if (Any(usage, EImageUsageFlags::RenderTarget))
+    {
+        vkUsage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        defaultState = EResourceState::RenderTarget;
+    }
+    if (Any(usage, EImageUsageFlags::DepthStencil))
+    {
+        vkUsage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        defaultState = EResourceState::DepthWrite;
+    }
+    if (Any(usage, EImageUsageFlags::Streamed))
+    {
+        vkUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+    if (Any(usage, EImageUsageFlags::Staging))
+    {
+        vkUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        defaultState = EResourceState::CopySource;
+    }
+    if (Any(usage, EImageUsageFlags::Transient))
+    {
+        const auto nonAttachmentUsage = EImageUsageFlags::Sampled | EImageUsageFlags::Storage
+            | EImageUsageFlags::Staging | EImageUsageFlags::Streamed | EImageUsageFlags::GenMIPMaps;
+        if (Any(usage, nonAttachmentUsage))
+            throw CRHIRuntimeError("Transient images can only be used as attachments");
+        if (!Any(usage, EImageUsageFlags::RenderTarget | EImageUsageFlags::DepthStencil))
+            throw CRHIRuntimeError("Transient images have to be a RenderTarget or DepthStencil");
+
+        // Transient attachments may not take any other usage, not even as a copy source
+        vkUsage &=
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        vkUsage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    return vkUsage;
+}
+
 CImage::Ref CDeviceVk::InternalCreateImage(VkImageType type, EFormat format, EImageUsageFlags usage,
                                            uint32_t width, uint32_t height, uint32_t depth,
                                            uint32_t mipLevels, uint32_t arrayLayers,
-                                           uint32_t sampleCount, const void* initialData)
+                                           uint32_t sampleCount, const void* initialData,
+                                           EFormat initialDataFormat)
 {
+    // 3 channel formats are hardly ever supported with optimal tiling, widen them and let the
+    //   upload add the alpha channel. The image reports the wide format, CImageViewVk maps views
+    //   onto it.
+    if (initialDataFormat == EFormat::UNDEFINED)
+        initialDataFormat = format;
+    EFormat expandedFormat = GetExpandedTexelFormat(format);
+    if (expandedFormat != EFormat::UNDEFINED)
+    {
+        VkFormatProperties formatProps;
+        vkGetPhysicalDeviceFormatProperties(PhysicalDevice, static_cast<VkFormat>(format),
+                                            &formatProps);
+        if (!(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+            format = expandedFormat;
+    }
+    bool convertTexels = initialData && initialDataFormat != format;
+    if (convertTexels && !CanConvertTexels(initialDataFormat, format))
+        throw CRHIRuntimeError("Cannot convert initial data to the image format");
+
     VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
     imageInfo.imageType = type;
     imageInfo.format = static_cast<VkFormat>(format);
@@ -330,11 +485,13 @@ CImage::Ref CDeviceVk::InternalCreateImage(VkImageType type, EFormat format, EIm
     imageInfo.samples = static_cast<VkSampleCountFlagBits>(sampleCount);
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL; // BELOW
     imageInfo.usage = 0; // BELOW
-    if (IsTransferQueueSeparate())
+    // Uploads hand images over from the copy queue explicitly. Storage images may bounce between
+    //   render and async compute, which is left to concurrent sharing.
+    if (Any(usage, EImageUsageFlags::Storage) && ConcurrentQueueFamilies.size() > 1)
     {
         imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
-        imageInfo.queueFamilyIndexCount = 3;
-        imageInfo.pQueueFamilyIndices = QueueFamilies;
+        imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(ConcurrentQueueFamilies.size());
+        imageInfo.pQueueFamilyIndices = ConcurrentQueueFamilies.data();
     }
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
@@ -348,38 +505,33 @@ CImage::Ref CDeviceVk::InternalCreateImage(VkImageType type, EFormat format, EIm
     allocCreateInfo.flags = 0;
 
     // Determine memory flags based on usage
-    EResourceState defaultState = EResourceState::General; // BELOW
-    if (Any(usage, EImageUsageFlags::Sampled))
-    {
-        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-        defaultState = EResourceState::ShaderResource;
-    }
-    if (Any(usage, EImageUsageFlags::Storage))
-    {
-        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
-            | VK_IMAGE_USAGE_STORAGE_BIT;
-        defaultState = EResourceState::General;
-    }
-    if (Any(usage, EImageUsageFlags::RenderTarget))
-    {
-        imageInfo.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-        defaultState = EResourceState::RenderTarget;
-    }
-    if (Any(usage, EImageUsageFlags::DepthStencil))
-    {
-        imageInfo.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        defaultState = EResourceState::DepthWrite;
-    }
+    EResourceState defaultState;
+    imageInfo.usage = GetVkImageUsage(usage, defaultState);
     if (Any(usage, EImageUsageFlags::Staging))
     {
         imageInfo.tiling = VK_IMAGE_TILING_LINEAR;
-        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
         allocCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-        defaultState = EResourceState::CopySource;
     }
-    if (Any(usage, EImageUsageFlags::GenMIPMaps))
+    // Full color mip chains of common formats are filtered on the CPU straight into the staging
+    //   buffer, everything else goes through a chain of blits on the copy queue
+    bool genMIPMaps = Any(usage, EImageUsageFlags::GenMIPMaps) && mipLevels > 1;
+    bool cpuMIPMaps = genMIPMaps && initialData && type != VK_IMAGE_TYPE_3D && arrayLayers == 1
+        && CMipChainBuilder::IsFormatSupported(format);
+    if (genMIPMaps)
     {
-        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        if (!cpuMIPMaps)
+            imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    if (Any(usage, EImageUsageFlags::Transient))
+    {
+        if (initialData)
+            throw CRHIRuntimeError("Transient images can only be used as attachments");
+
+        // Where there's no lazily allocated memory this is plain device local memory. A block of
+        //   its own keeps it from committing memory shared with other images.
+        allocCreateInfo.preferredFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        allocCreateInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
     }
 
     VkResult result;
@@ -391,50 +543,99 @@ CImage::Ref CDeviceVk::InternalCreateImage(VkImageType type, EFormat format, EIm
     auto image =
         std::make_shared<CMemoryImageVk>(*this, handle, allocation, imageInfo, usage, defaultState);
 
-    auto cmdList = DefaultCopyQueue->CreateCommandList();
-    cmdList->Enqueue();
-    auto ctx = std::static_pointer_cast<CCommandContextVk>(cmdList->CreateCopyContext());
-    auto cmdBuffer = ctx->GetCmdBuffer();
+    // Prepare a staging buffer, before the copy list is opened so the CPU work isn't serialized
+    //   behind the queue
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    VmaAllocation stagingAlloc = VK_NULL_HANDLE;
+    std::vector<VkBufferImageCopy> regions;
     if (initialData)
     {
-        ctx->TransitionImage(*image, EResourceState::CopyDest);
+        VkBufferImageCopy region = {};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { width, height, depth };
 
-        // Prepare a staging buffer
         VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
         bufferInfo.size = GetUncompressedImageFormatSize(imageInfo.format)
             * static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(depth);
         bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
+        std::unique_ptr<CMipChainBuilder> mipBuilder;
+        if (cpuMIPMaps)
+        {
+            mipBuilder = std::make_unique<CMipChainBuilder>(format, width, height, mipLevels);
+            bufferInfo.size = mipBuilder->GetTotalSize();
+            for (const CMipLevelInfo& level : mipBuilder->GetLevels())
+            {
+                region.bufferOffset = level.Offset;
+                region.imageSubresource.mipLevel = static_cast<uint32_t>(regions.size());
+                region.imageExtent = { level.Width, level.Height, 1 };
+                regions.push_back(region);
+            }
+        }
+        else
+            regions.push_back(region);
+
         VmaAllocationCreateInfo allocInfo = {};
         allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
 
-        VkBuffer stagingBuffer = VK_NULL_HANDLE;
-        VmaAllocation stagingAlloc = VK_NULL_HANDLE;
-
         vmaCreateBuffer(Allocator, &bufferInfo, &allocInfo, &stagingBuffer, &stagingAlloc, nullptr);
+        TrackAllocation(EMemoryCategory::Staging, stagingAlloc, true);
+
+        // Staging memory is write combined, so level 0 is converted into CPU memory if the mip
+        //   chain is filtered from it. Build never reads its destination otherwise.
+        size_t texelCount = static_cast<size_t>(width) * height * depth;
+        std::vector<uint8_t> convertedLevel;
+        if (convertTexels && mipBuilder)
+        {
+            convertedLevel.resize(texelCount * GetConvertibleTexelSize(format));
+            ConvertTexels(initialDataFormat, format, initialData, convertedLevel.data(),
+                          texelCount);
+            initialData = convertedLevel.data();
+        }
 
         void* mappedData;
         vmaMapMemory(Allocator, stagingAlloc, &mappedData);
-        memcpy(mappedData, initialData, bufferInfo.size);
+        if (mipBuilder)
+            mipBuilder->Build(initialData, mappedData);
+        else if (convertTexels)
+            ConvertTexels(initialDataFormat, format, initialData, mappedData, texelCount);
+        else
+            memcpy(mappedData, initialData, bufferInfo.size);
         vmaUnmapMemory(Allocator, stagingAlloc);
+    }
 
-        // Synchronously copy the content
-        VkBufferImageCopy region = {};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
+    // Plain copies go to the transfer queue and are released to the render queue family, which
+    //   acquires the image when it first submits work using it. The release has to name the
+    //   family before anyone uses the image, so the first use has to be on the render family,
+    //   see CImageVk::TakePendingAcquire. Blits need a graphics queue.
+    bool onCopyQueue = initialData && IsTransferQueueSeparate()
+        && imageInfo.sharingMode == VK_SHARING_MODE_EXCLUSIVE && !(genMIPMaps && !cpuMIPMaps);
+    auto queue = onCopyQueue ? DefaultCopyQueue : DefaultRenderQueue;
 
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
+    auto cmdList = std::static_pointer_cast<CCommandListVk>(queue->CreateCommandList());
+    cmdList->Enqueue();
+    auto ctx = std::static_pointer_cast<CCommandContextVk>(cmdList->CreateCopyContext());
+    auto cmdBuffer = ctx->GetCmdBuffer();
+    if (initialData)
+    {
+        ctx->TransitionImage(*image, EResourceState::CopyDest);
 
-        region.imageOffset = { 0, 0, 0 };
-        region.imageExtent = { width, height, depth };
+        // Synchronously copy the content
         vkCmdCopyBufferToImage(cmdBuffer, stagingBuffer, handle,
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(regions.size()), regions.data());
+        ctx->InvalidateState();
 
-        if (Any(usage, EImageUsageFlags::GenMIPMaps))
+        if (genMIPMaps && !cpuMIPMaps)
         {
             CImageBlit blit;
             blit.SrcSubresource.BaseArrayLayer = 0;
@@ -464,13 +665,54 @@ CImage::Ref CDeviceVk::InternalCreateImage(VkImageType type, EFormat format, EIm
             }
         }
 
-        PostFrameCleanup.emplace_back(
-            [=](CDeviceVk& p) { vmaDestroyBuffer(p.GetAllocator(), stagingBuffer, stagingAlloc); });
+        DeferredDeleter->DestroyBuffer(stagingBuffer, stagingAlloc,
+                                       static_cast<int>(EMemoryCategory::Staging));
+    }
+    if (!onCopyQueue)
+    {
+        ctx->TransitionImage(*image, defaultState);
+        ctx->FinishRecording();
+        cmdList->Commit();
+        queue->Flush();
+    }
+    else
+    {
+        CQueueOwnershipAcquire acquire;
+        acquire.SrcQueueFamily = GetQueueFamily(EQueueType::Copy);
+        acquire.DstQueueFamily = GetQueueFamily(EQueueType::Render);
+        acquire.OldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        acquire.NewLayout = StateToImageLayout(defaultState);
+
+        // Release half of the transfer, the layout transition happens in between
+        VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = acquire.OldLayout;
+        barrier.newLayout = acquire.NewLayout;
+        barrier.srcQueueFamilyIndex = acquire.SrcQueueFamily;
+        barrier.dstQueueFamilyIndex = acquire.DstQueueFamily;
+        barrier.image = handle;
+        barrier.subresourceRange.aspectMask = GetImageAspectFlags(imageInfo.format);
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = arrayLayers;
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                             &barrier);
+        ctx->FinishRecording();
+
+        VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+        VK(vkCreateSemaphore(Device, &semaphoreInfo, nullptr, &acquire.Semaphore));
+        cmdList->AddSignalSemaphore(acquire.Semaphore);
+        cmdList->Commit();
+        // The signal has to be submitted before any render queue submission can wait on it. The
+        //   copy queue's frames are advanced by the render queue, not by every upload.
+        queue->Flush();
+
+        image->InitializeAccess(0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, acquire.NewLayout);
+        image->SetPendingAcquire(std::move(acquire));
     }
-    ctx->TransitionImage(*image, defaultState);
-    ctx->FinishRecording();
-    cmdList->Commit();
-    DefaultCopyQueue->Flush();
 
     if (usage == EImageUsageFlags::Sampled)
         image->SetTrackingDisabled(true);
@@ -483,48 +725,89 @@ CBuffer::Ref CDeviceVk::CreateBuffer(size_t size, EBufferUsageFlags usage, const
     return std::make_shared<CBufferVk>(*this, size, usage, initialData);
 }
 
+CBuffer::Ref CDeviceVk::ImportHostBuffer(const void* pointer, size_t size,
+                                         CFence::Ref& releaseFence)
+{
+    if (!HostImportAlignment)
+        throw CRHIRuntimeError("Device can't import host memory");
+    if (reinterpret_cast<uintptr_t>(pointer) % HostImportAlignment != 0
+        || size % HostImportAlignment != 0)
+        throw CRHIRuntimeError("Host memory to import is not aligned to GetHostImportAlignment()");
+
+    auto fence = std::make_shared<CFenceVk>();
+    releaseFence = fence;
+    return std::make_shared<CBufferVk>(*this, pointer, size, std::move(fence));
+}
+
+uint32_t CDeviceVk::GetHostPointerMemoryTypeBits(const void* pointer) const
+{
+#ifdef VK_EXT_external_memory_host
+    if (!GetMemoryHostPointerProperties)
+        return 0;
+    VkMemoryHostPointerPropertiesEXT hostProps = {
+        VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT
+    };
+    VK(GetMemoryHostPointerProperties(Device,
+                                      VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                      pointer, &hostProps));
+    return hostProps.memoryTypeBits;
+#else
+    return 0;
+#endif
+}
+
+CBufferPoolVk& CDeviceVk::GetBufferPool(VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+{
+    std::lock_guard<std::mutex> lk(BufferPoolMutex);
+    auto& pool = BufferPools[std::make_pair(usage, memoryUsage)];
+    if (!pool)
+    {
+        // Index buffers need 4, constants whatever the device says
+        size_t alignment = 16;
+        if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+            alignment =
+                std::max<size_t>(alignment, Properties.limits.minUniformBufferOffsetAlignment);
+        pool = std::make_unique<CBufferPoolVk>(*this, usage, memoryUsage, alignment);
+    }
+    return *pool;
+}
+
 CImage::Ref CDeviceVk::CreateImage1D(EFormat format, EImageUsageFlags usage, uint32_t width,
                                      uint32_t mipLevels, uint32_t arrayLayers, uint32_t sampleCount,
-                                     const void* initialData)
+                                     const void* initialData, EFormat initialDataFormat)
 {
     if (Any(usage, EImageUsageFlags::GenMIPMaps))
     {
-        if ((width & -width) != width)
-            throw CRHIRuntimeError("GenMIPMaps requires sizes to be 2^n");
-        mipLevels = 1 + static_cast<uint32_t>(floor(log2(width)));
+        mipLevels = CMipChainBuilder::GetFullChainLevelCount(width);
     }
     return InternalCreateImage(VK_IMAGE_TYPE_1D, format, usage, width, 1, 1, mipLevels, arrayLayers,
-                               sampleCount, initialData);
+                               sampleCount, initialData, initialDataFormat);
 }
 
 CImage::Ref CDeviceVk::CreateImage2D(EFormat format, EImageUsageFlags usage, uint32_t width,
                                      uint32_t height, uint32_t mipLevels, uint32_t arrayLayers,
-                                     uint32_t sampleCount, const void* initialData)
+                                     uint32_t sampleCount, const void* initialData,
+                                     EFormat initialDataFormat)
 {
     if (Any(usage, EImageUsageFlags::GenMIPMaps))
     {
-        if ((width & -width) != width || (height & -height) != height)
-            throw CRHIRuntimeError("GenMIPMaps requires sizes to be 2^n");
-        mipLevels = 1 + static_cast<uint32_t>(floor(log2(std::min(width, height))));
+        mipLevels = CMipChainBuilder::GetFullChainLevelCount(width, height);
     }
     return InternalCreateImage(VK_IMAGE_TYPE_2D, format, usage, width, height, 1, mipLevels,
-                               arrayLayers, sampleCount, initialData);
+                               arrayLayers, sampleCount, initialData, initialDataFormat);
 }
 
 CImage::Ref CDeviceVk::CreateImage3D(EFormat format, EImageUsageFlags usage, uint32_t width,
                                      uint32_t height, uint32_t depth, uint32_t mipLevels,
                                      uint32_t arrayLayers, uint32_t sampleCount,
-                                     const void* initialData)
+                                     const void* initialData, EFormat initialDataFormat)
 {
     if (Any(usage, EImageUsageFlags::GenMIPMaps))
     {
-        if ((width & -width) != width || (height & -height) != height || (depth & -depth) != depth)
-            throw CRHIRuntimeError("GenMIPMaps requires sizes to be 2^n");
-        mipLevels =
-            1 + static_cast<uint32_t>(floor(log2(std::min(width, std::min(height, depth)))));
+        mipLevels = CMipChainBuilder::GetFullChainLevelCount(width, height, depth);
     }
     return InternalCreateImage(VK_IMAGE_TYPE_3D, format, usage, width, height, depth, mipLevels,
-                               arrayLayers, sampleCount, initialData);
+                               arrayLayers, sampleCount, initialData, initialDataFormat);
 }
 
 CImageView::Ref CDeviceVk::CreateImageView(const CImageViewDesc& desc, CImage::Ref image)
@@ -532,6 +815,140 @@ CImageView::Ref CDeviceVk::CreateImageView(const CImageViewDesc& desc, CImage::R
     return std::make_shared<CImageViewVk>(*this, desc, std::static_pointer_cast<CImageVk>(image));
 }
 
+CMemoryHeap::Ref CDeviceVk::CreateMemoryHeap(size_t size, EMemoryHeapType type,
+                                             const std::vector<CMemoryRequirements>& contents)
+{
+    uint32_t memoryTypeBits = UINT32_MAX;
+    for (const auto& reqs : contents)
+        memoryTypeBits &= reqs.MemoryTypeBits;
+    if (contents.empty() || memoryTypeBits == 0)
+        throw CRHIRuntimeError("No memory type suits all the resources meant for the heap");
+    return std::make_shared<CMemoryHeapVk>(*this, size, type, memoryTypeBits);
+}
+
+CMemoryRequirements CDeviceVk::GetImageMemoryRequirements(const CImageDesc& desc)
+{
+    EResourceState defaultState;
+    VkImageCreateInfo imageInfo = GetPlacedImageInfo(desc, defaultState);
+    VkImage handle;
+    VK(vkCreateImage(Device, &imageInfo, nullptr, &handle));
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(Device, handle, &memReqs);
+    vkDestroyImage(Device, handle, nullptr);
+    return CMemoryRequirements { static_cast<size_t>(memReqs.size),
+                                 GetPlacementAlignment(memReqs), memReqs.memoryTypeBits };
+}
+
+CMemoryRequirements CDeviceVk::GetBufferMemoryRequirements(size_t size, EBufferUsageFlags usage)
+{
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = size;
+    bufferInfo.usage = CBufferVk::GetPlacedBufferUsage(usage);
+    VkBuffer handle;
+    VK(vkCreateBuffer(Device, &bufferInfo, nullptr, &handle));
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(Device, handle, &memReqs);
+    vkDestroyBuffer(Device, handle, nullptr);
+    return CMemoryRequirements { static_cast<size_t>(memReqs.size),
+                                 GetPlacementAlignment(memReqs), memReqs.memoryTypeBits };
+}
+
+CImage::Ref CDeviceVk::CreateImageInHeap(const CImageDesc& desc, CMemoryHeap::Ref heap,
+                                         size_t offset)
+{
+    auto* heapImpl = static_cast<CMemoryHeapVk*>(heap.get());
+    EResourceState defaultState;
+    VkImageCreateInfo imageInfo = GetPlacedImageInfo(desc, defaultState);
+    VkImage handle;
+    VK(vkCreateImage(Device, &imageInfo, nullptr, &handle));
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(Device, handle, &memReqs);
+    memReqs.alignment = GetPlacementAlignment(memReqs);
+    if (!heapImpl->CanPlace(memReqs, offset))
+    {
+        vkDestroyImage(Device, handle, nullptr);
+        throw CRHIRuntimeError("Image does not fit into the heap at this offset");
+    }
+    // The heap is a dedicated allocation, so its memory can be bound at any offset without going
+    //   through the allocator
+    VK(vkBindImageMemory(Device, handle, heapImpl->GetVkMemory(),
+                         heapImpl->GetMemoryOffset(offset)));
+
+    // Whatever another resource left in that memory is of no use, first use discards it
+    return std::make_shared<CMemoryImageVk>(*this, handle, VK_NULL_HANDLE, imageInfo, desc.Usage,
+                                            defaultState, std::move(heap));
+}
+
+CBuffer::Ref CDeviceVk::CreateBufferInHeap(size_t size, EBufferUsageFlags usage,
+                                           CMemoryHeap::Ref heap, size_t offset)
+{
+    auto heapImpl = std::static_pointer_cast<CMemoryHeapVk>(heap);
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = size;
+    bufferInfo.usage = CBufferVk::GetPlacedBufferUsage(usage);
+    VkBuffer handle;
+    VK(vkCreateBuffer(Device, &bufferInfo, nullptr, &handle));
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(Device, handle, &memReqs);
+    memReqs.alignment = GetPlacementAlignment(memReqs);
+    if (!heapImpl->CanPlace(memReqs, offset))
+    {
+        vkDestroyBuffer(Device, handle, nullptr);
+        throw CRHIRuntimeError("Buffer does not fit into the heap at this offset");
+    }
+    VK(vkBindBufferMemory(Device, handle, heapImpl->GetVkMemory(),
+                          heapImpl->GetMemoryOffset(offset)));
+
+    return std::make_shared<CBufferVk>(*this, handle, size, usage, std::move(heapImpl), offset);
+}
+
+VkImageCreateInfo CDeviceVk::GetPlacedImageInfo(const CImageDesc& desc,
+                                                EResourceState& defaultState) const
+{
+    if (Any(desc.Usage, EImageUsageFlags::GenMIPMaps))
+        throw CRHIRuntimeError("Placed images have no initial data to generate MIP maps from");
+
+    VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    switch (desc.Type)
+    {
+    case EImageType::Image1D:
+        imageInfo.imageType = VK_IMAGE_TYPE_1D;
+        break;
+    case EImageType::Image2D:
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        break;
+    case EImageType::Image3D:
+        imageInfo.imageType = VK_IMAGE_TYPE_3D;
+        break;
+    }
+    imageInfo.format = static_cast<VkFormat>(desc.Format);
+    imageInfo.extent.width = desc.Width;
+    imageInfo.extent.height = desc.Height;
+    imageInfo.extent.depth = desc.Depth;
+    imageInfo.mipLevels = desc.MipLevels;
+    imageInfo.arrayLayers = desc.ArrayLayers;
+    imageInfo.samples = static_cast<VkSampleCountFlagBits>(desc.SampleCount);
+    imageInfo.tiling = Any(desc.Usage, EImageUsageFlags::Staging) ? VK_IMAGE_TILING_LINEAR
+                                                                   : VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = GetVkImageUsage(desc.Usage, defaultState);
+    if (Any(desc.Usage, EImageUsageFlags::Storage) && ConcurrentQueueFamilies.size() > 1)
+    {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(ConcurrentQueueFamilies.size());
+        imageInfo.pQueueFamilyIndices = ConcurrentQueueFamilies.data();
+    }
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    return imageInfo;
+}
+
+size_t CDeviceVk::GetPlacementAlignment(const VkMemoryRequirements& memReqs) const
+{
+    // Rounding every placement to the granularity keeps linear and optimal resources that are
+    //   neighbours in a heap from sharing a page
+    return static_cast<size_t>(
+        std::max(memReqs.alignment, Properties.limits.bufferImageGranularity));
+}
+
 CShaderModule::Ref CDeviceVk::CreateShaderModule(size_t size, const void* pCode)
 {
     return std::make_shared<CShaderModuleVk>(*this, size, pCode);
@@ -571,9 +988,17 @@ CSampler::Ref CDeviceVk::CreateSampler(const CSamplerDesc& desc)
 
 CCommandQueue::Ref CDeviceVk::CreateCommandQueue() { return DefaultRenderQueue; }
 
-CCommandQueue::Ref CDeviceVk::CreateCommandQueue(EQueueType queueType)
+CCommandQueue::Ref CDeviceVk::CreateCommandQueue(EQueueType queueType, uint32_t index)
 {
-    return std::make_shared<CCommandQueueVk>(*this, queueType, GetVkQueue(queueType));
+    if (index >= GetQueueCount(queueType))
+        throw CRHIRuntimeError("Queue index out of range");
+    // Submits to a VkQueue have to be serialized, which each CCommandQueueVk only does for itself
+    VkQueue handle = Queues[static_cast<int>(queueType)][index];
+    std::lock_guard<std::mutex> lk(CommandQueueMutex);
+    auto& queue = CommandQueues[handle];
+    if (!queue)
+        queue = std::make_shared<CCommandQueueVk>(*this, queueType, handle);
+    return queue;
 }
 
 CSwapChain::Ref CDeviceVk::CreateSwapChain(const CPresentationSurfaceDesc& info, EFormat format)
@@ -644,7 +1069,124 @@ CSwapChain::Ref CDeviceVk::CreateSwapChain(const CPresentationSurfaceDesc& info,
     return std::move(swapchain);
 }
 
-void CDeviceVk::WaitIdle() { vkDeviceWaitIdle(Device); }
+VkSemaphore CDeviceVk::CreateTimelineSemaphore()
+{
+    VkSemaphoreTypeCreateInfoKHR typeInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR };
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    semaphoreInfo.pNext = &typeInfo;
+    VkSemaphore semaphore;
+    VK(vkCreateSemaphore(Device, &semaphoreInfo, nullptr, &semaphore));
+    return semaphore;
+}
+
+uint64_t CDeviceVk::GetTimelineValue(VkSemaphore semaphore) const
+{
+    uint64_t value;
+    VK(GetSemaphoreCounterValue(Device, semaphore, &value));
+    return value;
+}
+
+bool CDeviceVk::WaitTimeline(VkSemaphore semaphore, uint64_t value, uint64_t timeoutNs) const
+{
+    VkSemaphoreWaitInfoKHR waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR };
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &semaphore;
+    waitInfo.pValues = &value;
+    VkResult result = WaitSemaphores(Device, &waitInfo, timeoutNs);
+    if (result == VK_TIMEOUT)
+        return false;
+    VK(result);
+    return true;
+}
+
+void CDeviceVk::WaitIdle()
+{
+    // The device wide wait must not overlap submissions from other threads
+    if (DefaultRenderQueue)
+        DefaultRenderQueue->WaitForSubmissionThread();
+    if (DefaultCopyQueue)
+        DefaultCopyQueue->WaitForSubmissionThread();
+    vkDeviceWaitIdle(Device);
+}
+
+CMemoryStats CDeviceVk::GetMemoryStats() const
+{
+    const VkPhysicalDeviceMemoryProperties* memProps;
+    vmaGetMemoryProperties(Allocator, &memProps);
+
+    CMemoryStats stats;
+    stats.bHasDriverBudget = false;
+#ifdef VK_EXT_memory_budget
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
+    };
+    if (bIsMemoryBudgetSupported)
+    {
+        VkPhysicalDeviceMemoryProperties2KHR props2 = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR
+        };
+        props2.pNext = &budget;
+        GetMemoryProperties2(PhysicalDevice, &props2);
+        stats.bHasDriverBudget = true;
+    }
+#endif
+    // Without a budget from the driver, usage is what VMA has allocated. Adding that up walks
+    //   every block, so it's skipped when the driver can tell.
+    VmaStats vmaStats = {};
+    if (!stats.bHasDriverBudget)
+        vmaCalculateStats(Allocator, &vmaStats);
+
+    for (uint32_t i = 0; i < memProps->memoryHeapCount; i++)
+    {
+        CMemoryHeapStats heap;
+        heap.Size = memProps->memoryHeaps[i].size;
+        heap.bIsDeviceLocal =
+            (memProps->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+#ifdef VK_EXT_memory_budget
+        if (stats.bHasDriverBudget)
+        {
+            heap.Budget = budget.heapBudget[i];
+            heap.Usage = budget.heapUsage[i];
+            stats.Heaps.push_back(heap);
+            continue;
+        }
+#endif
+        // VMA blocks, whether or not they are handed out
+        heap.Usage = vmaStats.memoryHeap[i].usedBytes + vmaStats.memoryHeap[i].unusedBytes;
+        // Leave room for other processes and driver internals
+        heap.Budget = heap.Size / 10 * 8;
+        stats.Heaps.push_back(heap);
+    }
+
+    auto tracked = [this](EMemoryCategory category) {
+        return static_cast<size_t>(
+            TrackedMemory[static_cast<int>(category)].load(std::memory_order_relaxed));
+    };
+    stats.Images = tracked(EMemoryCategory::Images);
+    stats.Buffers = tracked(EMemoryCategory::Buffers);
+    stats.Staging = tracked(EMemoryCategory::Staging);
+    stats.ConstantRing = tracked(EMemoryCategory::ConstantRing);
+    CRingBufferStats ringStats = HugeConstantBuffer->GetStats();
+    stats.ConstantRingLastFrameUsage = ringStats.LastFrameUsage;
+    stats.ConstantRingHighWaterMark = ringStats.HighWaterMark;
+    stats.ConstantRingCount = ringStats.RingCount;
+    stats.MemoryHeaps = tracked(EMemoryCategory::Heaps);
+    stats.DescriptorPools = tracked(EMemoryCategory::DescriptorPools);
+    return stats;
+}
+
+void CDeviceVk::TrackAllocation(EMemoryCategory category, VmaAllocation allocation,
+                                bool isAllocated)
+{
+    if (!allocation)
+        return;
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(Allocator, allocation, &info);
+    int64_t size = static_cast<int64_t>(info.size);
+    TrackMemory(category, isAllocated ? size : -size);
+}
 
 VkInstance CDeviceVk::GetVkInstance() const { return Instance; }
 
@@ -4,9 +4,13 @@
 #include "BufferVk.h"
 #include "CommandContextVk.h"
 #include "CommandQueueVk.h"
+#include "DeferredDeleterVk.h"
+#include "DefragmenterVk.h"
 #include "DescriptorSet.h"
 #include "VkCommon.h"
 
+#include <atomic>
+#include <map>
 #include <mutex>
 #include <queue>
 
@@ -24,23 +28,40 @@ public:
     CImage::Ref InternalCreateImage(VkImageType type, EFormat format, EImageUsageFlags usage,
                                     uint32_t width, uint32_t height, uint32_t depth,
                                     uint32_t mipLevels, uint32_t arrayLayers, uint32_t sampleCount,
-                                    const void* initialData);
+                                    const void* initialData, EFormat initialDataFormat);
 
     // Resources and resource views
     CBuffer::Ref CreateBuffer(size_t size, EBufferUsageFlags usage,
                               const void* initialData = nullptr);
     CImage::Ref CreateImage1D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t mipLevels = 1, uint32_t arrayLayers = 1,
-                              uint32_t sampleCount = 1, const void* initialData = nullptr);
+                              uint32_t sampleCount = 1, const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImage::Ref CreateImage2D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t height, uint32_t mipLevels = 1, uint32_t arrayLayers = 1,
-                              uint32_t sampleCount = 1, const void* initialData = nullptr);
+                              uint32_t sampleCount = 1, const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImage::Ref CreateImage3D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t height, uint32_t depth, uint32_t mipLevels = 1,
                               uint32_t arrayLayers = 1, uint32_t sampleCount = 1,
-                              const void* initialData = nullptr);
+                              const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImageView::Ref CreateImageView(const CImageViewDesc& desc, CImage::Ref image);
 
+    CBuffer::Ref ImportHostBuffer(const void* pointer, size_t size, CFence::Ref& releaseFence);
+    size_t GetHostImportAlignment() const { return HostImportAlignment; }
+    // Memory types host memory at pointer can be imported as
+    uint32_t GetHostPointerMemoryTypeBits(const void* pointer) const;
+
+    // Placed resources
+    CMemoryHeap::Ref CreateMemoryHeap(size_t size, EMemoryHeapType type,
+                                      const std::vector<CMemoryRequirements>& contents);
+    CMemoryRequirements GetImageMemoryRequirements(const CImageDesc& desc);
+    CMemoryRequirements GetBufferMemoryRequirements(size_t size, EBufferUsageFlags usage);
+    CImage::Ref CreateImageInHeap(const CImageDesc& desc, CMemoryHeap::Ref heap, size_t offset);
+    CBuffer::Ref CreateBufferInHeap(size_t size, EBufferUsageFlags usage, CMemoryHeap::Ref heap,
+                                    size_t offset);
+
     // Shader and resource binding
     CShaderModule::Ref CreateShaderModule(size_t size, const void* pCode);
     CDescriptorSetLayout::Ref
@@ -56,10 +77,35 @@ public:
 
     // Command submission
     CCommandQueue::Ref CreateCommandQueue();
-    CCommandQueue::Ref CreateCommandQueue(EQueueType queueType);
+    // index picks one of the GetQueueCount(queueType) hardware queues. Types that fall back to
+    //   the same family share queues, see IsComputeQueueSeparate/IsTransferQueueSeparate.
+    CCommandQueue::Ref CreateCommandQueue(EQueueType queueType, uint32_t index = 0);
+    uint32_t GetQueueCount(EQueueType t) const
+    {
+        return static_cast<uint32_t>(Queues[static_cast<int>(t)].size());
+    }
 
     CSwapChain::Ref CreateSwapChain(const CPresentationSurfaceDesc& info, EFormat format);
     void WaitIdle();
+    CMemoryStats GetMemoryStats() const;
+    void SetDefragmentationBudget(float milliseconds) { Defragmenter->SetBudget(milliseconds); }
+
+    // Bookkeeping for the categories in CMemoryStats
+    enum class EMemoryCategory
+    {
+        Images,
+        Buffers,
+        Staging,
+        ConstantRing,
+        Heaps,
+        DescriptorPools,
+        Count
+    };
+    void TrackMemory(EMemoryCategory category, int64_t bytes)
+    {
+        TrackedMemory[static_cast<int>(category)].fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void TrackAllocation(EMemoryCategory category, VmaAllocation allocation, bool isAllocated);
 
     // Vulkan specific getters
     VkInstance GetVkInstance() const;
@@ -82,30 +128,68 @@ public:
     VkQueue GetVkQueue(EQueueType t) const { return Queues[static_cast<int>(t)][0]; }
     VmaAllocator GetAllocator() const { return Allocator; }
 
-    CPersistentMappedRingBuffer* GetHugeConstantBuffer() const { return HugeConstantBuffer.get(); }
+    CGrowableRingBuffer* GetHugeConstantBuffer() const { return HugeConstantBuffer.get(); }
+    // Shared by all pooled buffers with the same usage and memory type
+    CBufferPoolVk& GetBufferPool(VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
     VkPipelineCache GetPipelineCache() const { return PipelineCache; }
+    CDefragmenterVk& GetDefragmenter() const { return *Defragmenter; }
+    // Prefer this over AddPostFrameCleanup for plain handles, it does not lock or allocate
+    CDeferredDeleterVk& GetDeferredDeleter() const { return *DeferredDeleter; }
 
     CCommandQueueVk::Ref GetDefaultRenderQueue() const { return DefaultRenderQueue; }
     CCommandQueueVk::Ref GetDefaultCopyQueue() const { return DefaultCopyQueue; }
 
     void AddPostFrameCleanup(std::function<void(CDeviceVk&)> callback);
 
+    // Timeline semaphores, every queue signals one as it submits
+    VkSemaphore CreateTimelineSemaphore();
+    uint64_t GetTimelineValue(VkSemaphore semaphore) const;
+    // Returns false if the value is still not reached after the timeout
+    bool WaitTimeline(VkSemaphore semaphore, uint64_t value, uint64_t timeoutNs = UINT64_MAX) const;
+
 private:
+    VkImageCreateInfo GetPlacedImageInfo(const CImageDesc& desc,
+                                         EResourceState& defaultState) const;
+    size_t GetPlacementAlignment(const VkMemoryRequirements& memReqs) const;
+
     VkDevice Device;
 
     // NOTE: according to some AMD doc https://gpuopen.com/concurrent-execution-asynchronous-queues/
-    //   it's best to stick to one queue per family for current GPUs
+    //   it's best to stick to one queue per family for current GPUs, more are there for those
+    //   who want to try
+    static constexpr uint32_t MaxQueuesPerFamily = 4;
     VkPhysicalDevice PhysicalDevice;
     VkPhysicalDeviceProperties Properties;
+    bool bIsMemoryBudgetSupported = false;
+    size_t HostImportAlignment = 0;
+#ifdef VK_EXT_external_memory_host
+    PFN_vkGetMemoryHostPointerPropertiesEXT GetMemoryHostPointerProperties = nullptr;
+#endif
+#ifdef VK_EXT_memory_budget
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR GetMemoryProperties2 = nullptr;
+#endif
+    PFN_vkWaitSemaphoresKHR WaitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR GetSemaphoreCounterValue = nullptr;
+    std::atomic<int64_t> TrackedMemory[static_cast<int>(EMemoryCategory::Count)] = {};
 
     // Global objects
     uint32_t QueueFamilies[static_cast<int>(EQueueType::Count)];
     std::vector<VkQueue> Queues[static_cast<int>(EQueueType::Count)];
+    // Distinct families of the queues above, for resources with concurrent sharing
+    std::vector<uint32_t> ConcurrentQueueFamilies;
     VmaAllocator Allocator;
-    std::unique_ptr<CPersistentMappedRingBuffer> HugeConstantBuffer;
+    std::unique_ptr<CGrowableRingBuffer> HugeConstantBuffer;
+    std::unique_ptr<CDefragmenterVk> Defragmenter;
+    std::unique_ptr<CDeferredDeleterVk> DeferredDeleter;
+    std::mutex BufferPoolMutex;
+    std::map<std::pair<VkBufferUsageFlags, VmaMemoryUsage>, std::unique_ptr<CBufferPoolVk>>
+        BufferPools;
     VkPipelineCache PipelineCache;
     CCommandQueueVk::Ref DefaultRenderQueue;
     CCommandQueueVk::Ref DefaultCopyQueue;
+    // One per VkQueue, whatever type it was asked for as
+    std::mutex CommandQueueMutex;
+    std::map<VkQueue, CCommandQueueVk::Ref> CommandQueues;
 
     friend class CCommandQueueVk; // Allow queues to grab cleanup functors
     std::mutex DeviceMutex;
@@ -0,0 +1,34 @@
+#include "FenceVk.h"
+#include <chrono>
+
+namespace RHI
+{
+
+bool CFenceVk::IsSignaled() const
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    return bIsSignaled;
+}
+
+bool CFenceVk::Wait(uint32_t timeoutMs) const
+{
+    std::unique_lock<std::mutex> lk(Mutex);
+    if (timeoutMs == UINT32_MAX)
+    {
+        Signaled.wait(lk, [this]() { return bIsSignaled; });
+        return true;
+    }
+    return Signaled.wait_for(lk, std::chrono::milliseconds(timeoutMs),
+                             [this]() { return bIsSignaled; });
+}
+
+void CFenceVk::Signal()
+{
+    {
+        std::lock_guard<std::mutex> lk(Mutex);
+        bIsSignaled = true;
+    }
+    Signaled.notify_all();
+}
+
+} /* namespace RHI */
@@ -0,0 +1,29 @@
+#pragma once
+#include "CommandQueue.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace RHI
+{
+
+// Signaled from the CPU, usually by a post frame cleanup once the frame it was attached to has
+//   finished executing
+class CFenceVk : public CFence
+{
+public:
+    typedef std::shared_ptr<CFenceVk> Ref;
+
+    CFenceVk() = default;
+
+    bool IsSignaled() const override;
+    bool Wait(uint32_t timeoutMs) const override;
+
+    void Signal();
+
+private:
+    mutable std::mutex Mutex;
+    mutable std::condition_variable Signaled;
+    bool bIsSignaled = false;
+};
+
+} /* namespace RHI */
@@ -85,6 +85,7 @@ void CRHIImGuiBackend::NewFrame()
         cmdList->Enqueue();
         auto ctx = std::static_pointer_cast<CCommandContextVk>(cmdList->CreateCopyContext());
         ImGui_ImplVulkan_CreateFontsTexture(ctx->GetCmdBuffer());
+        ctx->InvalidateState();
         ctx->FinishRecording();
         cmdList->Commit();
         DeviceImpl->GetDefaultRenderQueue()->Finish();
@@ -101,6 +102,8 @@ void CRHIImGuiBackend::RenderDrawData(ImDrawData* draw_data, IRenderContext& con
     auto& contextImpl = static_cast<CCommandContextVk&>(context);
     auto cmdBuffer = contextImpl.GetCmdBuffer();
     ImGui_ImplVulkan_RenderDrawData(draw_data, cmdBuffer);
+    // ImGui bound a pipeline, buffers, viewport and scissor of its own
+    contextImpl.InvalidateState();
 }
 
 }
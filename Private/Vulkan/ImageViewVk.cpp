@@ -1,6 +1,7 @@
 #include "ImageViewVk.h"
 #include "DeviceVk.h"
 #include "SwapChainVk.h"
+#include "TexelConversion.h"
 #include "VkHelpers.h"
 
 namespace RHI
@@ -82,6 +83,11 @@ CImageViewVk::CImageViewVk(CDeviceVk& p, const CImageViewDesc& desc, CImageVk::R
     ViewCreateInfo.image = imgVk->GetVkImage();
     ViewCreateInfo.viewType = Convert(desc.Type);
     ViewCreateInfo.format = static_cast<VkFormat>(desc.Format);
+    // The device may have widened a 3 channel image it can't sample, see CreateImage2D. A view in
+    //   the format asked for would need VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT, so it gets the
+    //   image's format instead.
+    if (GetExpandedTexelFormat(desc.Format) == static_cast<EFormat>(imgVk->GetVkFormat()))
+        ViewCreateInfo.format = imgVk->GetVkFormat();
     Convert(ViewCreateInfo.subresourceRange, desc.Range);
     ViewCreateInfo.subresourceRange.aspectMask = GetImageAspectFlags(ViewCreateInfo.format);
     // Only if aspect flags are set and we are dealing with a DepthStencil format
@@ -19,12 +19,37 @@ void CImageVk::InitializeAccess(VkAccessFlags access, VkPipelineStageFlags stage
     LastAccess.emplace(entireImage, record);
 }
 
-void CImageVk::TransitionAccess(VkCommandBuffer cmdBuffer, const CImageSubresourceRange& range,
+void CImageVk::SetPendingAcquire(CQueueOwnershipAcquire acquire)
+{
+    std::lock_guard<std::mutex> lk(AcquireMutex);
+    PendingAcquire = std::move(acquire);
+    bHasPendingAcquire.store(true, std::memory_order_release);
+}
+
+bool CImageVk::TakePendingAcquire(uint32_t queueFamily, CQueueOwnershipAcquire& acquire)
+{
+    if (!HasPendingAcquire())
+        return false;
+
+    std::lock_guard<std::mutex> lk(AcquireMutex);
+    if (!bHasPendingAcquire.load(std::memory_order_relaxed))
+        return false;
+    if (PendingAcquire.DstQueueFamily != queueFamily)
+        throw CRHIRuntimeError("Images uploaded on the copy queue have to be used on the render "
+                               "queue family first");
+    acquire = std::move(PendingAcquire);
+    PendingAcquire = {};
+    bHasPendingAcquire.store(false, std::memory_order_release);
+    return true;
+}
+
+bool CImageVk::TransitionAccess(VkCommandBuffer cmdBuffer, const CImageSubresourceRange& range,
                                 const CAccessRecord& accessRecord)
 {
     if (LastAccess.empty())
         throw "CImageVk Access tracking is not initialized";
 
+    bool recorded = false;
     for (const auto& pair : LastAccess)
     {
         uint32_t top, bottom, left, right;
@@ -35,10 +60,11 @@ void CImageVk::TransitionAccess(VkCommandBuffer cmdBuffer, const CImageSubresour
             overlapRange.LevelCount = bottom - top + 1;
             overlapRange.BaseArrayLayer = left;
             overlapRange.LayerCount = right - left + 1;
-            CAccessTracker::InsertImageBarrier(cmdBuffer, this, overlapRange, pair.second,
-                                               accessRecord);
+            recorded |= CAccessTracker::InsertImageBarrier(cmdBuffer, this, overlapRange,
+                                                           pair.second, accessRecord);
         }
     }
+    return recorded;
 }
 
 void CImageVk::UpdateAccess(const CImageSubresourceRange& range, const CAccessRecord& accessRecord)
@@ -203,23 +229,38 @@ VkFormat CSwapChainImageVk::GetVkFormat() const
 
 CMemoryImageVk::CMemoryImageVk(CDeviceVk& p, VkImage image, VmaAllocation alloc,
                                const VkImageCreateInfo& createInfo, EImageUsageFlags usage,
-                               EResourceState defaultState)
+                               EResourceState defaultState, CMemoryHeap::Ref heap)
     : Parent(p)
     , Image(image)
     , ImageAlloc(alloc)
+    , Heap(std::move(heap))
     , CreateInfo(createInfo)
     , UsageFlags(usage)
     , DefaultState(defaultState)
 {
     InitializeAccess(0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, CreateInfo.initialLayout);
+    Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Images, ImageAlloc, true);
 }
 
 CMemoryImageVk::~CMemoryImageVk()
 {
+    // Never used after its upload, the semaphore can only go once the copy queue is done with it
+    if (bHasPendingAcquire)
+    {
+        VkSemaphore semaphore = PendingAcquire.Semaphore;
+        if (auto copyQueue = Parent.GetDefaultCopyQueue())
+            copyQueue->AddPostFrameCleanup([semaphore](CDeviceVk& p) {
+                vkDestroySemaphore(p.GetVkDevice(), semaphore, nullptr);
+            });
+        else
+            vkDestroySemaphore(Parent.GetVkDevice(), semaphore, nullptr);
+    }
+
     if (!ImageAlloc)
-        vkDestroyImage(Parent.GetVkDevice(), Image, nullptr);
+        Parent.GetDeferredDeleter().DestroyImage(Image);
     else
-        vmaDestroyImage(Parent.GetAllocator(), Image, ImageAlloc);
+        Parent.GetDeferredDeleter().DestroyImage(
+            Image, ImageAlloc, static_cast<int>(CDeviceVk::EMemoryCategory::Images));
 }
 
 EImageUsageFlags CMemoryImageVk::GetUsageFlags() const { return UsageFlags; }
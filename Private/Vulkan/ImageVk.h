@@ -4,11 +4,25 @@
 #include "Resources.h"
 #include "SwapChain.h"
 #include "VkCommon.h"
+#include <atomic>
+#include <mutex>
 #include <queue>
 
 namespace RHI
 {
 
+// An image filled on another queue family that still has to be acquired by DstQueueFamily. The
+//   matching release barrier has already been recorded on the source queue, which signals
+//   Semaphore when done.
+struct CQueueOwnershipAcquire
+{
+    VkSemaphore Semaphore = VK_NULL_HANDLE;
+    uint32_t SrcQueueFamily;
+    uint32_t DstQueueFamily;
+    VkImageLayout OldLayout;
+    VkImageLayout NewLayout;
+};
+
 class CImageVk : public CImage
 {
 public:
@@ -22,7 +36,8 @@ public:
     // Access tracking for barrier deduction
     void InitializeAccess(VkAccessFlags access, VkPipelineStageFlags stages, VkImageLayout layout);
     /// Transition a subset of this image to new access record. Inserts the barriers into cmdBuffer
-    void TransitionAccess(VkCommandBuffer cmdBuffer, const CImageSubresourceRange& range,
+    ///   and returns whether there were any
+    bool TransitionAccess(VkCommandBuffer cmdBuffer, const CImageSubresourceRange& range,
                           const CAccessRecord& accessRecord);
     /// Doesn't do any transition, but updates the LastAccess map
     void UpdateAccess(const CImageSubresourceRange& range, const CAccessRecord& accessRecord);
@@ -30,9 +45,19 @@ public:
     bool IsTrackingDisabled() const { return bIsTrackingDisabled; }
     void SetTrackingDisabled(bool value) { bIsTrackingDisabled = value; }
 
+    // Queue family ownership transfer, taken by the first command list submitted on the
+    //   destination family that uses this image. Using it on any other family first throws.
+    bool HasPendingAcquire() const { return bHasPendingAcquire.load(std::memory_order_acquire); }
+    void SetPendingAcquire(CQueueOwnershipAcquire acquire);
+    bool TakePendingAcquire(uint32_t queueFamily, CQueueOwnershipAcquire& acquire);
+
 protected:
     CImageVk() = default;
 
+    std::mutex AcquireMutex;
+    CQueueOwnershipAcquire PendingAcquire;
+    std::atomic<bool> bHasPendingAcquire { false };
+
 private:
     std::map<CImageSubresourceRange, CAccessRecord> LastAccess;
     bool bIsTrackingDisabled = false;
@@ -68,9 +93,10 @@ private:
 class CMemoryImageVk : public CImageVk
 {
 public:
+    // Images placed in a heap have no allocation of their own and keep the heap alive instead
     CMemoryImageVk(CDeviceVk& p, VkImage image, VmaAllocation alloc,
                    const VkImageCreateInfo& createInfo, EImageUsageFlags usage,
-                   EResourceState defaultState);
+                   EResourceState defaultState, CMemoryHeap::Ref heap = nullptr);
     ~CMemoryImageVk();
 
     // CImage interface
@@ -91,12 +117,14 @@ public:
 
     VkImageCreateInfo GetCreateInfo() const;
     EResourceState GetDefaultState() const;
+    VmaAllocation GetAllocation() const { return ImageAlloc; }
 
 private:
     CDeviceVk& Parent;
 
     VkImage Image = VK_NULL_HANDLE;
     VmaAllocation ImageAlloc = VK_NULL_HANDLE;
+    CMemoryHeap::Ref Heap;
 
     VkImageCreateInfo CreateInfo;
     EImageUsageFlags UsageFlags {};
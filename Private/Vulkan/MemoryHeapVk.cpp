@@ -0,0 +1,63 @@
+#include "MemoryHeapVk.h"
+#include "DeviceVk.h"
+
+namespace RHI
+{
+
+CMemoryHeapVk::CMemoryHeapVk(CDeviceVk& p, size_t size, EMemoryHeapType type,
+                             uint32_t memoryTypeBits)
+    : Parent(p)
+    , Size(size)
+    , Type(type)
+{
+    VkMemoryRequirements memReqs;
+    memReqs.size = size;
+    memReqs.alignment = Parent.GetVkLimits().bufferImageGranularity;
+    memReqs.memoryTypeBits = memoryTypeBits;
+
+    VmaAllocationCreateInfo allocCreateInfo = {};
+    allocCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    switch (type)
+    {
+    case EMemoryHeapType::DeviceLocal:
+        allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        break;
+    case EMemoryHeapType::Upload:
+        allocCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+        allocCreateInfo.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        break;
+    case EMemoryHeapType::Readback:
+        allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+        allocCreateInfo.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        break;
+    }
+
+    VmaAllocationInfo info;
+    VkResult result =
+        vmaAllocateMemory(Parent.GetAllocator(), &memReqs, &allocCreateInfo, &Allocation, &info);
+    if (result != VK_SUCCESS)
+        throw CRHIRuntimeError("Could not allocate memory heap");
+    Memory = info.deviceMemory;
+    MemoryOffset = info.offset;
+    MemoryTypeIndex = info.memoryType;
+    MappedData = info.pMappedData;
+    Parent.TrackAllocation(CDeviceVk::EMemoryCategory::Heaps, Allocation, true);
+}
+
+CMemoryHeapVk::~CMemoryHeapVk()
+{
+    // Whatever was placed in here last may still be in use by frames in flight
+    Parent.GetDeferredDeleter().FreeAllocation(
+        Allocation, static_cast<int>(CDeviceVk::EMemoryCategory::Heaps));
+}
+
+bool CMemoryHeapVk::CanPlace(const VkMemoryRequirements& memReqs, size_t offset) const
+{
+    if (!(memReqs.memoryTypeBits & (1u << MemoryTypeIndex)))
+        return false;
+    if (GetMemoryOffset(offset) % memReqs.alignment != 0)
+        return false;
+    return offset <= Size && memReqs.size <= Size - offset;
+}
+
+} /* namespace RHI */
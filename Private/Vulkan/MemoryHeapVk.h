@@ -0,0 +1,43 @@
+#pragma once
+#include "Resources.h"
+#include "VkCommon.h"
+
+namespace RHI
+{
+
+// One dedicated allocation, resources are bound to it directly at the offsets they are placed at
+class CMemoryHeapVk : public CMemoryHeap
+{
+public:
+    typedef std::shared_ptr<CMemoryHeapVk> Ref;
+
+    // memoryTypeBits is what all the resources meant for the heap accept
+    CMemoryHeapVk(CDeviceVk& p, size_t size, EMemoryHeapType type, uint32_t memoryTypeBits);
+    ~CMemoryHeapVk() override;
+
+    size_t GetSize() const override { return Size; }
+    EMemoryHeapType GetType() const override { return Type; }
+
+    // Whether a resource with these requirements may be bound at offset
+    bool CanPlace(const VkMemoryRequirements& memReqs, size_t offset) const;
+
+    VkDeviceMemory GetVkMemory() const { return Memory; }
+    // Offsets into the heap are relative to where the allocation starts in its device memory
+    VkDeviceSize GetMemoryOffset(size_t offset) const { return MemoryOffset + offset; }
+    VmaAllocation GetAllocation() const { return Allocation; }
+    // Upload and readback heaps are persistently mapped, nullptr otherwise
+    void* GetMappedData() const { return MappedData; }
+
+private:
+    CDeviceVk& Parent;
+    size_t Size;
+    EMemoryHeapType Type;
+
+    VmaAllocation Allocation = VK_NULL_HANDLE;
+    VkDeviceMemory Memory = VK_NULL_HANDLE;
+    VkDeviceSize MemoryOffset = 0;
+    uint32_t MemoryTypeIndex = 0;
+    void* MappedData = nullptr;
+};
+
+} /* namespace RHI */
@@ -0,0 +1,52 @@
+#include "RenderBundleVk.h"
+#include "CommandContextVk.h"
+#include "CommandQueueVk.h"
+#include "DeviceVk.h"
+
+namespace RHI
+{
+
+CRenderBundleVk::CRenderBundleVk(CCommandQueueVk& queue, CRenderPass::Ref renderPass,
+                                 uint32_t subpass)
+    : Queue(queue)
+    , RenderPass(std::move(renderPass))
+    , Subpass(subpass)
+{
+}
+
+IRenderContext::Ref CRenderBundleVk::Record()
+{
+    // Re-recording while lists still execute the old command buffer is fine, it lives on in them
+    uint64_t moveSerial = Queue.GetDevice().GetDefragmenter().GetMoveSerial();
+    auto pool = std::make_shared<CCommandPoolVk>(Queue.GetDevice(), Queue.GetType());
+    auto recording = std::make_shared<CBundleRecordingVk>();
+    recording->CmdBuffer = pool->AllocateCommandBuffer(true);
+    // Lists in flight at the same time may all execute it
+    recording->CmdBuffer->BeginRecording(RenderPass, Subpass,
+                                         VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+    return std::make_shared<CCommandContextVk>(shared_from_this(), std::move(recording),
+                                               moveSerial);
+}
+
+bool CRenderBundleVk::NeedsRecording() const
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    return !Recording || MoveSerial != Queue.GetDevice().GetDefragmenter().GetMoveSerial();
+}
+
+CBundleRecordingVk::Ref CRenderBundleVk::GetRecording() const
+{
+    if (NeedsRecording())
+        throw CRHIRuntimeError("Render bundle has to be recorded before it can be executed");
+    std::lock_guard<std::mutex> lk(Mutex);
+    return Recording;
+}
+
+void CRenderBundleVk::FinishRecording(CBundleRecordingVk::Ref recording, uint64_t moveSerial)
+{
+    std::lock_guard<std::mutex> lk(Mutex);
+    Recording = std::move(recording);
+    MoveSerial = moveSerial;
+}
+
+} /* namespace RHI */
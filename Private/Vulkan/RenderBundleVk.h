@@ -0,0 +1,50 @@
+#pragma once
+#include "AccessTracker.h"
+#include "CommandBufferVk.h"
+#include "RenderContext.h"
+#include "VkCommon.h"
+#include <mutex>
+
+namespace RHI
+{
+
+// One recording of a bundle in a command pool of its own, which goes away with the last command
+//   list that executes it
+struct CBundleRecordingVk
+{
+    typedef std::shared_ptr<CBundleRecordingVk> Ref;
+
+    std::unique_ptr<CCommandBufferVk> CmdBuffer;
+    CAccessTracker AccessTracker;
+};
+
+class CRenderBundleVk : public IRenderBundle, public std::enable_shared_from_this<CRenderBundleVk>
+{
+public:
+    typedef std::shared_ptr<CRenderBundleVk> Ref;
+
+    CRenderBundleVk(CCommandQueueVk& queue, CRenderPass::Ref renderPass, uint32_t subpass);
+
+    IRenderContext::Ref Record() override;
+    bool NeedsRecording() const override;
+
+    CRenderPass::Ref GetRenderPass() const { return RenderPass; }
+    uint32_t GetSubpass() const { return Subpass; }
+    // The last finished recording, throws if it needs recording
+    CBundleRecordingVk::Ref GetRecording() const;
+
+    // Called by the context that recorded it
+    void FinishRecording(CBundleRecordingVk::Ref recording, uint64_t moveSerial);
+
+private:
+    CCommandQueueVk& Queue;
+    CRenderPass::Ref RenderPass;
+    uint32_t Subpass;
+
+    mutable std::mutex Mutex;
+    CBundleRecordingVk::Ref Recording;
+    // Defragmenter move serial as recording started
+    uint64_t MoveSerial = 0;
+};
+
+} /* namespace RHI */
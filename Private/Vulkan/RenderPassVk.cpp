@@ -20,7 +20,7 @@ CRenderPassVk::CRenderPassVk(CDeviceVk& p, const CRenderPassDesc& desc)
         VkAttachmentDescription& r = AttachmentsVk.back();
         r.flags = 0;
         r.format = viewImpl->GetFormat();
-        r.samples = VK_SAMPLE_COUNT_1_BIT; // TODO: FIXME
+        r.samples = static_cast<VkSampleCountFlagBits>(viewImpl->GetImage()->GetSampleCount());
         r.loadOp = static_cast<VkAttachmentLoadOp>(attachment.LoadOp);
         r.storeOp = static_cast<VkAttachmentStoreOp>(attachment.StoreOp);
         r.stencilLoadOp = static_cast<VkAttachmentLoadOp>(attachment.StencilLoadOp);
@@ -12,9 +12,10 @@ void CResourceBindings::Reset()
 }
 
 void CResourceBindings::BindBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range,
-                                   uint32_t set, uint32_t binding, uint32_t arrayElement)
+                                   uint32_t set, uint32_t binding, uint32_t arrayElement,
+                                   CBufferVk* pBuffer)
 {
-    Bind(set, binding, arrayElement, BindingInfo { buffer, offset, range });
+    Bind(set, binding, arrayElement, BindingInfo { buffer, offset, range, pBuffer });
 }
 
 void CResourceBindings::BindImageView(CImageViewVk* pImageView, VkAccessFlags access,
@@ -30,6 +31,29 @@ void CResourceBindings::BindSampler(VkSampler sampler, uint32_t set, uint32_t bi
     Bind(set, binding, arrayElement, BindingInfo { sampler });
 }
 
+bool CResourceBindings::PatchChangedBuffers()
+{
+    bool patched = false;
+    for (auto& setIter : BindingsBySet)
+    {
+        for (auto& bindingIter : setIter.second.Bindings)
+        {
+            for (auto& arrayIter : bindingIter.second)
+            {
+                auto& info = arrayIter.second;
+                if (info.Buffer && info.Buffer->GetHandle() != info.BufferHandle)
+                {
+                    info.BufferHandle = info.Buffer->GetHandle();
+                    setIter.second.bDirty = true;
+                    patched = true;
+                }
+            }
+        }
+    }
+    bDirty |= patched;
+    return patched;
+}
+
 void CResourceBindings::Bind(uint32_t set, uint32_t binding, uint32_t arrayElement,
                              const BindingInfo& info)
 {
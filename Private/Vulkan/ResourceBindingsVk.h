@@ -34,6 +34,8 @@ struct BindingInfo
     VkDeviceSize Offset;
     VkDeviceSize Range;
     VkBuffer BufferHandle = VK_NULL_HANDLE;
+    // Set if the buffer may get a new handle, from the defragmenter or a streaming Map
+    CBufferVk* Buffer = nullptr;
 
     CImageViewVk* ImageView = nullptr;
     VkAccessFlags ImageAccess;
@@ -44,8 +46,9 @@ struct BindingInfo
 
     BindingInfo() = default;
 
-    BindingInfo(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+    BindingInfo(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, CBufferVk* pBuffer)
         : BufferHandle(buffer)
+        , Buffer(pBuffer)
         , Offset(offset)
         , Range(range)
     {
@@ -88,11 +91,14 @@ public:
     void Reset();
 
     void BindBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t set,
-                    uint32_t binding, uint32_t arrayElement);
+                    uint32_t binding, uint32_t arrayElement, CBufferVk* pBuffer = nullptr);
     void BindImageView(CImageViewVk* pImageView, VkAccessFlags access, VkPipelineStageFlags stages,
                        VkImageLayout layout, uint32_t set, uint32_t binding, uint32_t arrayElement);
     void BindSampler(VkSampler sampler, uint32_t set, uint32_t binding, uint32_t arrayElement);
 
+    // Picks up the new handles of buffers and marks what changed as dirty
+    bool PatchChangedBuffers();
+
 private:
     void Bind(uint32_t set, uint32_t binding, uint32_t arrayElement, const BindingInfo& info);
 
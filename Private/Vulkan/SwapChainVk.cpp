@@ -175,13 +175,15 @@ CSwapChainVk::CSwapChainVk(CDeviceVk& device, const CPhysicalDeviceSwapChainCaps
 
 CSwapChainVk::~CSwapChainVk()
 {
+    // A present may still be waiting on the submission thread
+    Parent.GetDefaultRenderQueue()->WaitForSubmissionThread();
     ReleaseSwapChainAndImages();
     vkDestroySurfaceKHR(Parent.GetVkInstance(), CreateInfo.surface, nullptr);
 }
 
 void CSwapChainVk::Resize(uint32_t width, uint32_t height)
 {
-    vkDeviceWaitIdle(Parent.GetVkDevice());
+    Parent.WaitIdle();
 
     CreateInfo.imageExtent.width = width;
     CreateInfo.imageExtent.height = height;
@@ -238,24 +240,25 @@ bool CSwapChainVk::AcquireNextImage()
 
 void CSwapChainVk::Present(const CSwapChainPresentInfo& info)
 {
-    Parent.GetDefaultRenderQueue()->SubmitFrame();
-
     auto& imageInfo = AcquiredImages.front();
     VkSemaphore waitSemaphore = imageInfo.second.RenderSemaphore;
-
-    VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &waitSemaphore;
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &SwapChainHandle;
-    presentInfo.pImageIndices = &imageInfo.first;
-    presentInfo.pResults = nullptr;
-    vkQueuePresentKHR(Parent.GetVkQueue(EQueueType::Render), &presentInfo);
+    uint32_t imageIndex = imageInfo.first;
+    VkSwapchainKHR swapChain = SwapChainHandle;
+
+    // Presenting has to follow the frame's submission, which may happen on another thread
+    Parent.GetDefaultRenderQueue()->SubmitFrame([=](VkQueue queue) {
+        VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = &waitSemaphore;
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = &swapChain;
+        presentInfo.pImageIndices = &imageIndex;
+        presentInfo.pResults = nullptr;
+        vkQueuePresentKHR(queue, &presentInfo);
+    });
 
     // Waiter cleans up the semaphore
-    Parent.AddPostFrameCleanup([waitSemaphore](CDeviceVk& p) {
-        vkDestroySemaphore(p.GetVkDevice(), waitSemaphore, nullptr);
-    });
+    Parent.GetDeferredDeleter().DestroySemaphore(waitSemaphore);
     AcquiredImages.pop();
 
     std::static_pointer_cast<CSwapChainImageVk>(ProxyImage)
@@ -17,6 +17,25 @@ enum class EQueueType : uint32_t
     Count
 };
 
+// Signaled once the GPU is done with whatever the fence was handed out for. Completion is noticed
+//   as frames are submitted, so a fence never gets signaled while no frames are.
+class CFence : public tc::FNonCopyable
+{
+public:
+    typedef std::shared_ptr<CFence> Ref;
+
+    virtual ~CFence() = default;
+
+    virtual bool IsSignaled() const = 0;
+    // Returns false if the fence is still unsignaled after timeoutMs milliseconds
+    virtual bool Wait(uint32_t timeoutMs = UINT32_MAX) const = 0;
+
+protected:
+    CFence() = default;
+};
+
+class CCommandQueue;
+
 class CCommandList : public std::enable_shared_from_this<CCommandList>
 {
 public:
@@ -26,6 +45,8 @@ public:
 
     virtual void Enqueue() = 0;
     virtual void Commit() = 0;
+    // The list starts executing only once queue has reached point, see CCommandQueue::Flush
+    virtual void WaitForQueue(CCommandQueue& queue, uint64_t point) = 0;
 
     virtual ICopyContext::Ref CreateCopyContext() = 0;
     virtual IComputeContext::Ref CreateComputeContext() = 0;
@@ -41,9 +62,34 @@ public:
     virtual ~CCommandQueue() = default;
 
     virtual CCommandList::Ref CreateCommandList() = 0;
+    // Bundles can be executed in command lists of this queue, see IRenderBundle
+    virtual IRenderBundle::Ref CreateRenderBundle(CRenderPass::Ref renderPass,
+                                                  uint32_t subpass) = 0;
 
-    virtual void Flush() = 0;
+    // Submits the committed lists. Returns the point on this queue's timeline that is reached once
+    //   they and everything submitted before have finished executing. Points only ever grow.
+    virtual uint64_t Flush() = 0;
+    // Flush and wait for the returned point
     virtual void Finish() = 0;
+    virtual uint64_t GetCompletedPoint() const = 0;
+    // Returns false if the point is still not reached after timeoutMs milliseconds
+    virtual bool WaitForPoint(uint64_t point, uint32_t timeoutMs = UINT32_MAX) const = 0;
+
+    // Hands committed lists to a thread of their own that submits them in Enqueue order, so that
+    //   neither Commit nor finishing a frame waits for the driver. Off by default. Can only be
+    //   switched while no enqueued list is still waiting for its Commit.
+    virtual void SetSubmissionThreadEnabled(bool enabled) = 0;
+
+    // How many frames the CPU may get ahead of the GPU, 3 by default. 1 or 2 keep input latency
+    //   low, more keep the GPU busy when frame times vary a lot. Call between frames.
+    virtual void SetFramesInFlight(uint32_t count) = 0;
+    // Moves the wait for a free frame from presenting to WaitForNextFrame, which should then be
+    //   called right before input is sampled for the next frame
+    virtual void SetLowLatencyMode(bool enabled) = 0;
+    virtual void WaitForNextFrame() = 0;
+    // Frames submitted but not yet finished by the GPU as a frame is presented, averaged over
+    //   the last few frames
+    virtual float GetQueueDepth() const = 0;
 };
 
 } /* namespace RHI */
@@ -17,6 +17,8 @@ public:
     virtual void BindComputeDescriptorSet(uint32_t set, CDescriptorSet& descriptorSet) = 0;
     virtual void Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) = 0;
     virtual void DispatchIndirect(CBuffer& buffer, size_t offset) = 0;
+    // See ICopyContext::AllocateScratch
+    virtual CBuffer::Ref AllocateScratch(size_t size, size_t alignment = 256) = 0;
 
     virtual void FinishRecording() = 0;
 };
@@ -111,6 +111,17 @@ public:
     virtual void ResolveImage(CImage& src, CImage& dst,
                               const std::vector<CImageResolve>& regions) = 0;
 
+    // Hands memory in a CMemoryHeap over from whatever was placed there before to newImage, or to
+    //   a buffer when newImage is null. Writes through the previous resources are finished and
+    //   the contents of newImage are undefined until it is written.
+    virtual void AliasingBarrier(CImage* newImage) = 0;
+
+    // Device local memory for data the GPU writes and reads within the frame being recorded, e.g.
+    //   indirect arguments or compute temporaries. Much cheaper than a buffer of its own, but it
+    //   can't be mapped, and neither the buffer nor its contents may be used once the queue has
+    //   moved on to the next frame.
+    virtual CBuffer::Ref AllocateScratch(size_t size, size_t alignment = 256) = 0;
+
     virtual void FinishRecording() = 0;
 };
 
@@ -11,6 +11,7 @@
 #include "ShaderModule.h"
 #include "SwapChain.h"
 #include <LangUtils.h>
+#include <vector>
 
 namespace RHI
 {
@@ -24,6 +25,38 @@ enum class EDeviceCreateHints
     Discrete,
 };
 
+struct CMemoryHeapStats
+{
+    size_t Size;
+    // How much this process may use before things go bad, and how much it uses. Without
+    //   driver support the budget is a fixed share of the heap and usage what the RHI allocated.
+    size_t Budget;
+    size_t Usage;
+    bool bIsDeviceLocal;
+};
+
+struct CMemoryStats
+{
+    std::vector<CMemoryHeapStats> Heaps;
+    bool bHasDriverBudget;
+
+    // Bytes held by the RHI itself, by purpose
+    size_t Images;
+    size_t Buffers;
+    size_t Staging;
+    size_t ConstantRing;
+    // Constant ring space taken by the last finished frame, the most any frame has taken so far
+    //   and how many rings the constant ring has grown to. A high water mark close to the
+    //   capacity of a single ring means the initial ring size is too small.
+    size_t ConstantRingLastFrameUsage;
+    size_t ConstantRingHighWaterMark;
+    uint32_t ConstantRingCount;
+    // Memory heaps as a whole, the resources placed in them don't add to Images or Buffers
+    size_t MemoryHeaps;
+    // Descriptor pool memory is up to the driver, this is an estimate
+    size_t DescriptorPools;
+};
+
 template <typename TDerived> class RHI_API CDeviceBase : public tc::FNonCopyable
 {
 public:
@@ -34,18 +67,46 @@ public:
     // Resources and resource views
     CBuffer::Ref CreateBuffer(size_t size, EBufferUsageFlags usage,
                               const void* initialData = nullptr);
+    // initialData is in the image's format unless initialDataFormat says otherwise, e.g. RGB8 or
+    //   float32 texels that get expanded or narrowed while they're uploaded. 3 channel formats the
+    //   device can't sample are created with an alpha channel, GetFormat() of the image tells.
+    //   Views asking for the 3 channel format get the widened one. initialData may be uploaded on
+    //   a separate transfer queue and handed over to the render queue family, so the first
+    //   command list using such an image has to be on a render queue.
     CImage::Ref CreateImage1D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t mipLevels = 1, uint32_t arrayLayers = 1,
-                              uint32_t sampleCount = 1, const void* initialData = nullptr);
+                              uint32_t sampleCount = 1, const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImage::Ref CreateImage2D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t height, uint32_t mipLevels = 1, uint32_t arrayLayers = 1,
-                              uint32_t sampleCount = 1, const void* initialData = nullptr);
+                              uint32_t sampleCount = 1, const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImage::Ref CreateImage3D(EFormat format, EImageUsageFlags usage, uint32_t width,
                               uint32_t height, uint32_t depth, uint32_t mipLevels = 1,
                               uint32_t arrayLayers = 1, uint32_t sampleCount = 1,
-                              const void* initialData = nullptr);
+                              const void* initialData = nullptr,
+                              EFormat initialDataFormat = EFormat::UNDEFINED);
     CImageView::Ref CreateImageView(const CImageViewDesc& desc, CImage::Ref image);
 
+    // Wraps memory the caller owns as a buffer to copy from, saving the copy into a staging
+    //   buffer. pointer and size must be multiples of GetHostImportAlignment(), which is 0 where
+    //   the device can't import host memory. The contents must be in place before the import and
+    //   stay untouched until releaseFence is signaled, once the buffer is gone and the GPU no
+    //   longer reads from it.
+    CBuffer::Ref ImportHostBuffer(const void* pointer, size_t size, CFence::Ref& releaseFence);
+    size_t GetHostImportAlignment() const;
+
+    // Placed resources, whose memory comes from a heap at an offset the caller picks. Images and
+    //   buffers start out with undefined contents. A heap picks memory that suits every one of
+    //   contents, the requirements of the resources that are going to be placed in it.
+    CMemoryHeap::Ref CreateMemoryHeap(size_t size, EMemoryHeapType type,
+                                      const std::vector<CMemoryRequirements>& contents);
+    CMemoryRequirements GetImageMemoryRequirements(const CImageDesc& desc);
+    CMemoryRequirements GetBufferMemoryRequirements(size_t size, EBufferUsageFlags usage);
+    CImage::Ref CreateImageInHeap(const CImageDesc& desc, CMemoryHeap::Ref heap, size_t offset);
+    CBuffer::Ref CreateBufferInHeap(size_t size, EBufferUsageFlags usage, CMemoryHeap::Ref heap,
+                                    size_t offset);
+
     // Shader and resource binding
     CShaderModule::Ref CreateShaderModule(size_t size, const void* pCode);
     CDescriptorSetLayout::Ref
@@ -63,12 +124,24 @@ public:
 
     // Command submission
     CCommandQueue::Ref CreateCommandQueue();
+    // A queue on the family best suited to queueType, index picks one of GetQueueCount(queueType).
+    //   Types that share a family share its queues, so this may return the same queue as before,
+    //   e.g. the default one.
+    CCommandQueue::Ref CreateCommandQueue(EQueueType queueType, uint32_t index = 0);
+    uint32_t GetQueueCount(EQueueType queueType) const;
 
     // Windowing system interface
     CSwapChain::Ref CreateSwapChain(const CPresentationSurfaceDesc& info, EFormat format);
 
     void WaitIdle();
 
+    // Cheap when the driver reports a budget. Without one it walks every memory block, so
+    //   bHasDriverBudget false means it's better called every so often than every frame.
+    CMemoryStats GetMemoryStats() const;
+    // Lets the device move resources around between frames to undo fragmentation, spending up to
+    //   about this much time per frame. 0, the default, turns it off.
+    void SetDefragmentationBudget(float milliseconds);
+
 protected:
     CDeviceBase() = default;
 };
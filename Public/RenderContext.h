@@ -26,10 +26,29 @@ public:
                              uint32_t firstInstance) = 0;
     virtual void DrawIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount, uint32_t stride) = 0;
     virtual void DrawIndexedIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount, uint32_t stride) = 0;
+    // See ICopyContext::AllocateScratch, render bundles can't use it
+    virtual CBuffer::Ref AllocateScratch(size_t size, size_t alignment = 256) = 0;
 
     virtual void FinishRecording() = 0;
 };
 
+// Draws recorded once and then executed every frame without being recorded again, for geometry
+//   that does not change. Whatever it binds has to stay alive and unchanged for as long as it is
+//   executed. Descriptor sets with constants from BindConstants can't be used, those only last a
+//   frame.
+class IRenderBundle
+{
+public:
+    typedef std::shared_ptr<IRenderBundle> Ref;
+    virtual ~IRenderBundle() = default;
+
+    // What is recorded replaces the previous recording once the context is finished. Command lists
+    //   that already execute the previous one keep it until they are done.
+    virtual IRenderContext::Ref Record() = 0;
+    // True until recorded, and again once defragmentation moved resources it may use
+    virtual bool NeedsRecording() const = 0;
+};
+
 // A meta context from which you can create multiple render contexts for a render pass
 class IParallelRenderContext
 {
@@ -37,6 +56,9 @@ public:
     typedef std::shared_ptr<IParallelRenderContext> Ref;
     virtual ~IParallelRenderContext() = default;
     virtual IRenderContext::Ref CreateRenderContext(uint32_t subpass) = 0;
+    // Executed in order with the render contexts created for subpass. The bundle has to be recorded
+    //   for the same subpass of a compatible render pass.
+    virtual void ExecuteBundle(uint32_t subpass, IRenderBundle& bundle) = 0;
     virtual void FinishRecording() = 0;
 };
 
@@ -13,10 +13,14 @@ namespace RHI
 
 enum class EBufferUsageFlags
 {
+    // Only ever the source or destination of copies
+    None = 0,
     VertexBuffer = 1,
     IndexBuffer = 2,
     ConstantBuffer = 4,
     Streaming = 8,
+    // Small buffers may share a larger one with others, which is transparent to users
+    Pooled = 16,
 };
 
 DEFINE_ENUM_CLASS_BITWISE_OPERATORS(EBufferUsageFlags)
@@ -33,6 +37,9 @@ public:
 
     virtual ~CBufferBase() = default;
 
+    size_t GetSize() const { return Size; }
+    EBufferUsageFlags GetUsage() const { return Usage; }
+
     void* Map(size_t offset, size_t size);
     void Unmap();
 
@@ -68,6 +75,12 @@ enum class EImageUsageFlags
     GenMIPMaps = 1 << 4,
     Staging = 1 << 5,
     Storage = 1 << 6,
+    // Contents get replaced and copied around after creation, e.g. by CTextureStreamer
+    Streamed = 1 << 7,
+    // Only ever a RenderTarget or DepthStencil attachment whose contents don't outlive the render
+    //   pass, e.g. MSAA color or depth that is never stored. Tilers keep such images in tile
+    //   memory and never back them with real memory.
+    Transient = 1 << 8,
 };
 
 DEFINE_ENUM_CLASS_BITWISE_OPERATORS(EImageUsageFlags)
@@ -182,4 +195,57 @@ public:
     virtual ~CImageView() = default;
 };
 
+// Memory heap
+
+enum class EMemoryHeapType
+{
+    // Device local, for placed images and buffers the GPU reads and writes
+    DeviceLocal,
+    // Host visible and persistently mapped, placed buffers can be mapped
+    Upload,
+    Readback,
+};
+
+// A single block of memory whose placement is left to the user. Images and buffers created in a
+//   heap at overlapping offsets alias each other: only one of them holds valid contents at a
+//   time, and switching between them takes an AliasingBarrier on the context that uses them.
+//   The heap outlives every resource placed in it.
+class CMemoryHeap : public std::enable_shared_from_this<CMemoryHeap>, public tc::FNonCopyable
+{
+public:
+    typedef std::shared_ptr<CMemoryHeap> Ref;
+
+    virtual ~CMemoryHeap() = default;
+
+    virtual size_t GetSize() const = 0;
+    virtual EMemoryHeapType GetType() const = 0;
+
+protected:
+    CMemoryHeap() = default;
+};
+
+// Everything a placed image is created from, initial data has to be copied in afterwards
+struct CImageDesc
+{
+    EImageType Type = EImageType::Image2D;
+    EFormat Format = EFormat::UNDEFINED;
+    EImageUsageFlags Usage = EImageUsageFlags::None;
+    uint32_t Width = 1;
+    uint32_t Height = 1;
+    uint32_t Depth = 1;
+    uint32_t MipLevels = 1;
+    uint32_t ArrayLayers = 1;
+    uint32_t SampleCount = 1;
+};
+
+// Offsets into a heap have to be a multiple of Alignment, which is coarse enough for buffers and
+//   images to sit next to each other in the same heap
+struct CMemoryRequirements
+{
+    size_t Size;
+    size_t Alignment;
+    // Kinds of memory the resource can live in, as far as the implementation tells them apart
+    uint32_t MemoryTypeBits;
+};
+
 } /* namespace RHI */
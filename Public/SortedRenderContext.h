@@ -0,0 +1,131 @@
+#pragma once
+#include "RenderContext.h"
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace RHI
+{
+
+// Collects draws in whatever order they come and records them into Target sorted by pipeline,
+//   descriptor sets, vertex and index buffers and then depth, so that state changes are as rare as
+//   they get. Only draws with the same state keep their order, so anything that depends on draw
+//   order, blending mostly, belongs in a plain context. Nothing is recorded until Flush or
+//   FinishRecording, and every pipeline, descriptor set and buffer passed in has to stay alive
+//   and unchanged until then.
+class CSortedRenderContext : public IRenderContext
+{
+public:
+    typedef std::shared_ptr<CSortedRenderContext> Ref;
+
+    explicit CSortedRenderContext(IRenderContext::Ref target);
+
+    IRenderContext::Ref GetTarget() const { return Target; }
+    // Orders draws that share all their state, 0 is drawn first and 1 last. Applies to the draws
+    //   that follow.
+    void SetSortDepth(float depth);
+    // Sorts and records everything so far into Target without finishing it
+    void Flush();
+
+    void BindRenderPipeline(CPipeline& pipeline) override;
+    void SetViewport(const CViewportDesc& viewportDesc) override;
+    void SetScissor(const CRect2D& scissor) override;
+    void SetBlendConstants(const std::array<float, 4>& blendConstants) override;
+    void SetStencilReference(uint32_t reference) override;
+    void BindRenderDescriptorSet(uint32_t set, CDescriptorSet& descriptorSet) override;
+    void BindIndexBuffer(CBuffer& buffer, size_t offset, EFormat format) override;
+    void BindVertexBuffer(uint32_t binding, CBuffer& buffer, size_t offset) override;
+    void Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex,
+              uint32_t firstInstance) override;
+    void DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex,
+                     int32_t vertexOffset, uint32_t firstInstance) override;
+    void DrawIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount, uint32_t stride) override;
+    void DrawIndexedIndirect(CBuffer& buffer, size_t offset, uint32_t drawCount,
+                             uint32_t stride) override;
+    // Comes from Target right away
+    CBuffer::Ref AllocateScratch(size_t size, size_t alignment = 256) override;
+
+    // Flushes and finishes Target
+    void FinishRecording() override;
+
+    static constexpr uint32_t MaxDescriptorSets = 8;
+    static constexpr uint32_t MaxVertexBindings = 16;
+
+private:
+    // Everything a draw depends on, captured once per change rather than per draw
+    struct CDrawState
+    {
+        CPipeline* Pipeline = nullptr;
+        std::array<CDescriptorSet*, MaxDescriptorSets> DescriptorSets {};
+        CBuffer* IndexBuffer = nullptr;
+        size_t IndexOffset = 0;
+        EFormat IndexFormat = EFormat::UNDEFINED;
+        std::array<CBuffer*, MaxVertexBindings> VertexBuffers {};
+        std::array<size_t, MaxVertexBindings> VertexOffsets {};
+        bool bHasViewport = false;
+        CViewportDesc Viewport {};
+        bool bHasScissor = false;
+        CRect2D Scissor {};
+        bool bHasBlendConstants = false;
+        std::array<float, 4> BlendConstants {};
+        bool bHasStencilReference = false;
+        uint32_t StencilReference = 0;
+        // Upper bits of the sort key of all draws with this state
+        uint64_t Key = 0;
+    };
+
+    enum class EDrawType : uint8_t
+    {
+        Draw,
+        DrawIndexed,
+        DrawIndirect,
+        DrawIndexedIndirect
+    };
+
+    struct CDrawPacket
+    {
+        EDrawType Type;
+        uint32_t State;
+        // Count, instance count, first vertex or index, vertex offset and first instance. Indirect
+        //   draws use the first two as draw count and stride.
+        std::array<uint32_t, 5> Args;
+        CBuffer* IndirectBuffer;
+        size_t IndirectOffset;
+    };
+
+    struct CSortItem
+    {
+        uint64_t Key;
+        uint32_t Packet;
+    };
+
+    void AddPacket(const CDrawPacket& packet);
+    uint64_t MakeStateKey();
+    void SortPackets();
+    void ApplyState(const CDrawState& state);
+    void Replay(const CDrawPacket& packet);
+
+    IRenderContext::Ref Target;
+
+    CDrawState CurrState;
+    bool bIsStateDirty = true;
+    uint32_t CurrDepth = 0;
+
+    std::vector<CDrawState> States;
+    std::vector<CDrawPacket> Packets;
+    std::vector<CSortItem> SortItems;
+    std::vector<CSortItem> SortScratch;
+
+    // Small ids in first seen order, which is what goes into the keys
+    std::unordered_map<CPipeline*, uint32_t> PipelineIds;
+    std::map<std::array<CDescriptorSet*, MaxDescriptorSets>, uint32_t> DescriptorSetIds;
+    std::map<std::array<CBuffer*, MaxVertexBindings + 1>, uint32_t> BufferIds;
+
+    // What Target was told last during a flush
+    CDrawState AppliedState;
+    bool bHasAppliedState = false;
+    uint32_t AppliedStateIndex = UINT32_MAX;
+};
+
+} /* namespace RHI */
@@ -0,0 +1,143 @@
+#pragma once
+#include "CommandQueue.h"
+#include "Resources.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RHI
+{
+
+// Fills dst with the texels of one mip level, tightly packed. Runs on the streaming thread.
+typedef std::function<void(uint32_t mipLevel, void* dst, size_t size)> CMipLoader;
+
+class CStreamedImage
+{
+public:
+    typedef std::shared_ptr<CStreamedImage> Ref;
+
+    // Null until the mip tail is resident. Covers exactly the resident mips, so it changes whenever
+    //   residency does; fetch it again when (re)binding descriptor sets.
+    CImageView::Ref GetView() const { return View; }
+    // Most detailed mip level that is resident, GetMipLevels() if nothing is yet
+    uint32_t GetResidentMip() const { return ResidentMip; }
+
+    EFormat GetFormat() const { return Format; }
+    uint32_t GetWidth() const { return Width; }
+    uint32_t GetHeight() const { return Height; }
+    uint32_t GetMipLevels() const { return MipLevels; }
+
+    // Safe to call from any thread. Higher priority textures keep their mips when over budget.
+    //   wantedMip is the most detailed level worth having, e.g. derived from screen size.
+    void SetPriority(float priority, uint32_t wantedMip = 0)
+    {
+        Priority.store(priority, std::memory_order_relaxed);
+        WantedMip.store(wantedMip, std::memory_order_relaxed);
+    }
+
+private:
+    friend class CTextureStreamer;
+
+    EFormat Format;
+    uint32_t Width;
+    uint32_t Height;
+    uint32_t MipLevels;
+    uint32_t TailMip;
+    CMipLoader Loader;
+
+    std::atomic<float> Priority { 0.0f };
+    std::atomic<uint32_t> WantedMip { 0 };
+
+    // Image level 0 is mip ImageBaseMip, the view starts at ResidentMip
+    CImage::Ref Image;
+    CImageView::Ref View;
+    uint32_t ImageBaseMip;
+    uint32_t ResidentMip;
+    uint32_t TargetMip;
+    bool bIsLoading = false;
+};
+
+// Keeps the mips of registered images resident on demand within a memory budget. Images always
+//   get their small mip tail; larger levels are loaded on a background thread one at a time,
+//   coarse to fine, for the highest priorities first. Going over budget evicts the finest levels
+//   of the lowest priorities. Views follow the resident levels via CImageViewDesc::Range, images
+//   are only reallocated when a texture's target changes.
+class CTextureStreamer
+{
+public:
+    typedef std::shared_ptr<CTextureStreamer> Ref;
+
+    CTextureStreamer(CDevice& device, CCommandQueue::Ref queue, size_t budget);
+    ~CTextureStreamer();
+
+    // Throws for formats the streamer does not know the block size of
+    CStreamedImage::Ref Register(EFormat format, uint32_t width, uint32_t height,
+                                 uint32_t mipLevels, CMipLoader loader);
+    void Unregister(const CStreamedImage::Ref& image);
+
+    void SetBudget(size_t budget) { Budget = budget; }
+    size_t GetBudget() const { return Budget; }
+    // Bytes held by streamed images, including levels that are allocated but still loading
+    size_t GetAllocatedSize() const { return AllocatedSize; }
+    // Limits the staging memory of loads in flight, which bounds the upload work per frame
+    void SetMaxInFlightUpload(size_t bytes) { MaxInFlightUpload = bytes; }
+
+    // Call once per frame on the thread that records. Retired images are kept until the queue has
+    //   finished everything recorded up to the next call.
+    void Update();
+
+    static size_t GetMipSize(EFormat format, uint32_t width, uint32_t height, uint32_t mip);
+    // Mips no larger than this are always resident
+    static const uint32_t TailDimension = 64;
+
+private:
+    struct CLoadRequest
+    {
+        CStreamedImage::Ref Image;
+        uint32_t FirstMip;
+        uint32_t EndMip;
+        CBuffer::Ref Staging;
+        void* Mapped;
+    };
+
+    struct CRetired
+    {
+        CImage::Ref Image;
+        CImageView::Ref View;
+        CBuffer::Ref Staging;
+        // Queue point to wait for before they can go
+        uint64_t Point;
+    };
+
+    size_t GetImageSize(const CStreamedImage& image, uint32_t baseMip) const;
+    std::vector<CStreamedImage::Ref> UpdateTargets();
+    void Reallocate(ICopyContext& ctx, CStreamedImage& image, uint32_t baseMip);
+    void UpdateView(CStreamedImage& image);
+    void Retire(CImage::Ref image, CImageView::Ref view, CBuffer::Ref staging);
+    void RequestLoad(CStreamedImage::Ref image, uint32_t firstMip, uint32_t endMip);
+    void FinishLoad(ICopyContext& ctx, CLoadRequest& request);
+    void LoaderThread();
+
+    CDevice& Device;
+    CCommandQueue::Ref Queue;
+    size_t Budget;
+    size_t AllocatedSize = 0;
+    size_t MaxInFlightUpload = 32 << 20;
+    size_t InFlightUpload = 0;
+
+    std::vector<CStreamedImage::Ref> Images;
+    std::deque<CRetired> Retired;
+
+    std::mutex LoadMutex;
+    std::condition_variable LoadCondition;
+    std::deque<CLoadRequest> PendingLoads;
+    std::vector<CLoadRequest> FinishedLoads;
+    bool bIsStopping = false;
+    std::thread Thread;
+};
+
+} /* namespace RHI */